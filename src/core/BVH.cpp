@@ -0,0 +1,473 @@
+#include "BVH.h"
+#include "Scene.h"
+
+//  SAH constants - relative cost of stepping into a node vs. testing an object
+//
+static const float traversalCost = 0.5f;
+static const float intersectCost = 1.0f;
+static const int nBins = 12;
+static const int maxDepth = 48;         // past this, fall back to median splits
+static const int stackSize = 128;
+
+void BVH::build(const SceneStore &store) {
+    nodes.clear();
+    prims.clear();
+    unbounded.clear();
+    this->store = &store;
+    layout = store.getLayout();
+    buildCost = 0;
+    
+    vector<BVHBuildRef> refs;
+    refs.reserve(store.size());
+    for (int prim = 0; prim < store.size(); prim++) {
+        if (bSkipLights && store.isLight(prim)) continue;
+        AABB bounds;
+        if (getBounds(prim, bounds)) refs.push_back({ bounds, bounds.center(), prim });
+        else unbounded.push_back(prim);
+    }
+    if (!refs.empty()) {
+        nodes.reserve(2 * refs.size());
+        prims.reserve(refs.size());
+        buildBVH(refs, maxLeafSize, nodes, prims);
+    }
+    buildCost = cost();
+    updateLeafArrays();
+}
+
+void BVH::build(const SceneStore &store, const PrebuiltBVH &prebuilt) {
+    // every primitive the tree would hold must appear exactly once
+    //
+    int expected = 0;
+    for (int prim = 0; prim < store.size(); prim++) expected += !(bSkipLights && store.isLight(prim));
+    vector<unsigned char> seen(store.size(), 0);
+    bool valid = prebuilt.primCount + prebuilt.unboundedCount == expected;
+    for (int i = 0; i < prebuilt.primCount && valid; i++) {
+        int prim = prebuilt.prims[i];
+        valid = prim >= 0 && prim < store.size() && !seen[prim]++;
+    }
+    for (int i = 0; i < prebuilt.unboundedCount && valid; i++) {
+        int prim = prebuilt.unbounded[i];
+        valid = prim >= 0 && prim < store.size() && !seen[prim]++;
+    }
+    for (int i = 0; i < prebuilt.nodeCount && valid; i++) {
+        const BVHNode &node = prebuilt.nodes[i];
+        valid = node.count > 0 ? node.offset >= 0 && node.offset + node.count <= prebuilt.primCount
+                               : node.offset > i + 1 && node.offset < prebuilt.nodeCount && node.axis < 3;
+    }
+    if (!valid) {
+        ofLogWarning("BVH") << "prebuilt tree doesn't match the scene, rebuilding";
+        build(store);
+        return;
+    }
+    
+    nodes.assign(prebuilt.nodes, prebuilt.nodes + prebuilt.nodeCount);
+    prims.assign(prebuilt.prims, prebuilt.prims + prebuilt.primCount);
+    unbounded.assign(prebuilt.unbounded, prebuilt.unbounded + prebuilt.unboundedCount);
+    this->store = &store;
+    layout = store.getLayout();
+    buildCost = cost();
+    updateLeafArrays();
+}
+
+PrebuiltBVH BVH::getPrebuilt() const {
+    PrebuiltBVH prebuilt;
+    prebuilt.nodes = nodes.data();
+    prebuilt.nodeCount = nodes.size();
+    prebuilt.prims = prims.data();
+    prebuilt.primCount = prims.size();
+    prebuilt.unbounded = unbounded.data();
+    prebuilt.unboundedCount = unbounded.size();
+    return prebuilt;
+}
+
+bool BVH::getBounds(int prim, AABB &bounds) const {
+    switch (store->type(prim)) {
+        case PRIM_SPHERE: {
+            glm::vec3 r(store->spheres.radius[prim]);
+            bounds = AABB(store->spheres.center(prim) - r, store->spheres.center(prim) + r);
+            return true;
+        }
+        case PRIM_PLANE:
+            return false;
+        case PRIM_INSTANCE:
+            return store->instances[prim - store->firstInstance()].getBounds(bounds);
+        default:
+            return store->getObject(prim)->getBounds(bounds);
+    }
+}
+
+// Copy sphere centers/radii and plane points/normals from the store into
+// leaf order (lights are spheres too)
+//
+void BVH::updateLeafArrays() {
+    spheres.clear();
+    spheres.resize(prims.size());
+    bAllSpheres = true;
+    for (int i = 0; i < prims.size(); i++) {
+        int prim = prims[i];
+        if (store->type(prim) == PRIM_SPHERE) spheres.set(i, store->spheres.center(prim), store->spheres.radius[prim]);
+        else bAllSpheres = false;
+    }
+    planes.clear();
+    for (int prim : unbounded) {
+        if (store->type(prim) == PRIM_PLANE) {
+            int plane = prim - store->sphereCount();
+            planes.add(store->planes.point(plane), store->planes.normal(plane));
+        }
+        else planes.add(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0));
+    }
+}
+
+// Recompute every node's bounds from the primitives' current positions
+// without changing the tree's topology.  Children are always stored after
+// their parent, so one backwards pass over the node array is bottom-up.
+//
+void BVH::refit() {
+    for (int index = nodes.size() - 1; index >= 0; index--) {
+        BVHNode &node = nodes[index];
+        AABB bounds;
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                AABB b;
+                getBounds(prims[i], b);
+                bounds.grow(b);
+            }
+        }
+        else {
+            const BVHNode &left = nodes[index + 1];
+            const BVHNode &right = nodes[node.offset];
+            bounds.grow(AABB(left.min, left.max));
+            bounds.grow(AABB(right.min, right.max));
+        }
+        node.min = bounds.min;
+        node.max = bounds.max;
+    }
+    updateLeafArrays();
+}
+
+// Refit if only positions changed, rebuild if objects were added or removed
+// or the refitted tree has become too loose to be worth traversing.
+//
+void BVH::update(const SceneStore &store) {
+    stats = BVHStats();
+    bool sameLayout = isBuiltOver(store);
+    if (sameLayout && !nodes.empty()) {
+        uint64_t start = ofGetElapsedTimeMicros();
+        refit();
+        stats.refits++;
+        stats.refitMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+        stats.costRatio = buildCost > 0 ? cost() / buildCost : 1;
+        if (stats.costRatio <= rebuildThreshold) return;
+    }
+    else if (sameLayout && unbounded.size() == store.size()) {
+        updateLeafArrays();
+        return;     // nothing bounded, nothing to refit
+    }
+    uint64_t start = ofGetElapsedTimeMicros();
+    build(store);
+    stats.rebuilds++;
+    stats.rebuildMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+}
+
+float BVH::cost() const {
+    return bvhCost(nodes);
+}
+
+float bvhCost(const vector<BVHNode> &nodes) {
+    if (nodes.empty()) return 0;
+    float rootArea = AABB(nodes[0].min, nodes[0].max).area();
+    if (rootArea <= 0) return 0;
+    float total = 0;
+    for (const BVHNode &node : nodes) {
+        float area = AABB(node.min, node.max).area() / rootArea;
+        if (node.count > 0) total += area * node.count * intersectCost;
+        else total += area * traversalCost;
+    }
+    return total;
+}
+
+static int buildRecursive(vector<BVHBuildRef> &refs, int first, int last, int depth, int maxLeafSize, vector<BVHNode> &nodes, vector<int> &order) {
+    int index = nodes.size();
+    nodes.push_back(BVHNode());
+    
+    AABB bounds, centers;
+    for (int i = first; i < last; i++) {
+        bounds.grow(refs[i].bounds);
+        centers.grow(refs[i].center);
+    }
+    nodes[index].min = bounds.min;
+    nodes[index].max = bounds.max;
+    int n = last - first;
+    
+    // Binned SAH: drop the centers into equal width bins along each axis and
+    // sweep the bin boundaries for the cheapest split
+    //
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = n * intersectCost;
+    glm::vec3 extent = centers.max - centers.min;
+    if (n > 1 && depth < maxDepth) {
+        float parentArea = bounds.area();
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0) continue;
+            float scale = nBins / extent[axis];
+            AABB binBounds[nBins];
+            int binCount[nBins] = { 0 };
+            for (int i = first; i < last; i++) {
+                int b = std::min(nBins - 1, (int)((refs[i].center[axis] - centers.min[axis]) * scale));
+                binBounds[b].grow(refs[i].bounds);
+                binCount[b]++;
+            }
+            
+            // right-to-left sweep stores the right half of every split,
+            // left-to-right sweep completes the cost
+            //
+            float rightArea[nBins];
+            int rightCount[nBins];
+            AABB acc;
+            int count = 0;
+            for (int b = nBins - 1; b > 0; b--) {
+                acc.grow(binBounds[b]);
+                count += binCount[b];
+                rightArea[b] = acc.area();
+                rightCount[b] = count;
+            }
+            acc = AABB();
+            count = 0;
+            for (int b = 1; b < nBins; b++) {
+                acc.grow(binBounds[b - 1]);
+                count += binCount[b - 1];
+                if (count == 0 || rightCount[b] == 0) continue;
+                float cost = traversalCost + intersectCost * (acc.area() * count + rightArea[b] * rightCount[b]) / parentArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+    }
+    
+    if (bestAxis < 0 && n <= maxLeafSize) {
+        nodes[index].offset = order.size();
+        nodes[index].count = n;
+        nodes[index].axis = 0;
+        for (int i = first; i < last; i++) order.push_back(refs[i].prim);
+        return index;
+    }
+    
+    int mid;
+    if (bestAxis >= 0) {
+        float scale = nBins / extent[bestAxis];
+        float lo = centers.min[bestAxis];
+        mid = std::partition(refs.begin() + first, refs.begin() + last, [&](const BVHBuildRef &r) {
+            return std::min(nBins - 1, (int)((r.center[bestAxis] - lo) * scale)) < bestSplit;
+        }) - refs.begin();
+    }
+    else {
+        // no useful SAH split (too deep, or centers all coincide) but too
+        // many objects for one leaf - split at the median of the longest axis
+        //
+        bestAxis = 0;
+        if (extent.y > extent[bestAxis]) bestAxis = 1;
+        if (extent.z > extent[bestAxis]) bestAxis = 2;
+        mid = (first + last) / 2;
+        std::nth_element(refs.begin() + first, refs.begin() + mid, refs.begin() + last, [&](const BVHBuildRef &a, const BVHBuildRef &b) {
+            return a.center[bestAxis] < b.center[bestAxis];
+        });
+    }
+    
+    nodes[index].count = 0;
+    nodes[index].axis = bestAxis;
+    buildRecursive(refs, first, mid, depth + 1, maxLeafSize, nodes, order);
+    int second = buildRecursive(refs, mid, last, depth + 1, maxLeafSize, nodes, order);
+    nodes[index].offset = second;
+    return index;
+}
+
+void buildBVH(vector<BVHBuildRef> &refs, int maxLeafSize, vector<BVHNode> &nodes, vector<int> &order) {
+    if (refs.empty()) return;
+    buildRecursive(refs, 0, refs.size(), 0, maxLeafSize, nodes, order);
+}
+
+// Closest hit.  Distances are measured along the ray from ray.p, so the ray
+// direction is expected to be normalized (as RenderCam::getRay() returns).
+//
+bool BVH::intersect(const Ray &ray, int &prim, float &t) const {
+    float closest = std::numeric_limits<float>::infinity();
+    float distance;
+    prim = -1;
+    
+    for (int u = 0; u < unbounded.size(); u++) {
+        bool hit = store->type(unbounded[u]) == PRIM_PLANE ?
+            glm::intersectRayPlane(ray.p, ray.d, planes.point(u), planes.normal(u), distance) :
+            store->intersect(unbounded[u], ray, distance);
+        if (hit && distance < closest) {
+            closest = distance;
+            prim = unbounded[u];
+        }
+    }
+    if (!nodes.empty()) {
+        glm::vec3 invDir = 1.0f / ray.d;
+        int stack[stackSize];
+        int top = 0;
+        int current = 0;
+        while (true) {
+            const BVHNode &node = nodes[current];
+            float tEntry;
+            if (intersectBox(node.min, node.max, ray.p, invDir, closest, tEntry)) {
+                if (node.count > 0) {
+                    for (int i = node.offset; i < node.offset + node.count; i++) {
+                        bool hit = spheres.radius2[i] >= 0 ?
+                            glm::intersectRaySphere(ray.p, ray.d, spheres.center(i), spheres.radius2[i], distance) :
+                            store->intersect(prims[i], ray, distance);
+                        if (hit && distance < closest) {
+                            closest = distance;
+                            prim = prims[i];
+                        }
+                    }
+                }
+                else {
+                    // visit the child on the near side of the split first so the
+                    // far one is more likely to be culled by the closer hit
+                    //
+                    if (ray.d[node.axis] < 0) {
+                        stack[top++] = current + 1;
+                        current = node.offset;
+                    }
+                    else {
+                        stack[top++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+            if (top == 0) break;
+            current = stack[--top];
+        }
+    }
+    t = closest;
+    return prim >= 0;
+}
+
+// Closest hit for a packet of rays.  A node is entered if any ray of the packet
+// can still find a closer hit inside it; the leaves' spheres are then tested
+// against all rays at once.
+//
+void BVH::intersect(const RayPacket &rays, int prim[]) const {
+    const PacketKernels &kernels = packetKernels();
+    PacketHits hits;
+    hits.reset(rays.size);
+    
+    // ids below prims.size() are prims, the rest are unbounded objects
+    //
+    int nPrims = prims.size();
+    kernels.planes(rays, planes, 0, planes.size(), nPrims, hits);
+    for (int u = 0; u < unbounded.size(); u++) {
+        if (store->type(unbounded[u]) == PRIM_PLANE) continue;
+        for (int i = 0; i < rays.size; i++) {
+            float distance;
+            if (store->intersect(unbounded[u], rays.get(i), distance) && distance < hits.t[i]) {
+                hits.t[i] = distance;
+                hits.id[i] = nPrims + u;
+            }
+        }
+    }
+    
+    if (!nodes.empty()) {
+        glm::vec3 orig[maxPacketSize], invDir[maxPacketSize];
+        for (int i = 0; i < rays.size; i++) {
+            orig[i] = glm::vec3(rays.ox[i], rays.oy[i], rays.oz[i]);
+            invDir[i] = 1.0f / glm::vec3(rays.dx[i], rays.dy[i], rays.dz[i]);
+        }
+        float dirSign[3] = { rays.dx[0], rays.dy[0], rays.dz[0] };
+        
+        int stack[stackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            int current = stack[--top];
+            const BVHNode &node = nodes[current];
+            bool visit = false;
+            float tEntry;
+            for (int i = 0; i < rays.size && !visit; i++) {
+                visit = intersectBox(node.min, node.max, orig[i], invDir[i], hits.t[i], tEntry);
+            }
+            if (!visit) continue;
+            
+            if (node.count > 0) {
+                kernels.spheres(rays, spheres, node.offset, node.offset + node.count, 0, hits);
+                if (bAllSpheres) continue;
+                for (int k = node.offset; k < node.offset + node.count; k++) {
+                    if (spheres.radius2[k] >= 0) continue;
+                    for (int i = 0; i < rays.size; i++) {
+                        float distance;
+                        if (store->intersect(prims[k], rays.get(i), distance) && distance < hits.t[i]) {
+                            hits.t[i] = distance;
+                            hits.id[i] = k;
+                        }
+                    }
+                }
+            }
+            else {
+                // packets are coherent, so order children by the first ray
+                //
+                if (dirSign[node.axis] < 0) {
+                    stack[top++] = current + 1;
+                    stack[top++] = node.offset;
+                }
+                else {
+                    stack[top++] = node.offset;
+                    stack[top++] = current + 1;
+                }
+            }
+        }
+    }
+    
+    for (int i = 0; i < rays.size; i++) {
+        int id = hits.id[i];
+        prim[i] = id < 0 ? -1 : (id < nPrims ? prims[id] : unbounded[id - nPrims]);
+    }
+}
+
+// Any hit - used for shadow rays, where the first blocker found ends the search
+//
+bool BVH::occluded(const Ray &ray, float tMax, int &prim) const {
+    float distance;
+    for (int u = 0; u < unbounded.size(); u++) {
+        bool hit = store->type(unbounded[u]) == PRIM_PLANE ?
+            glm::intersectRayPlane(ray.p, ray.d, planes.point(u), planes.normal(u), distance) && distance < tMax :
+            store->occluded(unbounded[u], ray, tMax);
+        if (hit) {
+            prim = unbounded[u];
+            return true;
+        }
+    }
+    if (nodes.empty()) return false;
+    
+    glm::vec3 invDir = 1.0f / ray.d;
+    int stack[stackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode &node = nodes[stack[--top]];
+        float tEntry;
+        if (!intersectBox(node.min, node.max, ray.p, invDir, tMax, tEntry)) continue;
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                bool hit = spheres.radius2[i] >= 0 ?
+                    glm::intersectRaySphere(ray.p, ray.d, spheres.center(i), spheres.radius2[i], distance) && distance < tMax :
+                    store->occluded(prims[i], ray, tMax);
+                if (hit) {
+                    prim = prims[i];
+                    return true;
+                }
+            }
+        }
+        else {
+            stack[top++] = node.offset;
+            stack[top++] = &node - nodes.data() + 1;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RayPacket.h"
+#include "SceneStore.h"
+
+class Ray;
+
+//  Axis aligned bounding box
+//
+class AABB {
+public:
+    AABB() { }
+    AABB(const glm::vec3 &min, const glm::vec3 &max) { this->min = min; this->max = max; }
+    
+    void grow(const glm::vec3 &p) { min = glm::min(min, p); max = glm::max(max, p); }
+    void grow(const AABB &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    bool isEmpty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    float area() const {
+        if (isEmpty()) return 0;
+        glm::vec3 e = max - min;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+    
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+};
+
+//  Per-frame counters for BVH maintenance, filled in by BVH::update()
+//
+struct BVHStats {
+    int refits = 0;
+    int rebuilds = 0;
+    float refitMs = 0;
+    float rebuildMs = 0;
+    float costRatio = 1;    // SAH cost now vs. right after the last build
+};
+
+//  A node of a flattened BVH.  Nodes are stored depth first in one array: an
+//  interior node's first child directly follows it and only the second
+//  child's index is stored, which keeps each node at 32 bytes (two per cache
+//  line).
+//
+struct BVHNode {
+    glm::vec3 min;
+    int offset;             // leaf: first slot in the leaf order, interior: second child
+    glm::vec3 max;
+    uint16_t count;         // primitives in a leaf, 0 for interior nodes
+    uint16_t axis;          // split axis, used to visit the near child first
+};
+
+//  A built BVH's arrays, as compiled into a binary scene file (see
+//  SceneFile.h)
+//
+struct PrebuiltBVH {
+    const BVHNode *nodes = nullptr;
+    int nodeCount = 0;
+    const int *prims = nullptr;
+    int primCount = 0;
+    const int *unbounded = nullptr;
+    int unboundedCount = 0;
+};
+
+struct BVHBuildRef {
+    AABB bounds;
+    glm::vec3 center;
+    int prim;
+};
+
+//  Top-down binned SAH build, shared by the scene BVH and the per-mesh
+//  triangle BVHs.  Appends the tree to nodes and the primitives, in leaf
+//  order, to order.  refs is reordered.
+//
+void buildBVH(vector<BVHBuildRef> &refs, int maxLeafSize, vector<BVHNode> &nodes, vector<int> &order);
+
+//  Expected cost of a random ray against the tree, relative to the root box
+//
+float bvhCost(const vector<BVHNode> &nodes);
+
+//  Slab test - returns the entry distance of the ray into the box in tEntry
+//
+inline bool intersectBox(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &orig, const glm::vec3 &invDir, float tMax, float &tEntry) {
+    glm::vec3 t0 = (min - orig) * invDir;
+    glm::vec3 t1 = (max - orig) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return tEntry <= tExit;
+}
+
+//  Bounding volume hierarchy over the primitives of a SceneStore
+//
+//  Built top-down with binned SAH over every primitive with finite bounds
+//  (spheres, lights, and instances of meshes and sphere sets, which have
+//  BVHs of their own below this one).  Unbounded primitives such as the
+//  infinite ground plane can't live in a box, so they are kept in a
+//  separate list and tested against every ray.  Hits are reported as
+//  SceneStore primitive ids.
+//
+//  For animation, update() refits the existing tree bottom-up when objects
+//  have only moved, and only rebuilds from scratch when the store's layout
+//  changes or the refitted tree's SAH cost has degraded past
+//  rebuildThreshold times its cost when it was built.
+//
+class BVH {
+public:
+    void build(const SceneStore &store);
+    void refit();
+    void update(const SceneStore &store);     // the store must outlive its use here
+    
+    // Take a tree built over the same store layout earlier (loaded with the
+    // scene) instead of building one.  Its arrays are copied, since refits
+    // write to them; update() then refits it to the current positions.
+    // Falls back to build() if the tree doesn't match the store.
+    //
+    void build(const SceneStore &store, const PrebuiltBVH &prebuilt);
+    bool isBuiltOver(const SceneStore &store) const { return &store == this->store && store.getLayout() == layout; }
+    PrebuiltBVH getPrebuilt() const;            // views of this tree's arrays, to save it
+    
+    float cost() const;     // SAH cost of the current tree
+    const BVHStats & getStats() const { return stats; }
+    
+    // closest hit along the ray - the primitive hit and its distance.  The
+    // caller gets the point and normal from SceneStore::intersect().
+    //
+    bool intersect(const Ray &ray, int &prim, float &t) const;
+    
+    // closest hit for every ray of a packet - prim[i] is the primitive ray i
+    // hits first, or -1.  Spheres and planes go through the SIMD packet
+    // kernels.
+    //
+    void intersect(const RayPacket &rays, int prim[]) const;
+    
+    // any hit closer than tMax (the distance to a light, for a shadow ray) -
+    // true as soon as one primitive blocks the ray, which is returned in
+    // prim.  Lights block rays too unless the tree was built with
+    // bSkipLights.
+    //
+    bool occluded(const Ray &ray, float tMax, int &prim) const;
+    bool occluded(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const {
+        int prim;
+        return occluded(ray, tMax, prim);
+    }
+    
+    int nodeCount() const { return nodes.size(); }
+    
+    int maxLeafSize = 4;
+    float rebuildThreshold = 1.5;
+    bool bSkipLights = false;       // leave the lights' spheres out of the tree (shadow rays)
+    
+private:
+    bool getBounds(int prim, AABB &bounds) const;
+    void updateLeafArrays();
+    
+    vector<BVHNode> nodes;
+    vector<int> prims;                  // bounded primitives in leaf order
+    vector<int> unbounded;              // infinite planes etc.
+    const SceneStore *store = nullptr;  // store the tree was built over
+    unsigned long layout = 0;           // and its layout at the time
+    
+    // leaf order copies of the store's spheres and planes, so a leaf's
+    // spheres are contiguous for the packet kernels: slot i of spheres is
+    // prims[i] (radius2 < 0 if it isn't a sphere), slot i of planes is
+    // unbounded[i] (zero normal, so it never hits, if it isn't a plane)
+    //
+    SphereArrays spheres;
+    PlaneArrays planes;
+    bool bAllSpheres = true;
+    float buildCost = 0;
+    BVHStats stats;
+};
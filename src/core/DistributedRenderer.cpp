@@ -0,0 +1,459 @@
+#include "DistributedRenderer.h"
+#include "SceneFile.h"
+#include "MeshLoader.h"
+#include "ImageWriter.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+//  Protocol.  A worker says hello, the coordinator answers with the scene
+//  and then jobs, and the worker answers every job with its result, or an
+//  error and hangs up.
+//
+enum MessageType : uint32_t {
+    MSG_HELLO = 1,      // worker: protocol version, threads
+    MSG_SCENE,          // coordinator: settings, image size, compiled scene
+    MSG_JOB,            // coordinator: job id, frame, x, y, width, height
+    MSG_RESULT,         // worker: job id, rays, compressed pixels
+    MSG_ERROR,          // worker: what went wrong
+    MSG_DONE            // coordinator: no more jobs
+};
+
+static const uint32_t protocolVersion = 1;
+
+//  Message payloads, field by field.  A reader that runs past the end
+//  returns zeros and clears ok.
+//
+struct MessageWriter {
+    template <typename T> void put(const T &value) { append(&value, sizeof(value)); }
+    void append(const void *data, size_t size) { bytes.insert(bytes.end(), (const char *)data, (const char *)data + size); }
+    
+    vector<char> bytes;
+};
+
+struct MessageReader {
+    MessageReader(const vector<char> &bytes) : p(bytes.data()), end(bytes.data() + bytes.size()) { }
+    
+    template <typename T> T get() {
+        T value = T();
+        if ((size_t)(end - p) < sizeof(T)) {
+            ok = false;
+            p = end;
+            return value;
+        }
+        memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+    
+    const char *p;
+    const char *end;
+    bool ok = true;
+};
+
+static void putSettings(MessageWriter &out, const RenderSettings &settings) {
+    out.put(settings.ambientPercent);
+    out.put(settings.lightIntensity);
+    out.put<int32_t>(settings.phongExponent);
+    out.put<int32_t>(settings.spotlightAngle);
+    out.put<int32_t>(settings.nSquares);
+    out.put<uint8_t>(settings.adaptive);
+    out.put(settings.adaptiveThreshold);
+    out.put<int32_t>(settings.lightSamples);
+    out.put<int32_t>(settings.lightBudget);
+    out.put<int32_t>(settings.maxDepth);
+}
+
+static RenderSettings getSettings(MessageReader &in) {
+    RenderSettings settings;
+    settings.ambientPercent = in.get<float>();
+    settings.lightIntensity = in.get<float>();
+    settings.phongExponent = in.get<int32_t>();
+    settings.spotlightAngle = in.get<int32_t>();
+    settings.nSquares = in.get<int32_t>();
+    settings.adaptive = in.get<uint8_t>();
+    settings.adaptiveThreshold = in.get<float>();
+    settings.lightSamples = in.get<int32_t>();
+    settings.lightBudget = in.get<int32_t>();
+    settings.maxDepth = in.get<int32_t>();
+    return settings;
+}
+
+//  Tiles travel delta coded - every byte minus the same channel of the
+//  pixel to its left, which turns flat and smoothly shaded areas into runs
+//  of zeros and small values - then run length coded (PackBits: a count
+//  byte c, then c + 1 literal bytes if c < 128, or one byte repeated
+//  c - 126 times).  Lossless, so the coordinator gets the worker's exact
+//  pixels.
+//
+static void compressPixels(const ofPixels &pixels, vector<char> &out) {
+    size_t row = pixels.getWidth() * 3;
+    vector<unsigned char> deltas(row * pixels.getHeight());
+    for (size_t j = 0; j < pixels.getHeight(); j++) {
+        const unsigned char *in = pixels.getData() + j * row;
+        unsigned char *d = deltas.data() + j * row;
+        for (size_t k = 0; k < row; k++) d[k] = k < 3 ? in[k] : in[k] - in[k - 3];
+    }
+    
+    const unsigned char *b = deltas.data();
+    size_t n = deltas.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 129 && b[i + run] == b[i]) run++;
+        if (run >= 2) {
+            out.push_back((char)(run + 126));
+            out.push_back((char)b[i]);
+            i += run;
+            continue;
+        }
+        size_t start = i;
+        while (i < n && i - start < 128 && !(i + 1 < n && b[i + 1] == b[i])) i++;
+        out.push_back((char)(i - start - 1));
+        out.insert(out.end(), (const char *)b + start, (const char *)b + i);
+    }
+}
+
+// Into pixels, already allocated at the tile's size.  False if the data
+// doesn't decode to exactly that many bytes.
+//
+static bool decompressPixels(const char *data, size_t size, ofPixels &pixels) {
+    size_t row = pixels.getWidth() * 3;
+    size_t n = row * pixels.getHeight();
+    unsigned char *out = pixels.getData();
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+    size_t o = 0;
+    while (p < end) {
+        int c = *p++;
+        if (c < 128) {
+            size_t count = c + 1;
+            if (end - p < (ptrdiff_t)count || o + count > n) return false;
+            memcpy(out + o, p, count);
+            p += count;
+            o += count;
+        }
+        else {
+            size_t count = c - 126;
+            if (p == end || o + count > n) return false;
+            memset(out + o, *p++, count);
+            o += count;
+        }
+    }
+    if (o != n) return false;
+    
+    for (size_t j = 0; j < pixels.getHeight(); j++) {
+        unsigned char *d = out + j * row;
+        for (size_t k = 3; k < row; k++) d[k] += d[k - 3];
+    }
+    return true;
+}
+
+//--------------------------------------------------------------
+// Coordinator
+
+#ifdef _WIN32
+
+bool RenderCoordinator::render(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext, const string &address) {
+    ofLogError("RenderCoordinator") << "distributed rendering isn't supported on Windows";
+    return false;
+}
+
+#else
+
+bool RenderCoordinator::render(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext, const string &address) {
+    uint64_t start = ofGetElapsedTimeMicros();
+    stats = DistributedStats();
+    
+    // the jobs, frame by frame, and how many regions each frame still needs
+    //
+    struct Job {
+        int frame, x, y, width, height;
+    };
+    std::deque<Job> jobs;
+    std::map<int, int> remaining;
+    int size = regionSize > 0 ? regionSize : std::max(width, height);
+    for (int frame = first; frame <= last; frame++) {
+        if (bResume && ofFile::doesFileExist(ImageWriter::framePath(prefix, frame, ext))) {
+            stats.skipped++;
+            continue;
+        }
+        for (int y = 0; y < height; y += size) {
+            for (int x = 0; x < width; x += size) {
+                jobs.push_back({ frame, x, y, std::min(size, width - x), std::min(size, height - y) });
+                remaining[frame]++;
+            }
+        }
+    }
+    if (jobs.empty()) return true;
+    
+    // what every worker gets first
+    //
+    std::ostringstream compiled;
+    string error;
+    if (!saveSceneBinary(scene, compiled, error)) {
+        ofLogError("RenderCoordinator") << "can't compile the scene: " << error;
+        return false;
+    }
+    MessageWriter sceneMessage;
+    putSettings(sceneMessage, settings);
+    sceneMessage.put<int32_t>(width);
+    sceneMessage.put<int32_t>(height);
+    string sceneBytes = compiled.str();
+    sceneMessage.append(sceneBytes.data(), sceneBytes.size());
+    
+    Socket server;
+    if (!server.listen(address)) return false;
+    ofLogNotice("RenderCoordinator") << jobs.size() << " jobs, waiting for workers on " << address;
+    
+    struct Worker {
+        unique_ptr<Socket> socket;
+        std::map<uint32_t, Job> assigned;   // by job id
+        bool bReady = false;                // has the scene
+        uint64_t lastHeard = 0;
+    };
+    vector<Worker> workers;
+    std::map<int, ofPixels> frames;         // being assembled
+    ImageWriter writer;
+    uint32_t nextJob = 0;
+    uint64_t idleSince = start;
+    bool ok = true;
+    
+    // a failed worker's jobs go back to the front of the queue, in order,
+    // so the frames they hold up are finished first
+    //
+    auto drop = [&](Worker &worker, const string &why) {
+        ofLogWarning("RenderCoordinator") << "worker " << worker.socket->getName() << " " << why
+                                          << (worker.assigned.empty() ? "" : ", reassigning its jobs");
+        for (auto job = worker.assigned.rbegin(); job != worker.assigned.rend(); ++job) jobs.push_front(job->second);
+        stats.reassigned += worker.assigned.size();
+        worker.assigned.clear();
+        worker.socket->close();
+    };
+    
+    while (!remaining.empty()) {
+        uint64_t now = ofGetElapsedTimeMicros();
+        for (Worker &worker : workers) {
+            while (worker.bReady && worker.socket->isOpen() && (int)worker.assigned.size() < jobsPerWorker && !jobs.empty()) {
+                Job job = jobs.front();
+                MessageWriter message;
+                message.put(nextJob);
+                message.put<int32_t>(job.frame);
+                message.put<int32_t>(job.x);
+                message.put<int32_t>(job.y);
+                message.put<int32_t>(job.width);
+                message.put<int32_t>(job.height);
+                if (!worker.socket->send(MSG_JOB, message.bytes.data(), message.bytes.size())) {
+                    drop(worker, "disconnected");
+                    break;
+                }
+                if (worker.assigned.empty()) worker.lastHeard = now;    // the clock starts when it has work
+                worker.assigned[nextJob++] = job;
+                jobs.pop_front();
+            }
+        }
+        workers.erase(std::remove_if(workers.begin(), workers.end(), [](const Worker &w) { return !w.socket->isOpen(); }), workers.end());
+        if (!workers.empty()) idleSince = now;
+        else if (now - idleSince > timeout * 1e6) {
+            ofLogError("RenderCoordinator") << "no workers for " << timeout << " seconds, giving up";
+            ok = false;
+            break;
+        }
+        
+        // wait for a worker to connect or answer
+        //
+        vector<pollfd> polled(1 + workers.size());
+        polled[0] = { server.getHandle(), POLLIN, 0 };
+        for (size_t k = 0; k < workers.size(); k++) polled[k + 1] = { workers[k].socket->getHandle(), POLLIN, 0 };
+        if (poll(polled.data(), polled.size(), 100) < 0 && errno != EINTR) {
+            ofLogError("RenderCoordinator") << "poll failed: " << strerror(errno);
+            ok = false;
+            break;
+        }
+        now = ofGetElapsedTimeMicros();
+        
+        size_t polledWorkers = workers.size();
+        if (polled[0].revents & POLLIN) {
+            unique_ptr<Socket> connection = server.accept();
+            if (connection) {
+                connection->setTimeout(timeout);
+                workers.push_back(Worker());
+                workers.back().socket = std::move(connection);
+            }
+        }
+        
+        for (size_t k = 0; k < polledWorkers; k++) {
+            Worker &worker = workers[k];
+            if (!(polled[k + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                if (!worker.assigned.empty() && now - worker.lastHeard > timeout * 1e6) drop(worker, "timed out");
+                continue;
+            }
+            uint32_t type;
+            vector<char> payload;
+            if (!worker.socket->receive(type, payload)) {
+                drop(worker, "disconnected");
+                continue;
+            }
+            worker.lastHeard = now;
+            MessageReader in(payload);
+            
+            if (type == MSG_HELLO) {
+                uint32_t version = in.get<uint32_t>();
+                int threads = in.get<int32_t>();
+                if (version != protocolVersion) {
+                    drop(worker, "speaks protocol version " + ofToString(version) + ", not " + ofToString(protocolVersion));
+                }
+                else if (!worker.socket->send(MSG_SCENE, sceneMessage.bytes.data(), sceneMessage.bytes.size())) {
+                    drop(worker, "disconnected");
+                }
+                else {
+                    worker.bReady = true;
+                    stats.workers++;
+                    ofLogNotice("RenderCoordinator") << "worker " << worker.socket->getName() << " joined with " << threads << " threads";
+                }
+            }
+            else if (type == MSG_RESULT) {
+                uint32_t id = in.get<uint32_t>();
+                uint64_t primaryRays = in.get<uint64_t>();
+                uint64_t shadowRays = in.get<uint64_t>();
+                auto assigned = worker.assigned.find(id);
+                if (!in.ok || assigned == worker.assigned.end()) {
+                    drop(worker, "sent a result for no job");
+                    continue;
+                }
+                Job job = assigned->second;
+                ofPixels tile;
+                tile.allocate(job.width, job.height, OF_IMAGE_COLOR);
+                if (!decompressPixels(in.p, in.end - in.p, tile)) {
+                    drop(worker, "sent a corrupt tile");
+                    continue;
+                }
+                worker.assigned.erase(assigned);
+                stats.rays += primaryRays + shadowRays;
+                stats.bytesReceived += in.end - in.p;
+                stats.bytesRendered += tile.size();
+                
+                auto frame = frames.find(job.frame);
+                if (frame == frames.end()) frame = frames.emplace(job.frame, writer.recycle(width, height)).first;
+                size_t row = job.width * 3;
+                for (int j = 0; j < job.height; j++) {
+                    memcpy(frame->second.getData() + ((size_t)(job.y + j) * width + job.x) * 3, tile.getData() + j * row, row);
+                }
+                if (--remaining[job.frame] == 0) {
+                    writer.writeFrame(std::move(frame->second), prefix, job.frame, ext);
+                    frames.erase(frame);
+                    remaining.erase(job.frame);
+                    stats.frames++;
+                    if (onFrame) onFrame(job.frame);
+                }
+            }
+            else if (type == MSG_ERROR) {
+                drop(worker, "failed: " + string(payload.begin(), payload.end()));
+            }
+            else {
+                drop(worker, "sent an unknown message");
+            }
+        }
+    }
+    
+    for (Worker &worker : workers) worker.socket->send(MSG_DONE, nullptr, 0);
+    writer.flush();
+    if (writer.getErrors() > 0) ok = false;
+    stats.wallMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+    return ok;
+}
+
+#endif
+
+//--------------------------------------------------------------
+// Worker
+
+bool RenderWorker::serve(const string &address) {
+    // the coordinator may still be starting up
+    //
+    uint64_t start = ofGetElapsedTimeMicros();
+    while (!socket.connect(address)) {
+        if (ofGetElapsedTimeMicros() - start > timeout * 1e6) {
+            ofLogError("RenderWorker") << "can't connect to " << address;
+            return false;
+        }
+        ofSleepMillis(250);
+    }
+    MessageWriter hello;
+    hello.put(protocolVersion);
+    hello.put<int32_t>(renderer.tileRenderer.getThreads());
+    if (!socket.send(MSG_HELLO, hello.bytes.data(), hello.bytes.size())) return false;
+    
+    uint32_t type;
+    vector<char> message;
+    vector<char> result;
+    while (socket.receive(type, message)) {
+        string error;
+        if (type == MSG_DONE) {
+            socket.close();
+            return true;
+        }
+        else if (type == MSG_SCENE) {
+            if (!loadScene(message)) error = "can't load the scene";
+        }
+        else if (type == MSG_JOB) {
+            if (!renderJob(message, result)) error = "bad job";
+            else if (!socket.send(MSG_RESULT, result.data(), result.size())) break;
+        }
+        else {
+            error = "unknown message";
+        }
+        
+        if (!error.empty()) {
+            ofLogError("RenderWorker") << error;
+            socket.send(MSG_ERROR, error.data(), error.size());
+            socket.close();
+            return false;
+        }
+    }
+    ofLogError("RenderWorker") << "lost the coordinator at " << address;
+    return false;
+}
+
+bool RenderWorker::loadScene(const vector<char> &message) {
+    MessageReader in(message);
+    settings = getSettings(in);
+    width = in.get<int32_t>();
+    height = in.get<int32_t>();
+    if (!in.ok || width <= 0 || height <= 0) return false;
+    
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    file->assign(in.p, in.end - in.p);
+    if (!scene.loadCompiled(file)) return false;
+    frame = std::numeric_limits<int>::min();
+    ofLogNotice("RenderWorker") << scene.objects.size() << " objects, " << width << "x" << height;
+    return true;
+}
+
+bool RenderWorker::renderJob(const vector<char> &message, vector<char> &result) {
+    MessageReader in(message);
+    uint32_t id = in.get<uint32_t>();
+    int jobFrame = in.get<int32_t>();
+    int x = in.get<int32_t>();
+    int y = in.get<int32_t>();
+    int w = in.get<int32_t>();
+    int h = in.get<int32_t>();
+    if (!in.ok || width <= 0 || x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > width || y + h > height) return false;
+    
+    if (jobFrame != frame) {
+        scene.setFrame(jobFrame);
+        frame = jobFrame;
+    }
+    if (pixels.getWidth() != w || pixels.getHeight() != h) pixels.allocate(w, h, OF_IMAGE_COLOR);
+    renderer.render(scene, settings, width, height, x, y, pixels);
+    
+    const RenderStats &stats = renderer.getStats();
+    MessageWriter out;
+    out.put(id);
+    out.put<uint64_t>(stats.primaryRays);
+    out.put<uint64_t>(stats.shadowRays);
+    compressPixels(pixels, out.bytes);
+    result.swap(out.bytes);
+    return true;
+}
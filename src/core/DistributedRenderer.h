@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "Socket.h"
+
+//  Distributed rendering over worker processes
+//
+//  A RenderCoordinator splits a sequence into jobs - one region of one
+//  frame each, regionSize pixels square - and hands them out to
+//  RenderWorker processes that connect to it over TCP or a Unix domain
+//  socket (see Socket).  Each worker is sent the scene once, compiled (see
+//  SceneFile.h), with the render settings and the image size; after that a
+//  job is just a frame number and a rectangle.  The worker moves its copy
+//  of the scene to the frame with setFrame(), renders the region with
+//  Renderer::render(..., x, y, pixels), which gives exactly the pixels a
+//  local render has there, and sends them back losslessly compressed.
+//
+//  The coordinator keeps jobsPerWorker jobs queued on every worker, so one
+//  is always waiting when another finishes, assembles the frames and writes
+//  each one as soon as all its regions are in.  A worker that disconnects,
+//  reports an error or doesn't answer within timeout seconds is dropped
+//  and its jobs go back to the front of the queue for the others.  Workers
+//  can join at any time.  To try it on one machine:
+//
+//    headlessRender -listen unix:/tmp/render.sock -frames 200 -out frames/spotlight &
+//    for i in 1 2 3 4; do headlessRender -worker unix:/tmp/render.sock -threads 2 & done
+//
+struct DistributedStats {
+    int frames = 0;             // rendered by this run
+    int skipped = 0;            // already on disk (resume)
+    int workers = 0;            // that joined
+    int reassigned = 0;         // jobs handed to another worker after theirs failed
+    uint64_t rays = 0;
+    uint64_t bytesReceived = 0; // compressed tiles
+    uint64_t bytesRendered = 0; // the same uncompressed
+    float wallMs = 0;
+};
+
+class RenderCoordinator {
+public:
+    // Listen on address and render frames first..last to numbered images
+    // (see ImageWriter::writeFrame()) on whichever workers connect.  False
+    // if the scene can't be sent, a frame can't be written, or there are no
+    // workers for timeout seconds.
+    //
+    bool render(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext, const string &address);
+    
+    const DistributedStats & getStats() const { return stats; }
+    
+    std::function<void(int frame)> onFrame;     // after the frame is queued for writing
+    
+    int regionSize = 256;           // 0 = whole frames
+    int jobsPerWorker = 2;
+    float timeout = 60;             // seconds
+    bool bResume = false;           // skip frames already on disk, as SequenceRenderer does
+
+private:
+    DistributedStats stats;
+};
+
+class RenderWorker {
+public:
+    RenderWorker(int nThreads = 0) : renderer(nThreads) { }
+    
+    // Connect to the coordinator at address, retrying for up to timeout
+    // seconds while it starts, and render its jobs until it says it's done.
+    // False if it can't be reached or goes away.
+    //
+    bool serve(const string &address);
+    
+    float timeout = 60;             // seconds
+
+private:
+    bool loadScene(const vector<char> &message);
+    bool renderJob(const vector<char> &message, vector<char> &result);
+    
+    Socket socket;
+    Scene scene;
+    Renderer renderer;
+    RenderSettings settings;
+    int width = 0;
+    int height = 0;
+    int frame = std::numeric_limits<int>::min();    // the scene is at
+    ofPixels pixels;
+};
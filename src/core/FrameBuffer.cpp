@@ -0,0 +1,89 @@
+#include "FrameBuffer.h"
+#include "RayPacket.h"
+#include "Profiler.h"
+
+#ifdef PACKET_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Resolve pixels [first, first + count) of the rgb+count buffer in into
+// 3 byte pixels in out.  Both versions do the same float operations in the
+// same order, so they give identical bytes.
+//
+typedef void (*ResolveKernel)(const float *in, unsigned char *out, size_t first, size_t count);
+
+static void resolveScalar(const float *in, unsigned char *out, size_t first, size_t count) {
+    for (size_t p = first; p < first + count; p++) {
+        const float *s = in + p * 4;
+        float n = std::max(s[3], 1.0f);         // sums are 0 where there are no samples
+        for (int k = 0; k < 3; k++) {
+            float c = std::min(std::max(s[k] / n, 0.0f), 1.0f);
+            out[p * 3 + k] = (unsigned char)(c * 255.0f + 0.5f);
+        }
+    }
+}
+
+#ifdef PACKET_SIMD_X86
+
+//  SSE4.1 - one pixel per register, 4 pixels per iteration packed down to
+//  12 bytes
+//
+__attribute__((target("sse4.1")))
+static void resolveSSE(const float *in, unsigned char *out, size_t first, size_t count) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i dropCount = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t p = first;
+    for (; p + 4 <= first + count; p += 4) {
+        __m128i q[4];
+        for (int k = 0; k < 4; k++) {
+            __m128 s = _mm_loadu_ps(in + (p + k) * 4);
+            __m128 n = _mm_max_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3)), one);
+            __m128 c = _mm_min_ps(_mm_max_ps(_mm_div_ps(s, n), zero), one);
+            q[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        bytes = _mm_shuffle_epi8(bytes, dropCount);
+        unsigned char *o = out + p * 3;
+        _mm_storel_epi64((__m128i *)o, bytes);
+        int last = _mm_extract_epi32(bytes, 2);
+        memcpy(o + 8, &last, 4);
+    }
+    resolveScalar(in, out, p, first + count - p);
+}
+
+#endif
+
+static ResolveKernel resolveKernel() {
+#ifdef PACKET_SIMD_X86
+    static ResolveKernel kernel = detectSimdLevel() >= SIMD_SSE ? resolveSSE : resolveScalar;
+    return kernel;
+#else
+    return resolveScalar;
+#endif
+}
+
+void FrameBuffer::allocate(int width, int height) {
+    pixels.allocate(width, height, OF_IMAGE_COLOR_ALPHA);
+    clear();
+}
+
+void FrameBuffer::clear() {
+    std::fill(pixels.getData(), pixels.getData() + pixels.size(), 0.0f);
+}
+
+glm::vec3 FrameBuffer::getColor(int i, int j) const {
+    const float *s = pixels.getData() + ((size_t)j * getWidth() + i) * 4;
+    return s[3] > 0 ? glm::vec3(s[0], s[1], s[2]) / s[3] : glm::vec3(0);
+}
+
+void FrameBuffer::resolve(ofPixels &out) const {
+    PROFILE_SCOPE(STAGE_RESOLVE);
+    PROFILE_SPAN("resolve");
+    if (out.getWidth() != getWidth() || out.getHeight() != getHeight() || out.getNumChannels() != 3) {
+        out.allocate(getWidth(), getHeight(), OF_IMAGE_COLOR);
+    }
+    resolveKernel()(pixels.getData(), out.getData(), 0, (size_t)getWidth() * getHeight());
+}
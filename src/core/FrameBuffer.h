@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Linear float RGB image the renderer accumulates samples into
+//
+//  Every pixel holds the unclamped sum of its samples' colors (0..1 is the
+//  displayable range) and how many samples went into it, so passes can keep
+//  adding samples without losing precision.  Nothing is clamped or rounded
+//  until resolve() turns the averages into 8 bit pixels in a single pass
+//  over the whole buffer, 4 pixels per SSE4.1 instruction.
+//
+class FrameBuffer {
+public:
+    void allocate(int width, int height);   // and clear()
+    void clear();                           // no samples anywhere
+    bool isAllocated() const { return pixels.isAllocated(); }
+    int getWidth() const { return pixels.getWidth(); }
+    int getHeight() const { return pixels.getHeight(); }
+    
+    // Add samples to pixel column i, row j (row 0 at the top): rgb is the
+    // sum of their colors, w how many there were
+    //
+    void add(int i, int j, const glm::vec4 &samples) {
+        float *p = pixels.getData() + ((size_t)j * getWidth() + i) * 4;
+        p[0] += samples.x;
+        p[1] += samples.y;
+        p[2] += samples.z;
+        p[3] += samples.w;
+    }
+    float getSamples(int i, int j) const { return pixels.getData()[((size_t)j * getWidth() + i) * 4 + 3]; }
+    glm::vec3 getColor(int i, int j) const;     // average of the pixel's samples
+    
+    // Tonemap (clamp to 0..1) and quantize into pixels, allocated as
+    // width x height, 3 channels if it isn't already.  Pixels without
+    // samples come out black.
+    //
+    void resolve(ofPixels &out) const;
+    
+    ofFloatPixels pixels;       // r, g, b sums, sample count in the 4th channel
+};
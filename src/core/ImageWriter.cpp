@@ -0,0 +1,144 @@
+#include "ImageWriter.h"
+#include "Profiler.h"
+
+static std::atomic<int> jobsQueued{0};     // by every writer, for Job::serial
+
+ImageWriter::ImageWriter(int nThreads, int maxQueued) {
+    this->maxQueued = std::max(1, maxQueued);
+    for (int i = 0; i < std::max(1, nThreads); i++) {
+        threads.push_back(std::thread(&ImageWriter::threadLoop, this));
+    }
+}
+
+ImageWriter::~ImageWriter() {
+    flush();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        bQuit = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads) thread.join();
+}
+
+void ImageWriter::write(ofPixels &&pixels, const string &path) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        auto waiting = [&] { return std::find_if(queue.begin(), queue.end(), [&](const Job &job) { return job.path == path; }); };
+        done.wait(guard, [&] { return queue.size() < maxQueued || waiting() != queue.end(); });
+        
+        // a frame for the same path that nobody has started on is out of
+        // date now, write this one in its place
+        //
+        auto job = waiting();
+        if (job != queue.end()) {
+            if (spare.size() < maxQueued) spare.push_back(std::move(job->pixels));
+            job->pixels = std::move(pixels);
+            return;
+        }
+        queue.push_back(Job());
+        queue.back().pixels = std::move(pixels);
+        queue.back().path = path;
+        queue.back().serial = jobsQueued++;
+    }
+    wake.notify_one();
+}
+
+void ImageWriter::writeFrame(ofPixels &&pixels, const string &prefix, int frame, const string &ext) {
+    write(std::move(pixels), framePath(prefix, frame, ext));
+}
+
+string ImageWriter::framePath(const string &prefix, int frame, const string &ext) {
+    char number[16];
+    snprintf(number, sizeof(number), "%04d", frame);
+    return prefix + number + "." + ext;
+}
+
+ofPixels ImageWriter::recycle(int width, int height, int channels) {
+    ofPixels pixels;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < spare.size(); i++) {
+            if (spare[i].getWidth() == width && spare[i].getHeight() == height && spare[i].getNumChannels() == channels) {
+                pixels = std::move(spare[i]);
+                spare.erase(spare.begin() + i);
+                return pixels;
+            }
+        }
+    }
+    pixels.allocate(width, height, channels == 1 ? OF_IMAGE_GRAYSCALE : channels == 4 ? OF_IMAGE_COLOR_ALPHA : OF_IMAGE_COLOR);
+    return pixels;
+}
+
+void ImageWriter::flush() {
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return queue.empty() && busy == 0; });
+}
+
+int ImageWriter::nextJob() const {
+    for (int i = 0; i < queue.size(); i++) {
+        if (std::find(writing.begin(), writing.end(), queue[i].path) == writing.end()) return i;
+    }
+    return -1;
+}
+
+void ImageWriter::threadLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return (bQuit && queue.empty()) || nextJob() >= 0; });
+            int next = nextJob();
+            if (next < 0) return;           // quitting, and nothing left to write
+            job = std::move(queue[next]);
+            queue.erase(queue.begin() + next);
+            writing.push_back(job.path);
+            busy++;
+        }
+        done.notify_all();      // room in the queue again
+        
+        if (!save(job.pixels, job.path, job.serial)) {
+            ofLogError("ImageWriter") << "can't write " << job.path;
+            errors++;
+        }
+        
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy--;
+            writing.erase(std::find(writing.begin(), writing.end(), job.path));
+            if (spare.size() < maxQueued) spare.push_back(std::move(job.pixels));
+        }
+        done.notify_all();
+        wake.notify_all();      // a job queued for the same path can go now
+    }
+}
+
+// Writes to <name>.partial<serial>.<ext> (the extension picks the encoder),
+// then renames that over path
+//
+bool ImageWriter::save(const ofPixels &pixels, const string &path, int serial) {
+    PROFILE_SCOPE(STAGE_ENCODE);
+    PROFILE_SPAN("encode");
+    string ext = ofFilePath::getFileExt(path);
+    string partial = path.substr(0, path.size() - ext.size()) + "partial" + ofToString(serial) + "." + ext;
+    bool ok;
+    if (ofToLower(ext) != "ppm") {
+        ok = ofSaveImage(pixels, partial, OF_IMAGE_QUALITY_HIGH);
+    }
+    else {
+        // raw binary PPM - a short header and the pixels as they are
+        //
+        int channels = pixels.getNumChannels();
+        if (channels != 1 && channels != 3) return false;
+        ofstream out(ofToDataPath(partial), ios::binary);
+        if (!out) return false;
+        out << (channels == 1 ? "P5" : "P6") << "\n" << pixels.getWidth() << " " << pixels.getHeight() << "\n255\n";
+        out.write((const char *)pixels.getData(), pixels.size());
+        out.close();
+        ok = !out.fail();
+    }
+    if (!ok) {
+        std::remove(ofToDataPath(partial).c_str());
+        return false;
+    }
+    return std::rename(ofToDataPath(partial).c_str(), ofToDataPath(path).c_str()) == 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Background image output
+//
+//  write() takes ownership of a finished frame (moved in, never copied) and
+//  returns as soon as it is queued; worker threads encode and save it, so
+//  the caller can trace the next frame while the last one is compressed and
+//  written.  The queue is bounded: when maxQueued frames are waiting,
+//  write() blocks until one is done, so a slow disk can't pile up frames in
+//  memory.
+//
+//  The format comes from the file extension: jpg (quality high), png and
+//  bmp through ofSaveImage(), and ppm, written raw without any encoding.
+//  Each image is written under a temporary name and renamed when complete,
+//  so a file that exists is never half written, even after a crash.
+//
+//  Frames for the same path are written one at a time, in the order they
+//  were queued, and a frame still waiting in the queue is replaced by a
+//  newer one for its path - so the newest always ends up in the file.
+//
+class ImageWriter {
+public:
+    ImageWriter(int nThreads = 2, int maxQueued = 4);
+    ~ImageWriter();             // writes whatever is still queued
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter & operator=(const ImageWriter &) = delete;
+    
+    void write(ofPixels &&pixels, const string &path);
+    
+    // Frame N of a numbered sequence: <prefix><N zero padded to 4>.<ext>
+    //
+    void writeFrame(ofPixels &&pixels, const string &prefix, int frame, const string &ext);
+    static string framePath(const string &prefix, int frame, const string &ext);
+    
+    // A buffer of a written frame to render the next one into (allocated
+    // fresh if none of that size is free), so a sequence doesn't allocate
+    // a new frame every time
+    //
+    ofPixels recycle(int width, int height, int channels = 3);
+    
+    void flush();               // block until everything queued is written
+    
+    int getErrors() const { return errors; }    // writes that failed so far
+
+private:
+    struct Job {
+        ofPixels pixels;
+        string path;
+        int serial;             // makes the temporary file name unique, across writers too
+    };
+    
+    void threadLoop();
+    int nextJob() const;        // index of a queued job no thread is writing the path of, or -1
+    bool save(const ofPixels &pixels, const string &path, int serial);
+    
+    vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;       // a job was queued, or quit
+    std::condition_variable done;       // a job finished
+    std::deque<Job> queue;
+    vector<string> writing;             // paths being written right now
+    vector<ofPixels> spare;             // buffers of written frames
+    int maxQueued;
+    int busy = 0;                       // jobs being written right now
+    bool bQuit = false;
+    std::atomic<int> errors{0};
+};
@@ -0,0 +1,98 @@
+#include "LightTree.h"
+#include "Scene.h"
+
+void LightTree::build(const vector<Light *> &lights, int spotlightAngle) {
+    this->lights = lights;
+    this->spotlightAngle = spotlightAngle;
+    nodes.clear();
+    if (lights.empty()) return;
+    nodes.reserve(2 * lights.size());
+    vector<int> order(lights.size());
+    for (int i = 0; i < order.size(); i++) order[i] = i;
+    buildRecursive(order, 0, order.size());
+}
+
+// Median split along the widest axis of the lights' positions, down to one
+// light per leaf
+//
+int LightTree::buildRecursive(vector<int> &order, int first, int count) {
+    int index = nodes.size();
+    nodes.push_back(Node());
+    Node node;
+    for (int i = first; i < first + count; i++) {
+        Light *light = lights[order[i]];
+        node.bounds.grow(light->position);
+        node.power += std::max(light->intensity, 1e-3f);     // never 0, or a light could never be picked
+    }
+    if (count == 1) {
+        node.light = order[first];
+    }
+    else {
+        glm::vec3 extent = node.bounds.max - node.bounds.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        int half = count / 2;
+        std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](int a, int b) {
+            return lights[a]->position[axis] < lights[b]->position[axis];
+        });
+        node.left = buildRecursive(order, first, half);
+        node.right = buildRecursive(order, first + half, count - half);
+    }
+    nodes[index] = node;
+    return index;
+}
+
+// How much light the node's lights can send to p, up to a common factor:
+// their power times the largest cosine between n and a direction from p
+// into the bounding sphere of their box
+//
+float LightTree::importance(const Node &node, const glm::vec3 &p, const glm::vec3 &n) const {
+    if (node.light >= 0) {
+        Light *light = lights[node.light];
+        glm::vec3 l = glm::normalize(light->position - p);
+        if (!light->isIlluminated(l, spotlightAngle)) return 0;
+        return node.power * std::max(glm::dot(n, l), minCosine);
+    }
+    
+    glm::vec3 center = node.bounds.center();
+    float radius = glm::length(node.bounds.max - center);
+    float distance = glm::length(center - p);
+    if (distance <= radius) return node.power;
+    
+    // the angle to the center minus the half angle of the sphere
+    //
+    float cosAxis = glm::dot(n, center - p) / distance;
+    float sinAxis = sqrt(std::max(0.0f, 1 - cosAxis * cosAxis));
+    float sinHalf = radius / distance;
+    float cosHalf = sqrt(1 - sinHalf * sinHalf);
+    float cosine = cosAxis >= cosHalf ? 1 : cosAxis * cosHalf + sinAxis * sinHalf;
+    return node.power * std::max(cosine, minCosine);
+}
+
+int LightTree::sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &probability) const {
+    if (nodes.empty()) return -1;
+    probability = 1;
+    int index = 0;
+    while (nodes[index].left >= 0) {
+        const Node &node = nodes[index];
+        float left = importance(nodes[node.left], p, n);
+        float right = importance(nodes[node.right], p, n);
+        if (left + right <= 0) return -1;
+        
+        // pick a child and stretch u back over [0, 1) for the next level
+        //
+        float pLeft = left / (left + right);
+        if (u < pLeft) {
+            index = node.left;
+            probability *= pLeft;
+            u = u / pLeft;
+        }
+        else {
+            index = node.right;
+            probability *= 1 - pLeft;
+            u = (u - pLeft) / (1 - pLeft);
+        }
+        u = std::min(u, 0.99999994f);
+    }
+    if (index == 0 && importance(nodes[0], p, n) <= 0) return -1;   // a single light that can't reach p
+    return nodes[index].light;
+}
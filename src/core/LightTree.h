@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ofMain.h"
+#include "BVH.h"
+
+class Light;
+
+//  Importance sampling over many lights
+//
+//  A binary tree over the light positions, rebuilt every frame (it is tiny
+//  next to the scene BVH).  sample() walks it from the root and at every
+//  node picks a child with probability proportional to an estimate of how
+//  much light the child's lights can send to the shading point: their total
+//  power times a bound on the cosine between the surface normal and the
+//  direction to the child's box.  At a leaf, a spotlight whose cone misses
+//  the point gets no chance at all, since it can't contribute.
+//
+//  Every light that could light the point keeps a nonzero probability (the
+//  cosine bound never drops below minCosine), so weighting each picked
+//  light by 1 / probability gives an unbiased estimate of the sum over all
+//  lights.
+//
+class LightTree {
+public:
+    void build(const vector<Light *> &lights, int spotlightAngle);
+    
+    // Pick a light for the point p with normal n, using the random number
+    // u in [0, 1).  Returns its index in the lights passed to build() and
+    // the probability it was picked with, or -1 if the walk ends where no
+    // light can reach p - which can happen below the root, so it is a
+    // sample worth 0, not a sign that every later one will fail too.
+    //
+    int sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &probability) const;
+    
+    int size() const { return lights.size(); }
+    
+    float minCosine = 0.05;
+
+private:
+    struct Node {
+        AABB bounds;
+        float power = 0;
+        int left = -1, right = -1;      // children, -1 for a leaf
+        int light = -1;                 // for a leaf
+    };
+    
+    int buildRecursive(vector<int> &order, int first, int count);
+    float importance(const Node &node, const glm::vec3 &p, const glm::vec3 &n) const;
+    
+    vector<Node> nodes;
+    vector<Light *> lights;
+    int spotlightAngle = 0;
+};
@@ -0,0 +1,555 @@
+#include "MeshLoader.h"
+#include "TriangleMesh.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const string &path, bool sequential) {
+    close();
+#ifdef _WIN32
+    ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    buffer.resize(in.tellg());
+    in.seekg(0);
+    if (!in.read(buffer.data(), buffer.size())) return false;
+    bytes = buffer.data();
+    length = buffer.size();
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    length = info.st_size;
+    if (length > 0) {
+        void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        if (sequential) madvise(mapped, length, MADV_SEQUENTIAL);
+        bytes = (const char *)mapped;
+    }
+    ::close(fd);        // the mapping stays valid
+    return true;
+#endif
+}
+
+void MappedFile::assign(const char *data, size_t size) {
+    close();
+    buffer.resize(size + 64);
+    char *aligned = buffer.data() + (64 - (uintptr_t)buffer.data() % 64) % 64;
+    memcpy(aligned, data, size);
+    bytes = aligned;
+    length = size;
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+    if (bytes && buffer.empty()) munmap((void *)bytes, length);
+#endif
+    buffer.clear();
+    bytes = nullptr;
+    length = 0;
+}
+
+//--------------------------------------------------------------
+// OBJ
+//
+//  The parsers work directly on the mapped bytes, which aren't null
+//  terminated, so every scan is bounded by end.
+
+static inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static inline const char * skipBlanks(const char *p, const char *end) {
+    while (p < end && isBlank(*p)) p++;
+    return p;
+}
+
+static inline const char * nextLine(const char *p, const char *end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
+
+static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+// Decimal float with optional sign, fraction and exponent.  Digits are
+// accumulated as an integer and scaled once at the end, which is much faster
+// than strtof and exact to well within float precision.
+//
+static const char * parseFloat(const char *p, const char *end, float &value) {
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    p = skipBlanks(p, end);
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; p < end && isDigit(*p); p++, any = true) {
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+        else exponent++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++, any = true) {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+        }
+    }
+    if (!any) return start;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negativeExp = false;
+        if (q < end && (*q == '-' || *q == '+')) negativeExp = *q++ == '-';
+        if (q < end && isDigit(*q)) {
+            int e = 0;
+            for (; q < end && isDigit(*q); q++) if (e < 10000) e = e * 10 + (*q - '0');
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+    double v = mantissa;
+    if (exponent >= 0) v = exponent <= 22 ? v * powers[exponent] : v * pow(10.0, exponent);
+    else v = exponent >= -22 ? v / powers[-exponent] : v * pow(10.0, exponent);
+    value = negative ? -v : v;
+    return p;
+}
+
+static inline const char * parseInt(const char *p, const char *end, int &value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    int v = 0;
+    for (; p < end && isDigit(*p); p++) v = v * 10 + (*p - '0');
+    value = negative ? -v : v;
+    return p;
+}
+
+// OBJ indices are 1 based, negative ones count back from the latest vertex
+//
+static inline int resolveIndex(int index, int count) {
+    return index < 0 ? count + index : index - 1;
+}
+
+bool loadOBJ(const char *data, size_t size, TriangleMesh &mesh, string &error) {
+    const char *p = data;
+    const char *end = data + size;
+    
+    vector<glm::vec3> positions, normals;
+    vector<glm::vec2> uvs;
+    vector<int> vIndex, tIndex, nIndex;     // per triangle corner
+    positions.reserve(size / 64);
+    vIndex.reserve(size / 16);
+    bool cornerNormals = true;          // every corner references a normal
+    bool cornerUVs = true;              // and texture coordinates
+    bool sameNormals = true;            // always the ones with the vertex's index
+    bool sameUVs = true;
+    
+    int face[3], faceUV[3], faceNormal[3];
+    while (p < end) {
+        p = skipBlanks(p, end);
+        if (end - p >= 2 && p[0] == 'v' && isBlank(p[1])) {
+            glm::vec3 v;
+            p = parseFloat(p + 2, end, v.x);
+            p = parseFloat(p, end, v.y);
+            p = parseFloat(p, end, v.z);
+            positions.push_back(v);
+        }
+        else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])) {
+            glm::vec3 n;
+            p = parseFloat(p + 3, end, n.x);
+            p = parseFloat(p, end, n.y);
+            p = parseFloat(p, end, n.z);
+            normals.push_back(n);
+        }
+        else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+            glm::vec2 t;
+            p = parseFloat(p + 3, end, t.x);
+            p = parseFloat(p, end, t.y);
+            uvs.push_back(t);
+        }
+        else if (end - p >= 2 && p[0] == 'f' && isBlank(p[1])) {
+            // v, v/vt, v/vt/vn or v//vn per corner, fanned into triangles
+            //
+            p += 2;
+            int corners = 0;
+            while (true) {
+                p = skipBlanks(p, end);
+                if (p >= end || !(isDigit(*p) || *p == '-' || *p == '+')) break;
+                int v, vt = 0, vn = 0;
+                p = parseInt(p, end, v);
+                bool hasUV = false, hasNormal = false;
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p != '/') {
+                        p = parseInt(p, end, vt);
+                        hasUV = true;
+                    }
+                    if (p < end && *p == '/') {
+                        p = parseInt(p + 1, end, vn);
+                        hasNormal = true;
+                    }
+                }
+                v = resolveIndex(v, positions.size());
+                if (v < 0 || v >= positions.size()) {
+                    error = "face refers to a vertex that doesn't exist";
+                    return false;
+                }
+                if (hasUV) {
+                    vt = resolveIndex(vt, uvs.size());
+                    if (vt < 0 || vt >= uvs.size()) {
+                        error = "face refers to texture coordinates that don't exist";
+                        return false;
+                    }
+                    sameUVs = sameUVs && vt == v;
+                }
+                else cornerUVs = false;
+                if (hasNormal) {
+                    vn = resolveIndex(vn, normals.size());
+                    if (vn < 0 || vn >= normals.size()) {
+                        error = "face refers to a normal that doesn't exist";
+                        return false;
+                    }
+                    sameNormals = sameNormals && vn == v;
+                }
+                else cornerNormals = false;
+                
+                if (corners < 3) {
+                    face[corners] = v;
+                    faceUV[corners] = vt;
+                    faceNormal[corners] = vn;
+                }
+                else {
+                    face[1] = face[2];
+                    faceUV[1] = faceUV[2];
+                    faceNormal[1] = faceNormal[2];
+                    face[2] = v;
+                    faceUV[2] = vt;
+                    faceNormal[2] = vn;
+                }
+                corners++;
+                if (corners >= 3) {
+                    vIndex.insert(vIndex.end(), face, face + 3);
+                    tIndex.insert(tIndex.end(), faceUV, faceUV + 3);
+                    nIndex.insert(nIndex.end(), faceNormal, faceNormal + 3);
+                }
+            }
+        }
+        p = nextLine(p, end);
+    }
+    
+    bool useNormals = cornerNormals && !normals.empty();
+    bool useUVs = cornerUVs && !uvs.empty();
+    mesh.indices.assign(vIndex.begin(), vIndex.end());
+    mesh.normals.clear();
+    mesh.texcoords.clear();
+    if (!useNormals && !useUVs) {
+        mesh.vertices.swap(positions);
+    }
+    else if ((!useNormals || (sameNormals && normals.size() >= positions.size())) && (!useUVs || (sameUVs && uvs.size() >= positions.size()))) {
+        mesh.vertices.swap(positions);
+        if (useNormals) {
+            normals.resize(mesh.vertices.size());
+            mesh.normals.swap(normals);
+        }
+        if (useUVs) {
+            uvs.resize(mesh.vertices.size());
+            mesh.texcoords.swap(uvs);
+        }
+    }
+    else {
+        // positions, texture coordinates and normals are indexed separately -
+        // make one vertex per distinct combination
+        //
+        std::unordered_map<uint64_t, uint32_t> attributes;      // (vt, vn) pairs
+        std::unordered_map<uint64_t, uint32_t> combinations;    // (v, pair)
+        combinations.reserve(positions.size());
+        mesh.vertices.clear();
+        for (int i = 0; i < vIndex.size(); i++) {
+            uint64_t pair = (uint64_t)(useUVs ? tIndex[i] : 0) << 32 | (uint32_t)(useNormals ? nIndex[i] : 0);
+            uint32_t attribute = attributes.emplace(pair, (uint32_t)attributes.size()).first->second;
+            uint64_t key = (uint64_t)vIndex[i] << 32 | attribute;
+            auto inserted = combinations.emplace(key, (uint32_t)mesh.vertices.size());
+            if (inserted.second) {
+                mesh.vertices.push_back(positions[vIndex[i]]);
+                if (useUVs) mesh.texcoords.push_back(uvs[tIndex[i]]);
+                if (useNormals) mesh.normals.push_back(normals[nIndex[i]]);
+            }
+            mesh.indices[i] = inserted.first->second;
+        }
+    }
+    if (mesh.indices.empty()) {
+        error = "no faces";
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------
+// PLY
+
+enum PLYType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_UNKNOWN };
+
+static PLYType plyType(const string &name) {
+    if (name == "char" || name == "int8") return PLY_INT8;
+    if (name == "uchar" || name == "uint8") return PLY_UINT8;
+    if (name == "short" || name == "int16") return PLY_INT16;
+    if (name == "ushort" || name == "uint16") return PLY_UINT16;
+    if (name == "int" || name == "int32") return PLY_INT32;
+    if (name == "uint" || name == "uint32") return PLY_UINT32;
+    if (name == "float" || name == "float32") return PLY_FLOAT32;
+    if (name == "double" || name == "float64") return PLY_FLOAT64;
+    return PLY_UNKNOWN;
+}
+
+static int plySize(PLYType type) {
+    static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return sizes[type];
+}
+
+struct PLYProperty {
+    string name;
+    PLYType type;
+    bool isList = false;
+    PLYType countType;          // for lists; type is then the item type
+};
+
+struct PLYElement {
+    string name;
+    size_t count;
+    vector<PLYProperty> properties;
+};
+
+// Read one value of the given type, converting from the file's byte order
+//
+static inline double plyRead(const char *p, PLYType type, bool swap) {
+    unsigned char b[8];
+    int n = plySize(type);
+    memcpy(b, p, n);
+    if (swap) std::reverse(b, b + n);
+    switch (type) {
+        case PLY_INT8: return (int8_t)b[0];
+        case PLY_UINT8: return b[0];
+        case PLY_INT16: { int16_t v; memcpy(&v, b, 2); return v; }
+        case PLY_UINT16: { uint16_t v; memcpy(&v, b, 2); return v; }
+        case PLY_INT32: { int32_t v; memcpy(&v, b, 4); return v; }
+        case PLY_UINT32: { uint32_t v; memcpy(&v, b, 4); return v; }
+        case PLY_FLOAT32: { float v; memcpy(&v, b, 4); return v; }
+        case PLY_FLOAT64: { double v; memcpy(&v, b, 8); return v; }
+        default: return 0;
+    }
+}
+
+static inline bool hostIsLittleEndian() {
+    uint16_t one = 1;
+    return *(unsigned char *)&one == 1;
+}
+
+bool loadPLY(const char *data, size_t size, TriangleMesh &mesh, string &error) {
+    const char *end = data + size;
+    const char *p = data;
+    
+    // ASCII header, one declaration per line, up to end_header
+    //
+    vector<PLYElement> elements;
+    bool littleEndian = true;
+    bool first = true;
+    while (true) {
+        if (p >= end) {
+            error = "no end_header";
+            return false;
+        }
+        const char *eol = nextLine(p, end);
+        string line(p, eol - p);
+        p = eol;
+        vector<string> words = ofSplitString(ofTrim(line), " ", true, true);
+        if (first) {
+            if (words.empty() || words[0] != "ply") {
+                error = "not a PLY file";
+                return false;
+            }
+            first = false;
+            continue;
+        }
+        if (words.empty()) continue;
+        if (words[0] == "end_header") break;
+        if (words[0] == "format" && words.size() >= 2) {
+            if (words[1] == "binary_little_endian") littleEndian = true;
+            else if (words[1] == "binary_big_endian") littleEndian = false;
+            else {
+                error = "only binary PLY is supported (file is " + words[1] + ")";
+                return false;
+            }
+        }
+        else if (words[0] == "element" && words.size() >= 3) {
+            PLYElement element;
+            element.name = words[1];
+            element.count = strtoull(words[2].c_str(), nullptr, 10);
+            elements.push_back(element);
+        }
+        else if (words[0] == "property" && !elements.empty()) {
+            PLYProperty property;
+            if (words.size() >= 5 && words[1] == "list") {
+                property.isList = true;
+                property.countType = plyType(words[2]);
+                property.type = plyType(words[3]);
+                property.name = words[4];
+                if (property.countType == PLY_UNKNOWN) property.type = PLY_UNKNOWN;
+            }
+            else if (words.size() >= 3) {
+                property.type = plyType(words[1]);
+                property.name = words[2];
+            }
+            else {
+                error = "bad property line: " + line;
+                return false;
+            }
+            if (property.type == PLY_UNKNOWN) {
+                error = "unknown property type: " + line;
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+    bool swap = littleEndian != hostIsLittleEndian();
+    
+    mesh.vertices.clear();
+    mesh.normals.clear();
+    mesh.texcoords.clear();
+    mesh.indices.clear();
+    for (const PLYElement &element : elements) {
+        // fixed size records (all vertex elements in practice) are read by
+        // offset; anything with a list is walked property by property
+        //
+        bool fixed = true;
+        int stride = 0;
+        int x = -1, y = -1, z = -1, nx = -1, ny = -1, nz = -1, tu = -1, tv = -1, faceList = -1;
+        vector<int> offsets;
+        for (int i = 0; i < element.properties.size(); i++) {
+            const PLYProperty &property = element.properties[i];
+            offsets.push_back(stride);
+            if (property.isList) {
+                fixed = false;
+                if (property.name == "vertex_indices" || property.name == "vertex_index") faceList = i;
+                continue;
+            }
+            stride += plySize(property.type);
+            if (property.name == "x") x = i;
+            else if (property.name == "y") y = i;
+            else if (property.name == "z") z = i;
+            else if (property.name == "nx") nx = i;
+            else if (property.name == "ny") ny = i;
+            else if (property.name == "nz") nz = i;
+            else if (property.name == "u" || property.name == "s" || property.name == "texture_u") tu = i;
+            else if (property.name == "v" || property.name == "t" || property.name == "texture_v") tv = i;
+        }
+        
+        if (element.name == "vertex" && fixed) {
+            if (x < 0 || y < 0 || z < 0) {
+                error = "vertex element without x, y, z";
+                return false;
+            }
+            if ((size_t)(end - p) / std::max(stride, 1) < element.count) {
+                error = "file is truncated";
+                return false;
+            }
+            const vector<PLYProperty> &props = element.properties;
+            bool hasNormals = nx >= 0 && ny >= 0 && nz >= 0;
+            bool floats = !swap && props[x].type == PLY_FLOAT32 && props[y].type == PLY_FLOAT32 && props[z].type == PLY_FLOAT32;
+            mesh.vertices.resize(element.count);
+            bool hasUVs = tu >= 0 && tv >= 0;
+            if (hasNormals) mesh.normals.resize(element.count);
+            if (hasUVs) mesh.texcoords.resize(element.count);
+            for (size_t i = 0; i < element.count; i++, p += stride) {
+                glm::vec3 &v = mesh.vertices[i];
+                if (floats) {
+                    memcpy(&v.x, p + offsets[x], 4);
+                    memcpy(&v.y, p + offsets[y], 4);
+                    memcpy(&v.z, p + offsets[z], 4);
+                }
+                else {
+                    v.x = plyRead(p + offsets[x], props[x].type, swap);
+                    v.y = plyRead(p + offsets[y], props[y].type, swap);
+                    v.z = plyRead(p + offsets[z], props[z].type, swap);
+                }
+                if (hasNormals) {
+                    glm::vec3 &n = mesh.normals[i];
+                    n.x = plyRead(p + offsets[nx], props[nx].type, swap);
+                    n.y = plyRead(p + offsets[ny], props[ny].type, swap);
+                    n.z = plyRead(p + offsets[nz], props[nz].type, swap);
+                }
+                if (hasUVs) {
+                    glm::vec2 &t = mesh.texcoords[i];
+                    t.x = plyRead(p + offsets[tu], props[tu].type, swap);
+                    t.y = plyRead(p + offsets[tv], props[tv].type, swap);
+                }
+            }
+        }
+        else if (fixed) {
+            if ((size_t)(end - p) / std::max(stride, 1) < element.count) {
+                error = "file is truncated";
+                return false;
+            }
+            p += element.count * stride;
+        }
+        else {
+            bool faces = element.name == "face" && faceList >= 0;
+            if (faces) mesh.indices.reserve(element.count * 3);
+            for (size_t i = 0; i < element.count; i++) {
+                for (int k = 0; k < element.properties.size(); k++) {
+                    const PLYProperty &property = element.properties[k];
+                    if (!property.isList) {
+                        p += plySize(property.type);
+                        continue;
+                    }
+                    int countSize = plySize(property.countType);
+                    int itemSize = plySize(property.type);
+                    if (end - p < countSize) {
+                        error = "file is truncated";
+                        return false;
+                    }
+                    size_t count = plyRead(p, property.countType, swap);
+                    p += countSize;
+                    if ((size_t)(end - p) / itemSize < count) {
+                        error = "file is truncated";
+                        return false;
+                    }
+                    if (faces && k == faceList) {
+                        uint32_t first = 0, previous = 0;
+                        for (size_t c = 0; c < count; c++) {
+                            uint32_t index = plyRead(p + c * itemSize, property.type, swap);
+                            if (index >= mesh.vertices.size()) {
+                                error = "face refers to a vertex that doesn't exist";
+                                return false;
+                            }
+                            if (c == 0) first = index;
+                            else if (c >= 2) {
+                                mesh.indices.push_back(first);
+                                mesh.indices.push_back(previous);
+                                mesh.indices.push_back(index);
+                            }
+                            previous = index;
+                        }
+                    }
+                    p += count * itemSize;
+                }
+                if (p > end) {
+                    error = "file is truncated";
+                    return false;
+                }
+            }
+        }
+    }
+    if (mesh.indices.empty()) {
+        error = "no faces";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ofMain.h"
+
+class TriangleMesh;
+
+//  Read-only memory mapped file.  The OS pages the file in as the parser
+//  walks it, so even very large meshes are read without an extra copy.
+//  Files that are read in no particular order (compiled scenes, which are
+//  traced straight from the mapping) should be opened without the
+//  sequential read-ahead hint.  assign() holds bytes that aren't in a file
+//  (a compiled scene received over the network) the same way.
+//
+class MappedFile {
+public:
+    MappedFile() { }
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    
+    bool open(const string &path, bool sequential = true);
+    void assign(const char *data, size_t size);     // copies data, 64 byte aligned like a mapping
+    void close();
+    
+    const char * data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char *bytes = nullptr;
+    size_t length = 0;
+    vector<char> buffer;        // assign()ed bytes, or on Windows (no mmap) the whole file
+};
+
+//  Mesh file parsers.  Fill the mesh's vertex, normal, texture coordinate
+//  and index buffers (polygons are split into triangle fans) but don't
+//  build its BVH; on failure return false with a message in error.
+//
+//  loadOBJ() reads v, vt, vn and f records and ignores everything else
+//  (groups, materials).  loadPLY() reads binary PLY, either byte order,
+//  with any property types; texture coordinates are the u and v (or s and
+//  t, or texture_u and texture_v) vertex properties.
+//
+bool loadOBJ(const char *data, size_t size, TriangleMesh &mesh, string &error);
+bool loadPLY(const char *data, size_t size, TriangleMesh &mesh, string &error);
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Object pools
+//
+//  An ObjectPool is an arena for objects of one type: they are constructed
+//  in blocks of slots that are only freed with the pool, so an object never
+//  moves, and a destroyed object's slot is reused by the next one created.
+//  Adding and removing objects is O(1) and doesn't go near the heap once the
+//  pool has grown to the scene's size.
+//
+//  Pools of different types derived from Base can be kept together as
+//  ObjectPoolBase<Base> and destroy objects without knowing their type.
+//
+template <class Base>
+class ObjectPoolBase {
+public:
+    virtual ~ObjectPoolBase() { }
+    virtual void destroy(Base *obj) = 0;
+};
+
+template <class T, class Base = T>
+class ObjectPool : public ObjectPoolBase<Base> {
+public:
+    ObjectPool(int blockSize = 64) : blockSize(blockSize) { }
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool & operator=(const ObjectPool &) = delete;
+    
+    ~ObjectPool() {
+        for (auto &block : blocks) {
+            for (int i = 0; i < blockSize; i++) {
+                if (block[i].bLive) reinterpret_cast<T *>(block[i].storage)->~T();
+            }
+        }
+    }
+    
+    template <class... Args> T * create(Args &&... args) {
+        if (freeSlots.empty()) grow();
+        Slot *slot = freeSlots.back();
+        T *obj = new (slot->storage) T(std::forward<Args>(args)...);
+        freeSlots.pop_back();
+        slot->bLive = true;
+        live++;
+        return obj;
+    }
+    
+    // obj must have come from this pool's create()
+    //
+    void destroy(Base *obj) {
+        T *t = static_cast<T *>(obj);
+        Slot *slot = reinterpret_cast<Slot *>(t);
+        t->~T();
+        slot->bLive = false;
+        freeSlots.push_back(slot);
+        live--;
+    }
+    
+    int size() const { return live; }
+    int capacity() const { return blocks.size() * blockSize; }
+
+private:
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];    // first, so a T's address is its slot's
+        bool bLive = false;
+    };
+    
+    // a new block's slots are handed out lowest address first
+    //
+    void grow() {
+        blocks.emplace_back(new Slot[blockSize]);
+        Slot *block = blocks.back().get();
+        for (int i = blockSize - 1; i >= 0; i--) freeSlots.push_back(&block[i]);
+    }
+    
+    int blockSize;
+    int live = 0;
+    vector<unique_ptr<Slot[]>> blocks;
+    vector<Slot *> freeSlots;
+};
+
+//  Names an object for as long as it exists: a slot in a HandleTable and
+//  the generation of that slot when the object got it.  Once the object is
+//  gone its handle no longer finds anything, even after the slot is reused.
+//
+struct ObjectHandle {
+    uint32_t slot = std::numeric_limits<uint32_t>::max();
+    uint32_t generation = 0;
+    
+    bool operator==(const ObjectHandle &h) const { return slot == h.slot && generation == h.generation; }
+    bool operator!=(const ObjectHandle &h) const { return !(*this == h); }
+};
+
+//  Handles for the elements of a dense array that is kept packed by moving
+//  its last element into any hole: set() records each move, so handles
+//  stay valid while indices change.
+//
+class HandleTable {
+public:
+    ObjectHandle add(int index) {
+        ObjectHandle handle;
+        if (freeEntries.empty()) {
+            handle.slot = entries.size();
+            entries.push_back(Entry());
+        }
+        else {
+            handle.slot = freeEntries.back();
+            freeEntries.pop_back();
+        }
+        Entry &entry = entries[handle.slot];
+        entry.index = index;
+        handle.generation = entry.generation;
+        return handle;
+    }
+    
+    void remove(ObjectHandle handle) {
+        if (find(handle) < 0) return;
+        Entry &entry = entries[handle.slot];
+        entry.generation++;
+        entry.index = -1;
+        freeEntries.push_back(handle.slot);
+    }
+    
+    void set(ObjectHandle handle, int index) {
+        if (find(handle) >= 0) entries[handle.slot].index = index;
+    }
+    
+    // index of the element, -1 once it has been removed
+    //
+    int find(ObjectHandle handle) const {
+        if (handle.slot >= entries.size() || entries[handle.slot].generation != handle.generation) return -1;
+        return entries[handle.slot].index;
+    }
+    
+    // remove everything, leaving every handle given out so far invalid
+    //
+    void clear() {
+        for (uint32_t slot = 0; slot < entries.size(); slot++) {
+            if (entries[slot].index >= 0) remove({ slot, entries[slot].generation });
+        }
+    }
+
+private:
+    struct Entry {
+        uint32_t generation = 0;
+        int index = -1;
+    };
+    vector<Entry> entries;
+    vector<uint32_t> freeEntries;
+};
@@ -0,0 +1,180 @@
+#include "Profiler.h"
+#include <iomanip>
+
+thread_local ProfileScope *ProfileScope::top = nullptr;
+
+static const size_t maxSpans = 1 << 20;     // per thread, the rest are dropped
+
+//  Every slot ever handed out.  A thread gives its slot back when it exits
+//  (the next new thread takes it over, totals and all), so pools that are
+//  recreated don't pile up slots.  Never freed: threads may still be
+//  exiting while the program shuts down.
+//
+static std::mutex & registryLock() {
+    static std::mutex *lock = new std::mutex;
+    return *lock;
+}
+
+static vector<Profiler::Slot *> & registry() {
+    static vector<Profiler::Slot *> *slots = new vector<Profiler::Slot *>;
+    return *slots;
+}
+
+static std::atomic<uint64_t> origin{0};         // ticks at reset(), time 0 of the trace
+static std::atomic<uint64_t> droppedSpans{0};
+
+struct SlotLease {
+    Profiler::Slot *slot = nullptr;
+    ~SlotLease() {
+        std::lock_guard<std::mutex> guard(registryLock());
+        if (slot) slot->bInUse = false;
+    }
+};
+
+static void zero(Profiler::Slot &slot) {
+    for (auto &t : slot.ticks) t.store(0, std::memory_order_relaxed);
+    for (auto &c : slot.calls) c.store(0, std::memory_order_relaxed);
+    for (auto &c : slot.counters) c.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(slot.lock);
+    slot.spans.clear();
+}
+
+Profiler::Slot * Profiler::acquire() {
+    static thread_local SlotLease lease;
+    std::lock_guard<std::mutex> guard(registryLock());
+    for (Slot *slot : registry()) {
+        if (!slot->bInUse) {
+            lease.slot = slot;
+            break;
+        }
+    }
+    if (!lease.slot) {
+        lease.slot = new Slot();
+        zero(*lease.slot);
+        lease.slot->thread = registry().size();
+        registry().push_back(lease.slot);
+    }
+    lease.slot->bInUse = true;
+    uint64_t none = 0;
+    origin.compare_exchange_strong(none, ticks());
+    return lease.slot;
+}
+
+void Profiler::span(const char *name, uint64_t start, uint64_t end) {
+    Slot &s = slot();
+    std::lock_guard<std::mutex> guard(s.lock);
+    if (s.spans.size() < maxSpans) s.spans.push_back({ name, start, end });
+    else droppedSpans++;
+}
+
+// Cycle counter ticks per millisecond, measured once against the steady
+// clock
+//
+static double ticksPerMs() {
+    static double rate = [] {
+        auto clock = std::chrono::steady_clock::now();
+        uint64_t start = Profiler::ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - clock).count();
+        return (Profiler::ticks() - start) / ms;
+    }();
+    return rate;
+}
+
+bool Profiler::isEnabled() {
+#ifdef RT_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+ProfileStats Profiler::getStats() {
+    ProfileStats stats;
+    std::lock_guard<std::mutex> guard(registryLock());
+    if (registry().empty()) return stats;
+    double rate = ticksPerMs();
+    for (Slot *slot : registry()) {
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            stats.ms[s] += slot->ticks[s].load(std::memory_order_relaxed) / rate;
+            stats.calls[s] += slot->calls[s].load(std::memory_order_relaxed);
+        }
+        for (int c = 0; c < COUNTER_COUNT; c++) stats.counters[c] += slot->counters[c].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> guard(registryLock());
+    for (Slot *slot : registry()) zero(*slot);
+    origin = ticks();
+    droppedSpans = 0;
+}
+
+bool Profiler::writeChromeTrace(const string &path) {
+    if (!isEnabled()) {
+        ofLogError("Profiler") << "built without RT_PROFILE, there is no trace to write";
+        return false;
+    }
+    ofstream out(ofToDataPath(path));
+    if (!out) {
+        ofLogError("Profiler") << "can't write " << path;
+        return false;
+    }
+    ProfileStats stats = getStats();
+    double rate = ticksPerMs() / 1000.0;        // per microsecond, the trace's unit
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> guard(registryLock());
+        for (Slot *slot : registry()) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << slot->thread
+                << ",\"args\":{\"name\":\"thread " << slot->thread << "\"}}";
+            first = false;
+            std::lock_guard<std::mutex> spansGuard(slot->lock);
+            for (const Slot::Span &span : slot->spans) {
+                out << ",\n{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << slot->thread
+                    << ",\"ts\":" << ((int64_t)(span.start - origin)) / rate << ",\"dur\":" << (span.end - span.start) / rate << "}";
+            }
+        }
+    }
+    out << "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{";
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        out << "\"" << ProfileStats::stageName(s) << " ms\":" << stats.ms[s] << ",\"" << ProfileStats::stageName(s) << " calls\":" << stats.calls[s] << ",";
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) out << "\"" << ProfileStats::counterName(c) << "\":" << stats.counters[c] << ",";
+    out << "\"dropped spans\":" << droppedSpans << "}}\n";
+    out.close();
+    if (out.fail()) {
+        ofLogError("Profiler") << "can't write " << path;
+        return false;
+    }
+    return true;
+}
+
+double ProfileStats::totalMs() const {
+    double total = 0;
+    for (double stage : ms) total += stage;
+    return total;
+}
+
+ProfileStats ProfileStats::operator-(const ProfileStats &since) const {
+    ProfileStats d;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        d.ms[s] = ms[s] - since.ms[s];
+        d.calls[s] = calls[s] - since.calls[s];
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) d.counters[c] = counters[c] - since.counters[c];
+    return d;
+}
+
+const char * ProfileStats::stageName(int stage) {
+    static const char *names[STAGE_COUNT] = { "sync", "ray generation", "closest hit", "shadow", "shading", "texturing", "resolve", "encode" };
+    return names[stage];
+}
+
+const char * ProfileStats::counterName(int counter) {
+    static const char *names[COUNTER_COUNT] = { "tiles", "packets", "packet rays", "retraced", "tile reads" };
+    return names[counter];
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "ofMain.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#endif
+
+//  Hot path instrumentation
+//
+//  Scoped timers for the stages of a frame, a few counters, and trace spans
+//  for the coarse steps (renders, passes, tiles, writes) that can be saved
+//  as Chrome trace JSON (chrome://tracing, or ui.perfetto.dev).  All of it
+//  is compiled in only when RT_PROFILE is defined:
+//
+//    make PROJECT_CFLAGS=-DRT_PROFILE      (or Other C++ Flags in Xcode)
+//
+//  Without it PROFILE_SCOPE(), PROFILE_COUNT() and PROFILE_SPAN() expand to
+//  nothing, so a normal build pays nothing for them; Profiler's functions
+//  still exist and return empty results.
+//
+//  Every thread records into a slot of its own with plain (relaxed) adds,
+//  so timing a stage costs two reads of the CPU's cycle counter and no
+//  locks; getStats() sums the slots.  Stage times are self times: a stage
+//  timed inside another (shadow rays inside shading) is only counted in its
+//  own, so the stages add up to the time spent in them.
+//
+enum ProfileStage {
+    STAGE_SYNC,                 // copying the scene into the store, refitting the BVHs
+    STAGE_RAY_GENERATION,       // RenderCam::getRay()
+    STAGE_CLOSEST_HIT,          // BVH traversal for camera, reflected and refracted rays
+    STAGE_SHADOW,               // shadow rays
+    STAGE_SHADING,              // ambient + Phong, not counting their shadow rays
+    STAGE_TEXTURING,            // texture map lookups, including reading tiles from disk
+    STAGE_RESOLVE,              // frame buffer to 8 bit pixels
+    STAGE_ENCODE,               // compressing and saving images
+    STAGE_COUNT
+};
+
+enum ProfileCounter {
+    COUNTER_TILES,
+    COUNTER_PACKETS,
+    COUNTER_PACKET_RAYS,
+    COUNTER_RETRACED,           // packet hits the scalar test disagreed with
+    COUNTER_TILE_READS,         // texture tiles read from disk
+    COUNTER_COUNT
+};
+
+//  Totals over all threads since Profiler::reset()
+//
+struct ProfileStats {
+    double ms[STAGE_COUNT] = { };
+    uint64_t calls[STAGE_COUNT] = { };
+    uint64_t counters[COUNTER_COUNT] = { };
+    
+    double totalMs() const;
+    ProfileStats operator-(const ProfileStats &since) const;
+    
+    static const char * stageName(int stage);
+    static const char * counterName(int counter);
+};
+
+class Profiler {
+public:
+    static bool isEnabled();            // compiled with RT_PROFILE
+    static ProfileStats getStats();
+    static void reset();                // zero the totals and drop the trace
+    
+    // Spans since reset() as Chrome trace events, one track per thread,
+    // with the stage totals in otherData
+    //
+    static bool writeChromeTrace(const string &path);
+    
+    static uint64_t ticks() {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+    
+    // The calling thread's slot
+    //
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> ticks[STAGE_COUNT];
+        std::atomic<uint64_t> calls[STAGE_COUNT];
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        
+        struct Span {
+            const char *name;
+            uint64_t start, end;
+        };
+        std::mutex lock;                // guards spans, which are read by writeChromeTrace()
+        vector<Span> spans;
+        int thread = 0;
+        bool bInUse = false;
+    };
+    
+    static Slot & slot() {
+        static thread_local Slot *current = nullptr;
+        if (!current) current = acquire();
+        return *current;
+    }
+    
+    static void add(std::atomic<uint64_t> &total, uint64_t n) {
+        total.store(total.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    
+    static void count(ProfileCounter counter, uint64_t n) { add(slot().counters[counter], n); }
+    static void span(const char *name, uint64_t start, uint64_t end);
+
+private:
+    static Slot * acquire();
+};
+
+//  Times its scope as stage, less the stages timed inside it
+//
+class ProfileScope {
+public:
+    ProfileScope(ProfileStage stage) : stage(stage), parent(top) {
+        top = this;
+        start = Profiler::ticks();
+    }
+    ~ProfileScope() {
+        uint64_t elapsed = Profiler::ticks() - start;
+        Profiler::Slot &slot = Profiler::slot();
+        Profiler::add(slot.ticks[stage], elapsed - nested);
+        Profiler::add(slot.calls[stage], 1);
+        if (parent) parent->nested += elapsed;
+        top = parent;
+    }
+
+private:
+    ProfileStage stage;
+    ProfileScope *parent;
+    uint64_t start;
+    uint64_t nested = 0;
+    static thread_local ProfileScope *top;
+};
+
+//  Records its scope as a span in the trace
+//
+class ProfileSpan {
+public:
+    ProfileSpan(const char *name) : name(name), start(Profiler::ticks()) { }
+    ~ProfileSpan() { Profiler::span(name, start, Profiler::ticks()); }
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#ifdef RT_PROFILE
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(stage)
+#define PROFILE_COUNT(counter, n) Profiler::count(counter, n)
+#define PROFILE_SPAN(name) ProfileSpan PROFILE_CONCAT(profileSpan, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_SPAN(name)
+#endif
@@ -0,0 +1,109 @@
+#include "ProgressiveRenderer.h"
+
+ProgressiveRenderer::ProgressiveRenderer(int nThreads) {
+    // leave a core for the app's own thread so the viewport keeps its frame rate
+    //
+    if (nThreads <= 0) nThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    renderer.setThreads(nThreads);
+    renderer.tileRenderer.cancel = &bRestart;
+    nextStage = stages.size();
+    thread = std::thread(&ProgressiveRenderer::threadLoop, this);
+}
+
+ProgressiveRenderer::~ProgressiveRenderer() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        bQuit = true;
+        bRestart = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void ProgressiveRenderer::restart(const Scene &scene, const RenderSettings &settings, int width, int height) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        
+        // while objects are only being dragged around, refreshing positions
+        // is enough and lets the snapshot's BVH refit instead of rebuilding
+        //
+        if (pendingId > 0 && pending.getLayoutVersion() == scene.getLayoutVersion() && pending.objects.size() == scene.objects.size()) {
+            scene.copyPositionsTo(pending);
+        }
+        else {
+            scene.copyTo(pending);
+        }
+        pendingSettings = settings;
+        pendingWidth = width;
+        pendingHeight = height;
+        pendingId++;
+        bRestart = true;
+        bNewResult = false;
+    }
+    wake.notify_all();
+}
+
+void ProgressiveRenderer::cancel() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pendingId++;
+        pendingWidth = 0;       // nothing to render
+        bRestart = true;
+        bNewResult = false;
+    }
+    wake.notify_all();
+}
+
+bool ProgressiveRenderer::getLatest(ofPixels &pixels, int &stage) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!bNewResult) return false;
+    pixels.swap(result);
+    stage = resultStage;
+    bNewResult = false;
+    return true;
+}
+
+void ProgressiveRenderer::threadLoop() {
+    ofPixels pixels;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return bQuit || pendingId != activeId || nextStage < stages.size(); });
+            if (bQuit) return;
+            
+            // pick up the latest request - same trick as restart(), only
+            // positions need copying while the layout is unchanged
+            //
+            if (pendingId != activeId) {
+                if (pendingWidth > 0) {
+                    if (activeId > 0 && active.getLayoutVersion() == pending.getLayoutVersion() && active.objects.size() == pending.objects.size()) {
+                        pending.copyPositionsTo(active);
+                    }
+                    else {
+                        pending.copyTo(active);
+                    }
+                }
+                activeSettings = pendingSettings;
+                activeWidth = pendingWidth;
+                activeHeight = pendingHeight;
+                activeId = pendingId;
+                nextStage = activeWidth > 0 ? 0 : stages.size();
+                bRestart = false;
+                if (nextStage == stages.size()) continue;
+            }
+        }
+        
+        const Stage &stage = stages[nextStage];
+        RenderSettings settings = activeSettings;
+        settings.nSquares = stage.nSquares;
+        pixels.allocate(std::max(1, activeWidth / stage.divisor), std::max(1, activeHeight / stage.divisor), OF_IMAGE_COLOR);
+        renderer.render(active, settings, pixels);
+        
+        std::lock_guard<std::mutex> guard(lock);
+        if (bRestart || pendingId != activeId) continue;     // stale - a newer request came in
+        result.swap(pixels);
+        resultStage = nextStage;
+        bNewResult = true;
+        nextStage++;
+    }
+}
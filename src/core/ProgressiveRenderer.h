@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Scene.h"
+#include "Renderer.h"
+
+//  Progressive preview renderer
+//
+//  Renders a private snapshot of the scene on a background thread in stages
+//  of increasing resolution and anti-aliasing, so an interactive edit gets a
+//  coarse image within a frame or two and refines while the mouse is still.
+//  restart() hands over the latest scene state; the pass in flight is
+//  abandoned and refinement starts again from the coarsest stage.
+//
+class ProgressiveRenderer {
+public:
+    struct Stage {
+        int divisor;        // render at 1/divisor of the full resolution
+        int nSquares;       // anti-aliasing grid for this stage
+    };
+    
+    ProgressiveRenderer(int nThreads = 0);
+    ~ProgressiveRenderer();
+    
+    // Start refining a new state of the scene.  Called from the app thread;
+    // copies what it needs, so the caller can keep editing scene right away.
+    //
+    void restart(const Scene &scene, const RenderSettings &settings, int width, int height);
+    
+    // Stop the current refinement and drop any result not yet collected
+    //
+    void cancel();
+    
+    // If a stage finished since the last call, swap its image into pixels
+    // and return true.  stage is set to the index of that stage in stages.
+    //
+    bool getLatest(ofPixels &pixels, int &stage);
+    
+    bool isFinalStage(int stage) const { return stage == stages.size() - 1; }
+    
+    vector<Stage> stages = { { 8, 1 }, { 4, 1 }, { 2, 1 }, { 1, 1 }, { 1, 2 } };
+    
+private:
+    void threadLoop();
+    
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool bQuit = false;
+    std::atomic<bool> bRestart{false};     // also cancels the tile loop of the pass in flight
+    
+    // latest request from the app thread (guarded by lock)
+    //
+    Scene pending;
+    RenderSettings pendingSettings;
+    int pendingWidth = 0;
+    int pendingHeight = 0;
+    unsigned long pendingId = 0;
+    
+    // what the render thread is refining
+    //
+    Scene active;
+    RenderSettings activeSettings;
+    int activeWidth = 0;
+    int activeHeight = 0;
+    unsigned long activeId = 0;
+    int nextStage = 0;
+    Renderer renderer;
+    
+    // finished stage waiting for getLatest() (guarded by lock)
+    //
+    ofPixels result;
+    int resultStage = -1;
+    bool bNewResult = false;
+};
@@ -0,0 +1,278 @@
+#include "RayPacket.h"
+#include "Scene.h"
+
+#ifdef PACKET_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// No fused multiply-adds in this file: AVX-512 implies FMA, and at -O2 GCC
+// fuses the kernels' separate multiplies and adds, which moves grazing hits
+// further than packetTolerance from the scalar kernels'
+//
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+static const float epsilon = std::numeric_limits<float>::epsilon();     // same as glm's intersect tests
+
+void RayPacket::add(const Ray &ray) {
+    ox[size] = ray.p.x; oy[size] = ray.p.y; oz[size] = ray.p.z;
+    dx[size] = ray.d.x; dy[size] = ray.d.y; dz[size] = ray.d.z;
+    size++;
+}
+
+Ray RayPacket::get(int i) const {
+    return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+}
+
+void PacketHits::reset(int size) {
+    for (int i = 0; i < maxPacketSize; i++) {
+        t[i] = i < size ? std::numeric_limits<float>::infinity() : -1;
+        id[i] = -1;
+    }
+}
+
+//  Scalar kernels - the reference the SIMD versions must match
+//
+static void spheresScalar(const RayPacket &rays, const SphereArrays &spheres, int first, int last, int idBase, PacketHits &hits) {
+    for (int k = first; k < last; k++) {
+        float radius2 = spheres.radius2[k];
+        if (radius2 < 0) continue;
+        for (int i = 0; i < rays.size; i++) {
+            float diffx = spheres.x[k] - rays.ox[i];
+            float diffy = spheres.y[k] - rays.oy[i];
+            float diffz = spheres.z[k] - rays.oz[i];
+            float t0 = diffx * rays.dx[i] + diffy * rays.dy[i] + diffz * rays.dz[i];
+            float dSquared = (diffx * diffx + diffy * diffy + diffz * diffz) - t0 * t0;
+            if (dSquared > radius2) continue;
+            float t1 = sqrtf(radius2 - dSquared);
+            float dist = t0 > t1 + epsilon ? t0 - t1 : t0 + t1;
+            if (dist > epsilon && dist < hits.t[i]) {
+                hits.t[i] = dist;
+                hits.id[i] = idBase + k;
+            }
+        }
+    }
+}
+
+static void planesScalar(const RayPacket &rays, const PlaneArrays &planes, int first, int last, int idBase, PacketHits &hits) {
+    for (int k = first; k < last; k++) {
+        for (int i = 0; i < rays.size; i++) {
+            float d = rays.dx[i] * planes.nx[k] + rays.dy[i] * planes.ny[k] + rays.dz[i] * planes.nz[k];
+            if (fabsf(d) <= epsilon) continue;
+            float dist = ((planes.px[k] - rays.ox[i]) * planes.nx[k] + (planes.py[k] - rays.oy[i]) * planes.ny[k] +
+                          (planes.pz[k] - rays.oz[i]) * planes.nz[k]) / d;
+            if (dist > 0 && dist < hits.t[i]) {
+                hits.t[i] = dist;
+                hits.id[i] = idBase + k;
+            }
+        }
+    }
+}
+
+#ifdef PACKET_SIMD_X86
+
+//  SSE4.1 - 4 rays per register
+//
+__attribute__((target("sse4.1")))
+static void spheresSSE(const RayPacket &rays, const SphereArrays &spheres, int first, int last, int idBase, PacketHits &hits) {
+    const __m128 eps = _mm_set1_ps(epsilon);
+    for (int c = 0; c < rays.size; c += 4) {
+        __m128 ox = _mm_load_ps(rays.ox + c), oy = _mm_load_ps(rays.oy + c), oz = _mm_load_ps(rays.oz + c);
+        __m128 dx = _mm_load_ps(rays.dx + c), dy = _mm_load_ps(rays.dy + c), dz = _mm_load_ps(rays.dz + c);
+        __m128 tBest = _mm_load_ps(hits.t + c);
+        __m128 idBest = _mm_castsi128_ps(_mm_load_si128((const __m128i *)(hits.id + c)));
+        for (int k = first; k < last; k++) {
+            if (spheres.radius2[k] < 0) continue;
+            __m128 radius2 = _mm_set1_ps(spheres.radius2[k]);
+            __m128 diffx = _mm_sub_ps(_mm_set1_ps(spheres.x[k]), ox);
+            __m128 diffy = _mm_sub_ps(_mm_set1_ps(spheres.y[k]), oy);
+            __m128 diffz = _mm_sub_ps(_mm_set1_ps(spheres.z[k]), oz);
+            __m128 t0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(diffx, dx), _mm_mul_ps(diffy, dy)), _mm_mul_ps(diffz, dz));
+            __m128 diff2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(diffx, diffx), _mm_mul_ps(diffy, diffy)), _mm_mul_ps(diffz, diffz));
+            __m128 dSquared = _mm_sub_ps(diff2, _mm_mul_ps(t0, t0));
+            __m128 inside = _mm_cmple_ps(dSquared, radius2);
+            __m128 t1 = _mm_sqrt_ps(_mm_sub_ps(radius2, dSquared));
+            __m128 dist = _mm_blendv_ps(_mm_add_ps(t0, t1), _mm_sub_ps(t0, t1), _mm_cmpgt_ps(t0, _mm_add_ps(t1, eps)));
+            __m128 hit = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(dist, eps), _mm_cmplt_ps(dist, tBest)));
+            tBest = _mm_blendv_ps(tBest, dist, hit);
+            idBest = _mm_blendv_ps(idBest, _mm_castsi128_ps(_mm_set1_epi32(idBase + k)), hit);
+        }
+        _mm_store_ps(hits.t + c, tBest);
+        _mm_store_si128((__m128i *)(hits.id + c), _mm_castps_si128(idBest));
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void planesSSE(const RayPacket &rays, const PlaneArrays &planes, int first, int last, int idBase, PacketHits &hits) {
+    const __m128 eps = _mm_set1_ps(epsilon);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (int c = 0; c < rays.size; c += 4) {
+        __m128 ox = _mm_load_ps(rays.ox + c), oy = _mm_load_ps(rays.oy + c), oz = _mm_load_ps(rays.oz + c);
+        __m128 dx = _mm_load_ps(rays.dx + c), dy = _mm_load_ps(rays.dy + c), dz = _mm_load_ps(rays.dz + c);
+        __m128 tBest = _mm_load_ps(hits.t + c);
+        __m128 idBest = _mm_castsi128_ps(_mm_load_si128((const __m128i *)(hits.id + c)));
+        for (int k = first; k < last; k++) {
+            __m128 nx = _mm_set1_ps(planes.nx[k]), ny = _mm_set1_ps(planes.ny[k]), nz = _mm_set1_ps(planes.nz[k]);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)), _mm_mul_ps(dz, nz));
+            __m128 num = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(planes.px[k]), ox), nx),
+                                               _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(planes.py[k]), oy), ny)),
+                                    _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(planes.pz[k]), oz), nz));
+            __m128 dist = _mm_div_ps(num, d);
+            __m128 hit = _mm_and_ps(_mm_cmpgt_ps(_mm_and_ps(d, absMask), eps),
+                                    _mm_and_ps(_mm_cmpgt_ps(dist, _mm_setzero_ps()), _mm_cmplt_ps(dist, tBest)));
+            tBest = _mm_blendv_ps(tBest, dist, hit);
+            idBest = _mm_blendv_ps(idBest, _mm_castsi128_ps(_mm_set1_epi32(idBase + k)), hit);
+        }
+        _mm_store_ps(hits.t + c, tBest);
+        _mm_store_si128((__m128i *)(hits.id + c), _mm_castps_si128(idBest));
+    }
+}
+
+//  AVX2 - 8 rays per register
+//
+__attribute__((target("avx2")))
+static void spheresAVX2(const RayPacket &rays, const SphereArrays &spheres, int first, int last, int idBase, PacketHits &hits) {
+    const __m256 eps = _mm256_set1_ps(epsilon);
+    for (int c = 0; c < rays.size; c += 8) {
+        __m256 ox = _mm256_load_ps(rays.ox + c), oy = _mm256_load_ps(rays.oy + c), oz = _mm256_load_ps(rays.oz + c);
+        __m256 dx = _mm256_load_ps(rays.dx + c), dy = _mm256_load_ps(rays.dy + c), dz = _mm256_load_ps(rays.dz + c);
+        __m256 tBest = _mm256_load_ps(hits.t + c);
+        __m256 idBest = _mm256_castsi256_ps(_mm256_load_si256((const __m256i *)(hits.id + c)));
+        for (int k = first; k < last; k++) {
+            if (spheres.radius2[k] < 0) continue;
+            __m256 radius2 = _mm256_set1_ps(spheres.radius2[k]);
+            __m256 diffx = _mm256_sub_ps(_mm256_set1_ps(spheres.x[k]), ox);
+            __m256 diffy = _mm256_sub_ps(_mm256_set1_ps(spheres.y[k]), oy);
+            __m256 diffz = _mm256_sub_ps(_mm256_set1_ps(spheres.z[k]), oz);
+            __m256 t0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(diffx, dx), _mm256_mul_ps(diffy, dy)), _mm256_mul_ps(diffz, dz));
+            __m256 diff2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(diffx, diffx), _mm256_mul_ps(diffy, diffy)), _mm256_mul_ps(diffz, diffz));
+            __m256 dSquared = _mm256_sub_ps(diff2, _mm256_mul_ps(t0, t0));
+            __m256 inside = _mm256_cmp_ps(dSquared, radius2, _CMP_LE_OQ);
+            __m256 t1 = _mm256_sqrt_ps(_mm256_sub_ps(radius2, dSquared));
+            __m256 dist = _mm256_blendv_ps(_mm256_add_ps(t0, t1), _mm256_sub_ps(t0, t1), _mm256_cmp_ps(t0, _mm256_add_ps(t1, eps), _CMP_GT_OQ));
+            __m256 hit = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(dist, eps, _CMP_GT_OQ), _mm256_cmp_ps(dist, tBest, _CMP_LT_OQ)));
+            tBest = _mm256_blendv_ps(tBest, dist, hit);
+            idBest = _mm256_blendv_ps(idBest, _mm256_castsi256_ps(_mm256_set1_epi32(idBase + k)), hit);
+        }
+        _mm256_store_ps(hits.t + c, tBest);
+        _mm256_store_si256((__m256i *)(hits.id + c), _mm256_castps_si256(idBest));
+    }
+}
+
+__attribute__((target("avx2")))
+static void planesAVX2(const RayPacket &rays, const PlaneArrays &planes, int first, int last, int idBase, PacketHits &hits) {
+    const __m256 eps = _mm256_set1_ps(epsilon);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for (int c = 0; c < rays.size; c += 8) {
+        __m256 ox = _mm256_load_ps(rays.ox + c), oy = _mm256_load_ps(rays.oy + c), oz = _mm256_load_ps(rays.oz + c);
+        __m256 dx = _mm256_load_ps(rays.dx + c), dy = _mm256_load_ps(rays.dy + c), dz = _mm256_load_ps(rays.dz + c);
+        __m256 tBest = _mm256_load_ps(hits.t + c);
+        __m256 idBest = _mm256_castsi256_ps(_mm256_load_si256((const __m256i *)(hits.id + c)));
+        for (int k = first; k < last; k++) {
+            __m256 nx = _mm256_set1_ps(planes.nx[k]), ny = _mm256_set1_ps(planes.ny[k]), nz = _mm256_set1_ps(planes.nz[k]);
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, nx), _mm256_mul_ps(dy, ny)), _mm256_mul_ps(dz, nz));
+            __m256 num = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(planes.px[k]), ox), nx),
+                                                     _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(planes.py[k]), oy), ny)),
+                                       _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(planes.pz[k]), oz), nz));
+            __m256 dist = _mm256_div_ps(num, d);
+            __m256 hit = _mm256_and_ps(_mm256_cmp_ps(_mm256_and_ps(d, absMask), eps, _CMP_GT_OQ),
+                                       _mm256_and_ps(_mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(dist, tBest, _CMP_LT_OQ)));
+            tBest = _mm256_blendv_ps(tBest, dist, hit);
+            idBest = _mm256_blendv_ps(idBest, _mm256_castsi256_ps(_mm256_set1_epi32(idBase + k)), hit);
+        }
+        _mm256_store_ps(hits.t + c, tBest);
+        _mm256_store_si256((__m256i *)(hits.id + c), _mm256_castps_si256(idBest));
+    }
+}
+
+//  AVX-512 - a whole 16 ray packet per register
+//
+__attribute__((target("avx512f")))
+static void spheresAVX512(const RayPacket &rays, const SphereArrays &spheres, int first, int last, int idBase, PacketHits &hits) {
+    const __m512 eps = _mm512_set1_ps(epsilon);
+    __m512 ox = _mm512_load_ps(rays.ox), oy = _mm512_load_ps(rays.oy), oz = _mm512_load_ps(rays.oz);
+    __m512 dx = _mm512_load_ps(rays.dx), dy = _mm512_load_ps(rays.dy), dz = _mm512_load_ps(rays.dz);
+    __m512 tBest = _mm512_load_ps(hits.t);
+    __m512i idBest = _mm512_load_si512(hits.id);
+    for (int k = first; k < last; k++) {
+        if (spheres.radius2[k] < 0) continue;
+        __m512 radius2 = _mm512_set1_ps(spheres.radius2[k]);
+        __m512 diffx = _mm512_sub_ps(_mm512_set1_ps(spheres.x[k]), ox);
+        __m512 diffy = _mm512_sub_ps(_mm512_set1_ps(spheres.y[k]), oy);
+        __m512 diffz = _mm512_sub_ps(_mm512_set1_ps(spheres.z[k]), oz);
+        __m512 t0 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(diffx, dx), _mm512_mul_ps(diffy, dy)), _mm512_mul_ps(diffz, dz));
+        __m512 diff2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(diffx, diffx), _mm512_mul_ps(diffy, diffy)), _mm512_mul_ps(diffz, diffz));
+        __m512 dSquared = _mm512_sub_ps(diff2, _mm512_mul_ps(t0, t0));
+        __mmask16 inside = _mm512_cmp_ps_mask(dSquared, radius2, _CMP_LE_OQ);
+        __m512 t1 = _mm512_sqrt_ps(_mm512_sub_ps(radius2, dSquared));
+        __mmask16 far = _mm512_cmp_ps_mask(t0, _mm512_add_ps(t1, eps), _CMP_GT_OQ);
+        __m512 dist = _mm512_mask_blend_ps(far, _mm512_add_ps(t0, t1), _mm512_sub_ps(t0, t1));
+        __mmask16 hit = inside & _mm512_cmp_ps_mask(dist, eps, _CMP_GT_OQ) & _mm512_cmp_ps_mask(dist, tBest, _CMP_LT_OQ);
+        tBest = _mm512_mask_blend_ps(hit, tBest, dist);
+        idBest = _mm512_mask_blend_epi32(hit, idBest, _mm512_set1_epi32(idBase + k));
+    }
+    _mm512_store_ps(hits.t, tBest);
+    _mm512_store_si512(hits.id, idBest);
+}
+
+__attribute__((target("avx512f")))
+static void planesAVX512(const RayPacket &rays, const PlaneArrays &planes, int first, int last, int idBase, PacketHits &hits) {
+    const __m512 eps = _mm512_set1_ps(epsilon);
+    __m512 ox = _mm512_load_ps(rays.ox), oy = _mm512_load_ps(rays.oy), oz = _mm512_load_ps(rays.oz);
+    __m512 dx = _mm512_load_ps(rays.dx), dy = _mm512_load_ps(rays.dy), dz = _mm512_load_ps(rays.dz);
+    __m512 tBest = _mm512_load_ps(hits.t);
+    __m512i idBest = _mm512_load_si512(hits.id);
+    for (int k = first; k < last; k++) {
+        __m512 nx = _mm512_set1_ps(planes.nx[k]), ny = _mm512_set1_ps(planes.ny[k]), nz = _mm512_set1_ps(planes.nz[k]);
+        __m512 d = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, nx), _mm512_mul_ps(dy, ny)), _mm512_mul_ps(dz, nz));
+        __m512 num = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(planes.px[k]), ox), nx),
+                                                 _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(planes.py[k]), oy), ny)),
+                                   _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(planes.pz[k]), oz), nz));
+        __m512 dist = _mm512_div_ps(num, d);
+        __m512 absD = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(d), _mm512_set1_epi32(0x7fffffff)));
+        __mmask16 hit = _mm512_cmp_ps_mask(absD, eps, _CMP_GT_OQ) & _mm512_cmp_ps_mask(dist, _mm512_setzero_ps(), _CMP_GT_OQ) &
+                        _mm512_cmp_ps_mask(dist, tBest, _CMP_LT_OQ);
+        tBest = _mm512_mask_blend_ps(hit, tBest, dist);
+        idBest = _mm512_mask_blend_epi32(hit, idBest, _mm512_set1_epi32(idBase + k));
+    }
+    _mm512_store_ps(hits.t, tBest);
+    _mm512_store_si512(hits.id, idBest);
+}
+
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef PACKET_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE;
+#endif
+    return SIMD_SCALAR;
+}
+
+const PacketKernels & packetKernels(SimdLevel level) {
+    static const PacketKernels scalar = { "scalar", 1, spheresScalar, planesScalar };
+#ifdef PACKET_SIMD_X86
+    static const PacketKernels sse = { "SSE4.1", 4, spheresSSE, planesSSE };
+    static const PacketKernels avx2 = { "AVX2", 8, spheresAVX2, planesAVX2 };
+    static const PacketKernels avx512 = { "AVX-512", 16, spheresAVX512, planesAVX512 };
+    static const SimdLevel supported = detectSimdLevel();
+    if (level > supported) level = supported;
+    switch (level) {
+        case SIMD_AVX512: return avx512;
+        case SIMD_AVX2: return avx2;
+        case SIMD_SSE: return sse;
+        default: break;
+    }
+#endif
+    return scalar;
+}
+
+const PacketKernels & packetKernels() {
+    static const PacketKernels &best = packetKernels(detectSimdLevel());
+    return best;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ofMain.h"
+
+class Ray;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PACKET_SIMD_X86     // x86 SIMD kernels, compiled per function with target attributes
+#endif
+
+//  Packet ray tracing
+//
+//  A RayPacket holds up to maxPacketSize rays in structure-of-arrays form so
+//  one SIMD instruction works on the same component of 4 (SSE), 8 (AVX2) or
+//  16 (AVX-512) rays at once.  The kernels below intersect every ray in a
+//  packet against a run of spheres or planes, also stored as arrays, and keep
+//  the closest hit per ray.
+//
+//  Which kernels are used is decided once at startup from the CPU's features
+//  (packetKernels()); anything other than x86 gets the scalar versions.  The
+//  SIMD kernels evaluate the same expressions in the same order as the
+//  scalar ones and glm::intersectRaySphere()/intersectRayPlane(), so hit
+//  distances agree to within packetTolerance (relative).  RayPacket.cpp is
+//  compiled without fused multiply-adds, which would break that for the
+//  kernels of any level with FMA (AVX-512); glm's tests in other files
+//  can still be contracted if the whole build targets FMA.
+//
+static const int maxPacketSize = 16;
+static const float packetTolerance = 1e-5f;
+
+struct alignas(64) RayPacket {
+    float ox[maxPacketSize] = {}, oy[maxPacketSize] = {}, oz[maxPacketSize] = {};
+    float dx[maxPacketSize] = {}, dy[maxPacketSize] = {}, dz[maxPacketSize] = {};
+    int size = 0;
+    
+    void add(const Ray &ray);
+    Ray get(int i) const;
+};
+
+//  Closest hit so far for each ray of a packet.  Lanes past the packet's
+//  size start with t = -1 so they can never record a hit.
+//
+struct alignas(64) PacketHits {
+    float t[maxPacketSize];
+    int id[maxPacketSize];
+    
+    void reset(int size);
+};
+
+struct SphereArrays {
+    vector<float> x, y, z;
+    vector<float> radius;
+    vector<float> radius2;      // radius squared, < 0 for slots that aren't spheres
+    
+    void resize(int n) { x.resize(n); y.resize(n); z.resize(n); radius.resize(n); radius2.resize(n, -1); }
+    void set(int i, const glm::vec3 &center, float r) { x[i] = center.x; y[i] = center.y; z[i] = center.z; radius[i] = r; radius2[i] = r * r; }
+    void clear() { x.clear(); y.clear(); z.clear(); radius.clear(); radius2.clear(); }
+    glm::vec3 center(int i) const { return glm::vec3(x[i], y[i], z[i]); }
+};
+
+struct PlaneArrays {
+    vector<float> px, py, pz;   // point on plane
+    vector<float> nx, ny, nz;   // normal
+    
+    int size() const { return px.size(); }
+    glm::vec3 point(int i) const { return glm::vec3(px[i], py[i], pz[i]); }
+    glm::vec3 normal(int i) const { return glm::vec3(nx[i], ny[i], nz[i]); }
+    void set(int i, const glm::vec3 &p, const glm::vec3 &n) { px[i] = p.x; py[i] = p.y; pz[i] = p.z; nx[i] = n.x; ny[i] = n.y; nz[i] = n.z; }
+    void add(const glm::vec3 &p, const glm::vec3 &n) {
+        px.push_back(p.x); py.push_back(p.y); pz.push_back(p.z);
+        nx.push_back(n.x); ny.push_back(n.y); nz.push_back(n.z);
+    }
+    void clear() { px.clear(); py.clear(); pz.clear(); nx.clear(); ny.clear(); nz.clear(); }
+};
+
+//  Intersect the packet with spheres/planes [first, last).  A hit closer than
+//  hits.t[lane] replaces it and sets hits.id[lane] to idBase + the index.
+//
+typedef void (*SpherePacketKernel)(const RayPacket &rays, const SphereArrays &spheres, int first, int last, int idBase, PacketHits &hits);
+typedef void (*PlanePacketKernel)(const RayPacket &rays, const PlaneArrays &planes, int first, int last, int idBase, PacketHits &hits);
+
+struct PacketKernels {
+    const char *name;
+    int width;                  // rays per SIMD register
+    SpherePacketKernel spheres;
+    PlanePacketKernel planes;
+};
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE, SIMD_AVX2, SIMD_AVX512 };
+
+SimdLevel detectSimdLevel();
+const PacketKernels & packetKernels();                 // best kernels this CPU supports
+const PacketKernels & packetKernels(SimdLevel level);  // a specific set (tests/renderTests), scalar if unsupported
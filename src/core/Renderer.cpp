@@ -0,0 +1,491 @@
+#include "Renderer.h"
+#include "Profiler.h"
+
+void Renderer::render(const Scene &scene, const RenderSettings &settings, ofPixels &pixels) {
+    PROFILE_SPAN("render");
+    uint64_t start = ofGetElapsedTimeMicros();
+    if (frame.getWidth() != pixels.getWidth() || frame.getHeight() != pixels.getHeight()) {
+        frame.allocate(pixels.getWidth(), pixels.getHeight());
+    }
+    else {
+        frame.clear();
+    }
+    pass = 0;
+    accumulate(scene, settings, frame);
+    frame.resolve(pixels);
+    stats.renderMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+}
+
+void Renderer::render(const Scene &scene, const RenderSettings &settings, int width, int height, int x, int y, ofPixels &pixels) {
+    PROFILE_SPAN("render region");
+    uint64_t start = ofGetElapsedTimeMicros();
+    int x1 = x + pixels.getWidth();
+    int y1 = y + pixels.getHeight();
+    
+    // adaptive anti-aliasing compares the region's edge pixels with their
+    // neighbors outside it, so the frame buffer takes in a pixel more all
+    // around (inside the image), and only the region is refined
+    //
+    int border = settings.adaptive && settings.nSquares > 1 ? 1 : 0;
+    frameX = std::max(0, x - border);
+    frameY = std::max(0, y - border);
+    int frameWidth = std::min(width, x1 + border) - frameX;
+    int frameHeight = std::min(height, y1 + border) - frameY;
+    if (frame.getWidth() != frameWidth || frame.getHeight() != frameHeight) {
+        frame.allocate(frameWidth, frameHeight);
+    }
+    else {
+        frame.clear();
+    }
+    imageWidth = width;
+    imageHeight = height;
+    refineX0 = x - frameX;
+    refineY0 = y - frameY;
+    refineX1 = x1 - frameX;
+    refineY1 = y1 - frameY;
+    pass = 0;
+    trace(scene, settings, frame);
+    
+    frame.resolve(regionPixels);
+    size_t row = pixels.getWidth() * 3;
+    for (int j = 0; j < pixels.getHeight(); j++) {
+        memcpy(pixels.getData() + j * row, regionPixels.getData() + ((size_t)(j + refineY0) * frameWidth + refineX0) * 3, row);
+    }
+    stats.renderMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+}
+
+void Renderer::accumulate(const Scene &scene, const RenderSettings &settings, FrameBuffer &frame) {
+    imageWidth = frame.getWidth();
+    imageHeight = frame.getHeight();
+    frameX = frameY = 0;
+    refineX0 = refineY0 = 0;
+    refineX1 = imageWidth;
+    refineY1 = imageHeight;
+    trace(scene, settings, frame);
+}
+
+// One pass of samples over frame, which covers the image pixels from
+// (frameX, frameY)
+//
+void Renderer::trace(const Scene &scene, const RenderSettings &settings, FrameBuffer &frame) {
+    uint64_t start = ofGetElapsedTimeMicros();
+    this->scene = &scene;
+    this->settings = settings;
+    renderCam = scene.renderCam;
+    pixelSpread = renderCam.view.width() / imageWidth / glm::distance(renderCam.position, renderCam.view.toWorld(0.5, 0.5));
+    
+    // copy the objects into the flat primitive store, then refit the BVH to
+    // their new positions (or rebuild if needed).  A scene loaded compiled
+    // comes with its trees, which only need the refit.
+    //
+    {
+        PROFILE_SCOPE(STAGE_SYNC);
+        PROFILE_SPAN("sync");
+        store.sync(scene.objects);
+        const PrebuiltScene *prebuilt = scene.getPrebuilt();
+        if (prebuilt && !bvh.isBuiltOver(store)) bvh.build(store, prebuilt->bvh);
+        if (prebuilt && !occluders.isBuiltOver(store)) occluders.build(store, prebuilt->occluders);
+        bvh.update(store);
+        occluders.update(store);
+    }
+    
+    // how many lights each shading point gets: the budget is spread over
+    // the primary rays this pass is expected to trace.  With adaptive
+    // anti-aliasing that is a fixed guess, the center ray plus the grid in
+    // a quarter of the pixels - not what the last render traced, or an
+    // image would depend on what this renderer rendered before it.
+    //
+    int nLights = scene.lights.size();
+    lightsPerPoint = settings.lightSamples;
+    if (settings.lightBudget > 0 && nLights > 0) {
+        float samples = settings.nSquares * settings.nSquares;
+        if (settings.adaptive && settings.nSquares > 1) samples = 1 + samples / 4;
+        int budgeted = std::max(1, (int)(settings.lightBudget / (samples * imageWidth * imageHeight)));
+        lightsPerPoint = lightsPerPoint > 0 ? std::min(lightsPerPoint, budgeted) : budgeted;
+    }
+    if (lightsPerPoint >= nLights) lightsPerPoint = 0;      // sampling every light is just the exhaustive loop
+    if (lightsPerPoint > 0) lightTree.build(scene.lights, settings.spotlightAngle);
+    
+    // Shade the image tile by tile across all cores
+    //
+    contexts.assign(tileRenderer.getThreads(), TraceContext());
+    if (settings.adaptive && settings.nSquares > 1) {
+        tracePass(frame, 1, nullptr);
+        findEdges(frame);
+        tracePass(frame, settings.nSquares, refine.data());
+    }
+    else {
+        tracePass(frame, settings.nSquares, nullptr);
+    }
+    
+    // let the texture tiles go, so the cache can evict them between renders
+    //
+    for (TraceContext &ctx : contexts) ctx.textures.release();
+    
+    stats = RenderStats();
+    for (const TraceContext &ctx : contexts) {
+        stats.primaryRays += ctx.primaryRays;
+        stats.secondaryRays += ctx.secondaryRays;
+        stats.shadowRays += ctx.shadowRays;
+        stats.shadowCacheHits += ctx.shadowCacheHits;
+    }
+    stats.samplesPerPixel = stats.primaryRays / std::max(1.0f, (float)frame.getWidth() * frame.getHeight());
+    stats.lightsPerPoint = lightsPerPoint;
+    stats.renderMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+    pass++;
+}
+
+// Add nSquares x nSquares samples to every pixel of frame, or only to the
+// pixels set in mask (one per frame pixel, row by row) if there is one
+//
+void Renderer::tracePass(FrameBuffer &frame, int nSquares, const unsigned char *mask) {
+    PROFILE_SPAN("pass");
+    int samples = nSquares * nSquares;
+    int width = frame.getWidth();
+    if (bPackets && samples <= maxPacketSize) {
+        int pixelsPerPacket = maxPacketSize / samples;
+        tileRenderer.render(frame, pixelsPerPacket, [=](int i, int j, int count, int worker, glm::vec4 *samples) {
+            renderSpan(frameX + i, frameY + j, count, nSquares, contexts[worker], samples, mask ? mask + j * width + i : nullptr);
+        });
+    }
+    else {
+        tileRenderer.render(frame, [=](int i, int j, int worker) {
+            if (mask && !mask[j * width + i]) return glm::vec4(0);
+            return renderPixel(frameX + i, frameY + j, nSquares, contexts[worker]);
+        });
+    }
+}
+
+// Mark the pixels for the adaptive grid pass: those whose color so far
+// differs from one of their 8 neighbors by more than the threshold in any
+// channel.  Colors are compared as they will be displayed (clamped), so
+// differences inside blown out highlights don't count.  That catches both
+// object edges and shadow boundaries, from both sides.
+//
+void Renderer::findEdges(const FrameBuffer &frame) {
+    PROFILE_SPAN("edges");
+    int width = frame.getWidth();
+    int height = frame.getHeight();
+    vector<glm::vec3> colors(width * height);
+    refine.assign(width * height, 0);
+    
+    ThreadPool &pool = tileRenderer.getPool();
+    pool.parallelFor(height, [&](int j, int worker) {
+        for (int i = 0; i < width; i++) {
+            colors[j * width + i] = glm::min(glm::max(frame.getColor(i, j), glm::vec3(0)), glm::vec3(1));
+        }
+    });
+    pool.parallelFor(height, [&](int j, int worker) {
+        for (int i = 0; i < width; i++) {
+            const glm::vec3 &c = colors[j * width + i];
+            bool edge = false;
+            for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1) && !edge; y++) {
+                for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); x++) {
+                    glm::vec3 d = glm::abs(colors[y * width + x] - c);
+                    if (std::max(d.x, std::max(d.y, d.z)) > settings.adaptiveThreshold) {
+                        edge = true;
+                        break;
+                    }
+                }
+            }
+            refine[j * width + i] = edge && i >= refineX0 && i < refineX1 && j >= refineY0 && j < refineY1;
+        }
+    });
+}
+
+// Samples for pixel (i, j) - the sum of their colors and how many - called
+// concurrently from the render threads, so this must only read shared state
+//
+glm::vec4 Renderer::renderPixel(int i, int j, int nSquares, TraceContext &ctx) {
+    float width = imageWidth;
+    float height = imageHeight;
+    float iNudge = i + 0.5f;
+    float jNudge = j + 0.5f;
+    
+    float u = iNudge / width;
+    float v = (height - jNudge) / height;
+    
+    // ANTI-ALIASING METHOD
+    // Use an nSquares x nSquares grid (2x2 by default) for anti aliasing
+    ctx.seed(j * imageWidth + i, pass, nSquares);
+    glm::vec3 colorSum = glm::vec3(0);
+    for (float x = -(nSquares - 1.0f) / 2.0f; x <= (nSquares - 1.0f) / 2.0f; x++) {
+        for (float y = -(nSquares - 1.0f) / 2.0f; y <= (nSquares - 1.0f) / 2.0f; y++) {
+            float uTemp = u + (x / (width * nSquares));
+            float vTemp = v + (y / (height * nSquares));
+            Ray currentRay = renderCam.getRay(uTemp, vTemp);
+            colorSum += rayTrace(currentRay, ctx);
+        }
+    }
+    ctx.primaryRays += nSquares * nSquares;
+    return glm::vec4(colorSum, nSquares * nSquares);
+    
+    // ALIASING METHOD
+//    Ray currentRay = renderCam.getRay(u, v);
+//    return rayTrace(currentRay, ctx); // default black for when it does not hit
+}
+
+// Pixels i .. i + count - 1 of row j, traced as one packet of all their
+// anti-aliasing rays.  Rays are generated and summed in the same order as
+// renderPixel(), so both give the same colors.  If there is a mask (of the
+// span's pixels) only pixels set in it are traced, the others get no
+// samples.
+//
+void Renderer::renderSpan(int i, int j, int count, int nSquares, TraceContext &ctx, glm::vec4 *samples, const unsigned char *mask) {
+    float width = imageWidth;
+    float height = imageHeight;
+    int samplesPerPixel = nSquares * nSquares;
+    
+    RayPacket packet;
+    for (int k = 0; k < count; k++) {
+        if (mask && !mask[k]) continue;
+        float u = (i + k + 0.5f) / width;
+        float v = (height - (j + 0.5f)) / height;
+        for (float x = -(nSquares - 1.0f) / 2.0f; x <= (nSquares - 1.0f) / 2.0f; x++) {
+            for (float y = -(nSquares - 1.0f) / 2.0f; y <= (nSquares - 1.0f) / 2.0f; y++) {
+                float uTemp = u + (x / (width * nSquares));
+                float vTemp = v + (y / (height * nSquares));
+                packet.add(renderCam.getRay(uTemp, vTemp));
+            }
+        }
+    }
+    
+    Hit hits[maxPacketSize];
+    if (packet.size > 0) intersectPacket(packet, hits);
+    
+    int r = 0;
+    for (int k = 0; k < count; k++) {
+        if (mask && !mask[k]) {
+            samples[k] = glm::vec4(0);
+            continue;
+        }
+        ctx.seed(j * imageWidth + i + k, pass, nSquares);
+        glm::vec3 colorSum = glm::vec3(0);
+        for (int s = 0; s < samplesPerPixel; s++, r++) {
+            colorSum += shade(packet.get(r), hits[r], ctx);
+        }
+        samples[k] = glm::vec4(colorSum, samplesPerPixel);
+    }
+    ctx.primaryRays += r;
+}
+
+glm::vec3 Renderer::rayTrace(const Ray &ray, TraceContext &ctx) {
+    Hit hit;
+    intersect(ray, hit);
+    return shade(ray, hit, ctx);       // default black for when it does not hit
+}
+
+void Renderer::intersect(const Ray *rays, int count, Hit *hits) {
+    if (!bPackets) {
+        for (int r = 0; r < count; r++) intersect(rays[r], hits[r]);
+        return;
+    }
+    for (int first = 0; first < count; first += maxPacketSize) {
+        RayPacket packet;
+        int n = std::min(maxPacketSize, count - first);
+        for (int r = 0; r < n; r++) packet.add(rays[first + r]);
+        intersectPacket(packet, hits + first);
+    }
+}
+
+bool Renderer::intersect(const Ray &ray, Hit &hit) {
+    PROFILE_SCOPE(STAGE_CLOSEST_HIT);
+    hit = Hit();
+    int prim;
+    float t;
+    return bvh.intersect(ray, prim, t) && store.resolve(prim, ray, hit);
+}
+
+// The packet kernels only find which primitive each ray hits first.  The
+// point and normal come from the store's scalar test, so packet and single
+// ray tracing shade identically; if that disagrees with the packet kernel
+// (a grazing hit right at the kernel's tolerance) the ray is simply traced
+// again on its own.
+//
+void Renderer::intersectPacket(const RayPacket &packet, Hit *hits) {
+    int prims[maxPacketSize];
+    {
+        PROFILE_SCOPE(STAGE_CLOSEST_HIT);
+        PROFILE_COUNT(COUNTER_PACKETS, 1);
+        PROFILE_COUNT(COUNTER_PACKET_RAYS, packet.size);
+        bvh.intersect(packet, prims);
+    }
+    for (int r = 0; r < packet.size; r++) {
+        hits[r] = Hit();
+        if (prims[r] < 0) continue;
+        Ray ray = packet.get(r);
+        if (!store.resolve(prims[r], ray, hits[r])) {
+            PROFILE_COUNT(COUNTER_RETRACED, 1);
+            intersect(ray, hits[r]);
+        }
+    }
+}
+
+// Color for a ray whose closest hit is hit.
+//
+// Mirror and glass surfaces push the rays they reflect and refract onto
+// ctx's ray stack, and they are all traced here, in a loop rather than by
+// recursion, before the color is returned.
+//
+glm::vec3 Renderer::shade(const Ray &ray, const Hit &hit, TraceContext &ctx) {
+    if (!hit.isHit()) return glm::vec3(0);
+    PROFILE_SCOPE(STAGE_SHADING);
+    glm::vec3 color = shadeSurface(ray, hit, glm::vec3(1), 0, 0, ctx);
+    while (ctx.nRays > 0) {
+        TraceContext::SecondaryRay next = ctx.rays[--ctx.nRays];
+        Ray secondary(next.p, next.d);
+        ctx.secondaryRays++;
+        Hit secondaryHit;
+        if (intersect(secondary, secondaryHit)) color += shadeSurface(secondary, secondaryHit, next.weight, next.depth, next.distance, ctx);
+    }
+    return color;
+}
+
+// Light leaving the hit point back along ray, which got there after depth
+// bounces, times weight.  Reflective and transparent materials give only
+// the rest of their light to Phong shading and push the reflected and
+// refracted rays, split by Fresnel's law for glass (Schlick's
+// approximation), up to the material's and the render's maxDepth.
+//
+// Texture maps are filtered over about a pixel's footprint: its width at
+// the distance the ray has travelled from the camera (reflections and
+// refractions count as straight on), in texture coordinates.
+//
+glm::vec3 Renderer::shadeSurface(const Ray &ray, const Hit &hit, const glm::vec3 &weight, int depth, float distance, TraceContext &ctx) {
+    const Material &material = store.materials[hit.material];
+    const glm::vec3 &pt = hit.point;
+    const glm::vec3 &normal = hit.normal;
+    glm::vec3 diffuse = material.diffuse;
+    glm::vec3 specular = material.specular;
+    if (hit.uvScale > 0) {
+        PROFILE_SCOPE(STAGE_TEXTURING);
+        float footprint = pixelSpread * (distance + hit.t) * hit.uvScale;
+        if (material.diffuseMap >= 0) diffuse = ctx.textures.sample(material.diffuseMap, hit.uv, footprint);
+        if (material.specularMap >= 0) specular = ctx.textures.sample(material.specularMap, hit.uv, footprint);
+    }
+    glm::vec3 v = glm::normalize(ray.p - pt);
+    glm::vec3 local = ambient(diffuse, settings.ambientPercent) + phong(pt, normal, v, diffuse, specular, settings.phongExponent, ctx);
+    if (material.reflectivity == 0 && material.transparency == 0) return weight * local;
+    
+    int maxDepth = std::min(std::min(material.maxDepth, settings.maxDepth), maxRayDepth);
+    if (depth >= maxDepth) return weight * local;
+    
+    // n faces the side the ray came from
+    //
+    float epsilon = 0.001;
+    float cosIncident = -glm::dot(ray.d, normal);
+    bool entering = cosIncident > 0;
+    glm::vec3 n = entering ? normal : -normal;
+    cosIncident = fabs(cosIncident);
+    
+    float reflected = material.reflectivity;
+    if (material.transparency > 0) {
+        float eta = entering ? 1 / material.refractiveIndex : material.refractiveIndex;
+        glm::vec3 refracted = glm::refract(ray.d, n, eta);
+        float fresnel = 1;      // total internal reflection
+        if (glm::dot(refracted, refracted) > 0) {
+            float r0 = (material.refractiveIndex - 1) / (material.refractiveIndex + 1);
+            r0 *= r0;
+            float c = 1 - (eta < 1 ? cosIncident : -glm::dot(refracted, n));
+            fresnel = r0 + (1 - r0) * c * c * c * c * c;
+            pushRay(pt - epsilon * n, glm::normalize(refracted), weight * (material.transparency * (1 - fresnel)), depth + 1, distance + hit.t, ctx);
+        }
+        reflected += material.transparency * fresnel;
+    }
+    pushRay(pt + epsilon * n, glm::reflect(ray.d, n), weight * reflected, depth + 1, distance + hit.t, ctx);
+    return weight * (1 - material.reflectivity - material.transparency) * local;
+}
+
+// Push a secondary ray carrying weight of the camera ray's color.  Past the
+// first couple of bounces, rays carrying less than rouletteWeight play
+// Russian roulette: one survives with a probability proportional to its
+// strongest channel and carries rouletteWeight if it does, so dim rays
+// mostly end early without making the image any darker on average.
+//
+void Renderer::pushRay(const glm::vec3 &p, const glm::vec3 &d, glm::vec3 weight, int depth, float distance, TraceContext &ctx) {
+    static const int rouletteDepth = 2;
+    static const float rouletteWeight = 0.1;
+    float strength = std::max(weight.x, std::max(weight.y, weight.z));
+    if (strength <= 0) return;
+    if (depth > rouletteDepth && strength < rouletteWeight) {
+        float survival = strength / rouletteWeight;
+        if (ctx.random() >= survival) return;
+        weight /= survival;
+    }
+    if (ctx.nRays == 2 * maxRayDepth) return;     // can't happen, see TraceContext
+    ctx.rays[ctx.nRays++] = { p, d, weight, depth, distance };
+}
+
+// True if something blocks ray before tMax on its way to light (an index
+// into the scene's lights).  Lights never block each other's light: they
+// aren't in the occluders tree at all.
+//
+bool Renderer::inShadow(const Ray &ray, float tMax, int light, TraceContext &ctx) {
+    PROFILE_SCOPE(STAGE_SHADOW);
+    ctx.shadowRays++;
+    if (light >= ctx.lastOccluder.size()) ctx.lastOccluder.resize(light + 1, -1);
+    int &last = ctx.lastOccluder[light];
+    if (last >= 0 && store.occluded(last, ray, tMax)) {
+        ctx.shadowCacheHits++;
+        return true;
+    }
+    int prim;
+    if (!occluders.occluded(ray, tMax, prim)) return false;
+    
+    // an instance isn't worth caching: testing it is a traversal of its
+    // geometry's own BVH, which a miss would then repeat in the occluders tree
+    //
+    if (store.type(prim) != PRIM_INSTANCE) last = prim;
+    return true;
+}
+
+glm::vec3 Renderer::ambient(const glm::vec3 &diffuse, float percentage) {
+    return diffuse * percentage;
+}
+
+// Lambert + Blinn-Phong light from scene->lights[light] at p (v is the
+// direction to the camera), scaled by the light's intensity - 0 if it is
+// shadowed or its cone misses p
+//
+glm::vec3 Renderer::illuminate(int light, const glm::vec3 &p, const glm::vec3 &norm, const glm::vec3 &v, const glm::vec3 &diffuse, const glm::vec3 &specular, float power, TraceContext &ctx) {
+    Light * source = scene->lights[light];
+    glm::vec3 l = glm::normalize(source->position - p);
+    float epsilon = 0.001;
+    glm::vec3 epsilonDistance = p + epsilon * l;
+    Ray lightRay = Ray(epsilonDistance, l);
+    
+    // Check whether the point is illuminated by the type of light and
+    // if so, whether anything between it and the light shadows it
+    if (!source->isIlluminated(l, settings.spotlightAngle) || inShadow(lightRay, glm::length(source->position - epsilonDistance), light, ctx)) {
+        return glm::vec3(0);
+    }
+    // Solve for the bisector
+    glm::vec3 b = (v + l) / glm::length(v + l);
+    glm::vec3 lambert = max(float(0.0), glm::dot(norm, l)) * source->intensity * diffuse;
+    glm::vec3 phong = specular * source->intensity * glm::pow(max(float(0.0), glm::dot(norm, b)), power);
+    return phong + lambert;
+}
+
+// Light from the scene's lights at p, seen from direction v
+//
+glm::vec3 Renderer::phong(const glm::vec3 &p, const glm::vec3 &norm, const glm::vec3 &v, const glm::vec3 &diffuse, const glm::vec3 &specular, float power, TraceContext &ctx) {
+    glm::vec3 diffusedColor = glm::vec3(0);
+    if (lightsPerPoint == 0) {
+        for (int i = 0; i < scene->lights.size(); i++) {
+            diffusedColor += illuminate(i, p, norm, v, diffuse, specular, power, ctx);
+        }
+        return diffusedColor;
+    }
+    
+    // Many lights: average lightsPerPoint lights picked by importance, each
+    // weighted by 1 / the probability it was picked with.  A pick that ends
+    // at a light which can't reach p is still a sample, worth 0.
+    //
+    for (int k = 0; k < lightsPerPoint; k++) {
+        float probability;
+        int i = lightTree.sample(p, norm, ctx.random(), probability);
+        if (i < 0) continue;
+        diffusedColor += illuminate(i, p, norm, v, diffuse, specular, power, ctx) / probability;
+    }
+    return diffusedColor / (float)lightsPerPoint;
+}
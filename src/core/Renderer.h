@@ -0,0 +1,197 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Scene.h"
+#include "SceneStore.h"
+#include "BVH.h"
+#include "TileRenderer.h"
+#include "FrameBuffer.h"
+#include "LightTree.h"
+#include "TextureCache.h"
+
+//  Shading parameters, copied out of the GUI once per render so the render
+//  threads never touch the sliders
+//
+struct RenderSettings {
+    float ambientPercent = 0.1;
+    float lightIntensity = 0.8;  // for the default scene's lights, shading uses each Light::intensity
+    int phongExponent = 50;
+    int spotlightAngle = 50;
+    int nSquares = 2;           // anti-aliasing grid, nSquares x nSquares rays per pixel
+    
+    // Adaptive anti-aliasing: trace one ray through each pixel center first,
+    // and the nSquares x nSquares grid only in pixels whose color differs
+    // from a neighbor's by more than adaptiveThreshold (0..1) in a channel
+    //
+    bool adaptive = true;
+    float adaptiveThreshold = 0.03;
+    
+    // Many lights: instead of every light, shade each point with
+    // lightSamples lights picked by importance (see LightTree), and/or as
+    // many as fit in lightBudget light evaluations per frame.  0 = no
+    // limit.  Noisy, but unbiased - the average is the exhaustive image.
+    //
+    int lightSamples = 0;
+    int lightBudget = 0;
+    
+    // Mirror and glass: the most reflection and refraction bounces a
+    // camera ray is followed through, on top of each material's own
+    // maxDepth (and never more than maxRayDepth)
+    //
+    int maxDepth = 5;
+    
+    bool operator==(const RenderSettings &s) const {
+        return ambientPercent == s.ambientPercent && lightIntensity == s.lightIntensity &&
+               phongExponent == s.phongExponent && spotlightAngle == s.spotlightAngle && nSquares == s.nSquares &&
+               adaptive == s.adaptive && adaptiveThreshold == s.adaptiveThreshold &&
+               lightSamples == s.lightSamples && lightBudget == s.lightBudget && maxDepth == s.maxDepth;
+    }
+    bool operator!=(const RenderSettings &s) const { return !(*this == s); }
+};
+
+static const int maxRayDepth = 16;     // reflection and refraction bounces, at most
+
+//  Per-thread state for tracing.  Each render worker owns one, so nothing in
+//  here is ever shared between threads.
+//
+struct alignas(64) TraceContext {
+    uint64_t primaryRays = 0;
+    uint64_t secondaryRays = 0;     // reflected and refracted
+    uint64_t shadowRays = 0;
+    uint64_t shadowCacheHits = 0;   // shadow rays blocked by the light's last occluder
+    
+    // by light index, the primitive that last blocked a shadow ray to that
+    // light (-1 for none).  Neighboring pixels tend to be shadowed by the
+    // same object, so it is tested first.
+    //
+    vector<int> lastOccluder;
+    
+    TextureReader textures;         // the texture tiles this thread has pinned
+    
+    // Random numbers for light sampling, reseeded for every pixel so an
+    // image doesn't depend on which thread rendered what
+    //
+    uint32_t rng = 0;
+    void seed(uint32_t a, uint32_t b, uint32_t c) { rng = hash(a ^ hash(b ^ hash(c))); }
+    float random() {
+        rng = rng * 747796405u + 2891336453u;
+        return (hash(rng) >> 8) * (1.0f / 16777216.0f);     // [0, 1)
+    }
+    static uint32_t hash(uint32_t x) {
+        x ^= x >> 16; x *= 0x7feb352d;
+        x ^= x >> 15; x *= 0x846ca68b;
+        x ^= x >> 16;
+        return x;
+    }
+    
+    // Reflected and refracted rays still to trace for the camera ray being
+    // shaded.  A fixed stack instead of recursion: rays are traced depth
+    // first, each one popped pushes at most two, so it never holds more
+    // than maxRayDepth + 1 and the per-thread memory touched stays small.
+    //
+    struct SecondaryRay {
+        glm::vec3 p, d;
+        glm::vec3 weight;       // share of the camera ray's color it carries
+        int depth;              // bounces so far, 1 for the first
+        float distance;         // travelled from the camera to p
+    };
+    SecondaryRay rays[2 * maxRayDepth];
+    int nRays = 0;
+};
+
+//  Timing and ray counts for the last render()
+//
+struct RenderStats {
+    uint64_t primaryRays = 0;
+    uint64_t secondaryRays = 0;
+    uint64_t shadowRays = 0;
+    uint64_t shadowCacheHits = 0;
+    float samplesPerPixel = 0;      // average primary rays per pixel
+    int lightsPerPoint = 0;         // lights sampled per shading point, 0 = all of them
+    float renderMs = 0;
+    
+    uint64_t rays() const { return primaryRays + secondaryRays + shadowRays; }
+    double raysPerSecond() const { return renderMs > 0 ? rays() / (renderMs / 1000.0) : 0; }
+};
+
+//  The ray tracer - turns a Scene into pixels
+//
+class Renderer {
+public:
+    Renderer(int nThreads = 0) : tileRenderer(nThreads) { occluders.bSkipLights = true; }
+    
+    void setThreads(int nThreads) { tileRenderer.setThreads(nThreads); }
+    
+    // Render scene through its RenderCam into pixels, which must already be
+    // allocated at the output resolution (3 channels)
+    //
+    void render(const Scene &scene, const RenderSettings &settings, ofPixels &pixels);
+    
+    // Render only the part of a width x height image whose top left pixel is
+    // (x, y) into pixels, allocated at that part's size - exactly the pixels
+    // render() gives there, so a frame can be split between machines
+    //
+    void render(const Scene &scene, const RenderSettings &settings, int width, int height, int x, int y, ofPixels &pixels);
+    
+    // Add one pass of samples to frame, which must already be allocated at
+    // the output resolution: nSquares x nSquares per pixel, or with adaptive
+    // anti-aliasing 1 per pixel plus the grid where they're needed
+    //
+    void accumulate(const Scene &scene, const RenderSettings &settings, FrameBuffer &frame);
+    
+    const RenderStats & getStats() const { return stats; }
+    
+    // Colors are linear float RGB, 0..1 displayable, and only clamped when
+    // the frame buffer is resolved
+    //
+    glm::vec4 renderPixel(int i, int j, int nSquares, TraceContext &ctx);
+    void renderSpan(int i, int j, int count, int nSquares, TraceContext &ctx, glm::vec4 *samples, const unsigned char *mask = nullptr);
+    
+    // Closest hits of rays[0 .. count - 1] into hits, traced in packets if
+    // bPackets is set (the same hits either way), for shading afterwards -
+    // once per ray, whatever else it passed through
+    //
+    void intersect(const Ray *rays, int count, Hit *hits);
+    bool intersect(const Ray &ray, Hit &hit);
+    glm::vec3 rayTrace(const Ray &ray, TraceContext &ctx);
+    glm::vec3 shade(const Ray &ray, const Hit &hit, TraceContext &ctx);
+    bool inShadow(const Ray &ray, float tMax, int light, TraceContext &ctx);
+    glm::vec3 illuminate(int light, const glm::vec3 &p, const glm::vec3 &norm, const glm::vec3 &v, const glm::vec3 &diffuse, const glm::vec3 &specular, float power, TraceContext &ctx);
+    glm::vec3 phong(const glm::vec3 &p, const glm::vec3 &norm, const glm::vec3 &v, const glm::vec3 &diffuse, const glm::vec3 &specular, float power, TraceContext &ctx);
+    glm::vec3 ambient(const glm::vec3 &diffuse, float percentage);
+    
+    SceneStore store;               // flat copy of the scene's primitives the tracer reads
+    BVH bvh;                        // over store
+    BVH occluders;                  // over store without the lights, for shadow rays
+    TileRenderer tileRenderer;
+    bool bPackets = true;           // trace primary rays in SIMD packets (same image either way)
+
+private:
+    void trace(const Scene &scene, const RenderSettings &settings, FrameBuffer &frame);
+    void tracePass(FrameBuffer &frame, int nSquares, const unsigned char *mask);
+    void findEdges(const FrameBuffer &frame);
+    void intersectPacket(const RayPacket &packet, Hit *hits);
+    glm::vec3 shadeSurface(const Ray &ray, const Hit &hit, const glm::vec3 &weight, int depth, float distance, TraceContext &ctx);
+    void pushRay(const glm::vec3 &p, const glm::vec3 &d, glm::vec3 weight, int depth, float distance, TraceContext &ctx);
+    
+    const Scene *scene = nullptr;
+    RenderSettings settings;
+    RenderCam renderCam;            // copy of the scene's camera for this render
+    int imageWidth = 0;
+    int imageHeight = 0;
+    float pixelSpread = 0;          // a pixel's width at distance 1 from the camera, for texture filtering
+    int frameX = 0;                 // image pixel of the frame buffer's top left
+    int frameY = 0;
+    int refineX0 = 0;               // frame pixels adaptive anti-aliasing may refine,
+    int refineY0 = 0;               // [x0, x1) x [y0, y1) - not the border a region
+    int refineX1 = 0;               // is rendered with for the comparisons
+    int refineY1 = 0;
+    ofPixels regionPixels;          // a region's frame buffer, resolved
+    vector<TraceContext> contexts;  // one per render thread
+    FrameBuffer frame;              // for render() into 8 bit pixels
+    vector<unsigned char> refine;   // pixels adaptive anti-aliasing adds the grid to
+    LightTree lightTree;            // over the scene's lights, when they're sampled
+    int lightsPerPoint = 0;         // for this pass, 0 = every light
+    uint32_t pass = 0;              // accumulate() calls since render(), seeds the samples
+    RenderStats stats;
+};
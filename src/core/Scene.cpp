@@ -0,0 +1,375 @@
+#include "Scene.h"
+#include "SceneFile.h"
+#include "MeshLoader.h"
+#include "Profiler.h"
+
+bool SpotLight::isIlluminated(glm::vec3 lightDirection, int angle) {
+    
+    glm::vec3 spotDirection = glm::normalize(direction);
+    float pointAngle = glm::dot(spotDirection, -lightDirection);
+    if (pointAngle >= glm::radians((float)angle)) return true;
+    return false;
+}
+
+glm::mat4 makeTransform(const glm::vec3 &position, const glm::vec3 &rotation, float scale) {
+    glm::mat4 m = glm::translate(glm::mat4(1.0), position);
+    if (rotation != glm::vec3(0)) {
+        m = glm::rotate(m, glm::radians(rotation.z), glm::vec3(0, 0, 1));
+        m = glm::rotate(m, glm::radians(rotation.y), glm::vec3(0, 1, 0));
+        m = glm::rotate(m, glm::radians(rotation.x), glm::vec3(1, 0, 0));
+    }
+    if (scale != 1) m = glm::scale(m, glm::vec3(scale));
+    return m;
+}
+
+// Intersect Ray with Mesh - the ray is moved into object space, the same
+// way the renderer traces it.  Meshes are shaded from both sides, so the
+// normal is flipped to face the ray.
+//
+bool Mesh::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+    if (!mesh) return false;
+    Instance instance;
+    instance.set(mesh.get(), nullptr, getTransform());
+    float t;
+    if (!instance.intersect(ray, t, normal)) return false;
+    point = ray.p + t * ray.d;
+    return true;
+}
+
+bool Mesh::getBounds(AABB &bounds) {
+    if (!mesh) return false;
+    Instance instance;
+    instance.set(mesh.get(), nullptr, getTransform());
+    return instance.getBounds(bounds);
+}
+
+void Mesh::draw() {
+    if (!mesh) return;
+    if (!vbo) {
+        const MeshArrays &arrays = mesh->getArrays();
+        vbo = make_shared<ofVboMesh>();
+        vbo->addVertices(arrays.vertices, arrays.vertexCount);
+        if (arrays.normals) vbo->addNormals(arrays.normals, arrays.vertexCount);
+        vbo->addIndices(arrays.indices, 3 * arrays.triangleCount);
+    }
+    ofPushMatrix();
+    ofMultMatrix(getTransform());
+    vbo->draw();
+    ofPopMatrix();
+}
+
+// Closest hit on any copy
+//
+bool Instances::intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+    glm::mat4 transform = getTransform();
+    float closest = std::numeric_limits<float>::infinity();
+    for (const glm::mat4 &copy : transforms) {
+        Instance instance;
+        instance.set(mesh.get(), spheres.get(), transform * copy);
+        float t;
+        glm::vec3 n;
+        if (instance.intersect(ray, t, n) && t < closest) {
+            closest = t;
+            normal = n;
+        }
+    }
+    if (closest == std::numeric_limits<float>::infinity()) return false;
+    point = ray.p + closest * ray.d;
+    return true;
+}
+
+bool Instances::getBounds(AABB &bounds) {
+    glm::mat4 transform = getTransform();
+    bounds = AABB();
+    for (const glm::mat4 &copy : transforms) {
+        Instance instance;
+        instance.set(mesh.get(), spheres.get(), transform * copy);
+        AABB b;
+        if (instance.getBounds(b)) bounds.grow(b);
+    }
+    return !bounds.isEmpty();
+}
+
+void Instances::draw() {
+    if (mesh && !vbo) {
+        const MeshArrays &arrays = mesh->getArrays();
+        vbo = make_shared<ofVboMesh>();
+        vbo->addVertices(arrays.vertices, arrays.vertexCount);
+        if (arrays.normals) vbo->addNormals(arrays.normals, arrays.vertexCount);
+        vbo->addIndices(arrays.indices, 3 * arrays.triangleCount);
+    }
+    ofPushMatrix();
+    ofMultMatrix(getTransform());
+    for (const glm::mat4 &copy : transforms) {
+        ofPushMatrix();
+        ofMultMatrix(copy);
+        if (vbo) vbo->draw();
+        else if (spheres) {
+            const SphereSetArrays &arrays = spheres->getArrays();
+            for (int i = 0; i < arrays.count; i++) ofDrawSphere(glm::vec3(arrays.spheres[i]), arrays.spheres[i].w);
+        }
+        ofPopMatrix();
+    }
+    ofPopMatrix();
+}
+
+// Intersect Ray with Plane  (wrapper on glm::intersect*
+//
+bool Plane::intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normalAtIntersect) {
+    float dist;
+    bool hit = glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist);
+    if (hit) {
+        Ray r = ray;
+        point = r.evalPoint(dist);
+        normalAtIntersect = this->normal;
+    }
+    return (hit);
+}
+
+
+// Convert (u, v) to (x, y, z)
+// We assume u,v is in [0, 1]
+//
+glm::vec3 ViewPlane::toWorld(float u, float v) {
+    float w = width();
+    float h = height();
+    return (glm::vec3((u * w) + min.x, (v * h) + min.y, position.z));
+}
+
+// Get a ray from the current camera position to the (u, v) position on
+// the ViewPlane
+//
+Ray RenderCam::getRay(float u, float v) {
+    PROFILE_SCOPE(STAGE_RAY_GENERATION);
+    glm::vec3 pointOnPlane = view.toWorld(u, v);
+    return(Ray(position, glm::normalize(pointOnPlane - position)));
+}
+
+// This could be drawn a lot simpler but I wanted to use the getRay call
+// to test it at the corners.
+//
+void RenderCam::drawFrustum() {
+    view.draw();
+    Ray r1 = getRay(0, 0);
+    Ray r2 = getRay(0, 1);
+    Ray r3 = getRay(1, 1);
+    Ray r4 = getRay(1, 0);
+    float dist = glm::length((view.toWorld(0, 0) - position));
+    r1.draw(dist);
+    r2.draw(dist);
+    r3.draw(dist);
+    r4.draw(dist);
+}
+
+// KEYFRAME ANIMATION
+//
+glm::vec3 linearAnimation(glm::vec3 key1, glm::vec3 key2, int currentFrame, int frameMax) {
+    float changeX = key2.x - key1.x;
+    float changeY = key2.y - key1.y;
+    float changeZ = key2.z - key1.z;
+    return glm::vec3(changeX * ((float)currentFrame/frameMax) + key1.x,
+                     changeY * ((float)currentFrame/frameMax) + key1.y,
+                     changeZ * ((float)currentFrame/frameMax) + key1.z);
+}
+
+glm::vec3 easeInOutAnimation(glm::vec3 key1, glm::vec3 key2, int currentFrame, int frameMax) {
+    float changeX = (key2.x - key1.x) / 2;
+    float changeY = (key2.y - key1.y) / 2;
+    float changeZ = (key2.z - key1.z) / 2;
+    float temp = currentFrame;
+    temp /= frameMax/2;
+    if (temp < 1) {
+        return glm::vec3((float)(changeX * temp * temp + key1.x),
+                         (float)(changeY * temp * temp + key1.y),
+                         (float)(changeZ * temp * temp + key1.z));
+    }
+    temp--;
+    return glm::vec3((float)(-changeX * (temp * (temp - 2) - 1) + key1.x),
+                     (float)(-changeY * (temp * (temp - 2) - 1) + key1.y),
+                     (float)(-changeZ * (temp * (temp - 2) - 1) + key1.z));
+}
+
+void Scene::setupDefault(float lightIntensity, int spotlightAngle) {
+    add<Sphere>(glm::vec3(-1, 0, 0), 2.0, ofColor::blue);
+    add<Sphere>(glm::vec3(1, 0, -4), 2.0, ofColor::lightGreen);
+    add<Sphere>(glm::vec3(0, 0, 2), 1.0, ofColor::red);
+    add<Plane>(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray);
+    add<PointLight>(glm::vec3(4, 6, 4), lightIntensity, ofColor::white);
+    add<PointLight>(glm::vec3(-4, 6, 4), lightIntensity, ofColor::white);
+//    add<SpotLight>(glm::vec3(0, 6, 3), lightIntensity, glm::vec3(0, -1, -.5), spotlightAngle, ofColor::white);
+
+    // RED, BLUE, AND GREEN SPHERES ANIMATED
+    tracks.push_back(AnimationTrack(objects[0], glm::vec3(-8, 0, -8), glm::vec3(-1, 0, 0), true));
+    tracks.push_back(AnimationTrack(objects[1], glm::vec3(8, 0, -8), glm::vec3(1, 0, -4), true));
+    tracks.push_back(AnimationTrack(objects[2], glm::vec3(0, 8, 2), glm::vec3(0, 0, 2), false));
+}
+
+void Scene::setFrame(int frame) {
+    for (AnimationTrack &track : tracks) {
+        track.obj->position = track.evaluate(frame, frameMax);
+    }
+    if (!tracks.empty()) markMoved();
+}
+
+void Scene::clear() {
+    for (SceneObject *obj : objects) pools.at(typeid(*obj))->destroy(obj);
+    objects.clear();
+    lights.clear();
+    handles.clear();
+    tracks.clear();
+    prebuilt.reset();
+    markChanged();
+}
+
+void Scene::adopt(SceneObject *obj) {
+    obj->index = objects.size();
+    obj->handle = handles.add(obj->index);
+    objects.push_back(obj);
+    if (Light *light = dynamic_cast<Light *>(obj)) {
+        light->lightIndex = lights.size();
+        lights.push_back(light);
+    }
+    markChanged();
+}
+
+void Scene::remove(SceneObject *obj) {
+    if (obj->index < 0 || obj->index >= objects.size() || objects[obj->index] != obj) {
+        ofLogError("Scene") << "remove: the object isn't in this scene";
+        return;
+    }
+    if (Light *light = dynamic_cast<Light *>(obj)) {
+        Light *last = lights.back();
+        lights[light->lightIndex] = last;
+        last->lightIndex = light->lightIndex;
+        lights.pop_back();
+    }
+    tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [=](const AnimationTrack &track) { return track.obj == obj; }), tracks.end());
+    
+    SceneObject *last = objects.back();
+    objects[obj->index] = last;
+    last->index = obj->index;
+    handles.set(last->handle, last->index);
+    objects.pop_back();
+    handles.remove(obj->handle);
+    pools.at(typeid(*obj))->destroy(obj);
+    markChanged();
+}
+
+SceneObject * Scene::get(ObjectHandle handle) const {
+    int index = handles.find(handle);
+    return index >= 0 ? objects[index] : nullptr;
+}
+
+// Load into a scratch scene first, so a bad file leaves this one as it was
+//
+bool Scene::load(const string &path) {
+    uint64_t start = ofGetElapsedTimeMicros();
+    string fullPath = ofToDataPath(path, true);
+    shared_ptr<MappedFile> file = make_shared<MappedFile>();
+    if (!file->open(fullPath, false)) {
+        ofLogError("Scene") << "can't open " << path;
+        return false;
+    }
+    Scene loaded;
+    shared_ptr<PrebuiltScene> compiled;
+    string error;
+    bool ok;
+    if (isSceneBinary(file->data(), file->size())) ok = loadSceneBinary(file, loaded, compiled, error);
+    else ok = loadSceneText(file->data(), file->size(), ofFilePath::getEnclosingDirectory(fullPath, false), loaded, error);
+    if (!ok) {
+        ofLogError("Scene") << path << ": " << error;
+        return false;
+    }
+    
+    replaceWith(loaded, compiled);
+    ofLogNotice("Scene") << path << ": " << objects.size() << " objects, " << lights.size() << " lights in "
+                         << (ofGetElapsedTimeMicros() - start) / 1000.0 << " ms";
+    return true;
+}
+
+bool Scene::loadCompiled(shared_ptr<const MappedFile> file) {
+    Scene loaded;
+    shared_ptr<PrebuiltScene> compiled;
+    string error;
+    if (!isSceneBinary(file->data(), file->size())) error = "not a compiled scene";
+    else if (loadSceneBinary(file, loaded, compiled, error)) {
+        replaceWith(loaded, compiled);
+        return true;
+    }
+    ofLogError("Scene") << error;
+    return false;
+}
+
+void Scene::replaceWith(Scene &loaded, shared_ptr<PrebuiltScene> compiled) {
+    clear();
+    pools.swap(loaded.pools);
+    objects.swap(loaded.objects);
+    lights.swap(loaded.lights);
+    tracks.swap(loaded.tracks);
+    
+    // new handles from our table, so none given out before can match them
+    //
+    for (SceneObject *obj : objects) obj->handle = handles.add(obj->index);
+    renderCam = loaded.renderCam;
+    frameMin = loaded.frameMin;
+    frameMax = loaded.frameMax;
+    markChanged();
+    if (compiled) {
+        compiled->layoutVersion = layoutVersion;
+        prebuilt = compiled;
+    }
+}
+
+bool Scene::save(const string &path) const {
+    ofstream out(ofToDataPath(path), std::ios::binary);
+    if (!out) {
+        ofLogError("Scene") << "can't write " << path;
+        return false;
+    }
+    string error;
+    bool ok;
+    if (ofToLower(ofFilePath::getFileExt(path)) == "scene") ok = saveSceneText(*this, out, error);
+    else ok = saveSceneBinary(*this, out, error);
+    out.close();
+    if (ok && out.fail()) error = "write failed";
+    if (!ok || out.fail()) {
+        ofLogError("Scene") << path << ": " << error;
+        return false;
+    }
+    return true;
+}
+
+void Scene::copyTo(Scene &copy) const {
+    copy.clear();
+    
+    // lights and animation tracks point into objects, so remap them to the
+    // copies, which have the same indices.  The lights keep their order.
+    //
+    for (SceneObject *obj : objects) obj->cloneInto(copy);
+    for (Light *light : lights) {
+        Light *c = static_cast<Light *>(copy.objects[light->index]);
+        c->lightIndex = light->lightIndex;
+        copy.lights[c->lightIndex] = c;
+    }
+    for (const AnimationTrack &track : tracks) {
+        AnimationTrack t = track;
+        t.obj = copy.objects[track.obj->index];
+        copy.tracks.push_back(t);
+    }
+    copy.renderCam = renderCam;
+    copy.prebuilt = prebuilt;
+    copy.frameMin = frameMin;
+    copy.frameMax = frameMax;
+    copy.version = version;
+    copy.layoutVersion = layoutVersion;
+}
+
+void Scene::copyPositionsTo(Scene &copy) const {
+    for (int i = 0; i < objects.size(); i++) {
+        copy.objects[i]->position = objects[i]->position;
+        copy.objects[i]->rotation = objects[i]->rotation;
+    }
+    copy.renderCam = renderCam;
+    copy.version = version;
+}
+
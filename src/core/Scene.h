@@ -0,0 +1,435 @@
+#pragma once
+
+#include "ofMain.h"
+#include "BVH.h"
+#include "TriangleMesh.h"
+#include "SphereSet.h"
+#include "ObjectPool.h"
+#include <typeindex>
+
+class MappedFile;
+class Scene;
+
+//  General Purpose Ray class
+//
+class Ray {
+public:
+    Ray(glm::vec3 p, glm::vec3 d) { this->p = p; this->d = d; }
+    void draw(float t) { ofDrawLine(p, p + t * d); }
+    
+    glm::vec3 evalPoint(float t) {
+        return (p + t * d);
+    }
+    
+    glm::vec3 p, d;
+};
+
+//  Object to world transform: scale, rotate (degrees about x, then y, then
+//  z), then move to position
+//
+glm::mat4 makeTransform(const glm::vec3 &position, const glm::vec3 &rotation, float scale = 1);
+
+//  Base class for any renderable object in the scene
+//
+class SceneObject {
+public:
+    virtual ~SceneObject() { }
+    virtual void draw() = 0;    // pure virtual funcs - must be overloaded
+    virtual SceneObject * cloneInto(Scene &scene) const = 0;    // deep copy added to scene, for render snapshots
+    virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { cout << "SceneObject::intersect" << endl; return false; }
+    virtual bool getBounds(AABB &bounds) { return false; }   // false for unbounded objects (infinite planes)
+    
+    // object to world space, makeTransform(position, rotation).  Spheres,
+    // lights and planes only move - a sphere looks the same turned, and a
+    // plane is turned by its normal.
+    //
+    glm::mat4 getTransform() const { return makeTransform(position, rotation); }
+    
+    // any data common to all scene objects goes here
+    glm::vec3 position = glm::vec3(0, 0, 0);   // translate
+    glm::vec3 rotation = glm::vec3(0, 0, 0);   // rotate
+    
+    // material properties (we will ultimately replace this with a Material class - TBD)
+    //
+    ofColor diffuseColor = ofColor::grey;    // default colors - can be changed.
+    ofColor specularColor = ofColor::lightGray;
+    
+    // mirror and glass: the fractions of light reflected and refracted
+    // (the rest is shaded as before), and the most bounces a ray may have
+    // taken before it is reflected or refracted here
+    //
+    float reflectivity = 0;
+    float transparency = 0;
+    float refractiveIndex = 1.5;
+    int maxDepth = 8;
+    
+    // image maps (see TextureCache) that replace the diffuse and specular
+    // colors, empty for none.  Texture coordinates are divided by mapScale:
+    // on a plane, whose coordinates are in world units, it is the size of
+    // one copy of the map; on spheres and meshes 1/n repeats it n times.
+    //
+    string diffuseMap;
+    string specularMap;
+    float mapScale = 1;
+    
+    bool isSelectable = true;
+    bool isLight = false;
+    int index = -1;             // in Scene::objects
+    ObjectHandle handle;        // Scene::get() finds it with this while it exists
+};
+
+class Light: public SceneObject {
+public:
+//    Light(glm::vec3 p, float intensity, ofColor diffuse = ofColor::lightGray) { position = p; diffuseColor = diffuse; this->intensity = intensity; }
+
+    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+        return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
+    }
+    bool getBounds(AABB &bounds) {
+        bounds = AABB(position - glm::vec3(radius), position + glm::vec3(radius));
+        return true;
+    }
+    void draw()
+    {
+        ofDrawSphere(position, radius);
+    }
+    
+    virtual bool isIlluminated(glm::vec3 lightDirection, int angle) = 0;
+    
+    float radius = 0.1;
+    float intensity = 1.0;
+    int lightIndex = -1;        // in Scene::lights
+};
+
+class PointLight: public Light {
+public:
+    PointLight(glm::vec3 p, float intensity, ofColor diffuse = ofColor::lightGray) { position = p; diffuseColor = diffuse; this->intensity = intensity; isLight = true; }
+    PointLight() { }
+    SceneObject * cloneInto(Scene &scene) const;
+    void draw()
+    {
+        ofDrawSphere(position, radius);
+    }
+    bool isIlluminated(glm::vec3 lightDirection, int angle) { return true; }
+};
+
+class SpotLight: public Light {
+public:
+    SpotLight(glm::vec3 p, float intensity, glm::vec3 spotDirection, float angle, ofColor diffuse = ofColor::lightGray) { position = p; diffuseColor = diffuse; direction = spotDirection; this->intensity = intensity; isLight = true; }
+    SceneObject * cloneInto(Scene &scene) const;
+    void draw()
+    {
+        ofSetColor(ofColor::coral);
+        ofDrawSphere(position, radius);
+    }
+    bool isIlluminated(glm::vec3 lightDirection, int angle);
+    
+    glm::vec3 direction;
+    // float exponent;
+
+};
+
+//  General purpose sphere  (assume parametric)
+//
+class Sphere: public SceneObject {
+public:
+    Sphere(glm::vec3 p, float r, ofColor diffuse = ofColor::lightGray) { position = p; radius = r; diffuseColor = diffuse; }
+    Sphere() {}
+    SceneObject * cloneInto(Scene &scene) const;
+    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
+        return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
+    }
+    bool getBounds(AABB &bounds) {
+        bounds = AABB(position - glm::vec3(radius), position + glm::vec3(radius));
+        return true;
+    }
+    void draw()  {
+        ofDrawSphere(position, radius);
+    }
+    
+    float radius = 1.0;
+};
+
+//  Triangle mesh placed by position and rotation.  The geometry is shared
+//  between copies (render snapshots), since it doesn't change once loaded.
+//
+class Mesh : public SceneObject {
+public:
+    Mesh(shared_ptr<TriangleMesh> mesh, glm::vec3 p, ofColor diffuse = ofColor::lightGray) { this->mesh = mesh; position = p; diffuseColor = diffuse; }
+    Mesh() { }
+    SceneObject * cloneInto(Scene &scene) const;
+    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+    bool getBounds(AABB &bounds);
+    void draw();
+    
+    shared_ptr<TriangleMesh> mesh;      // in object space
+
+private:
+    shared_ptr<ofVboMesh> vbo;          // built on first draw
+};
+
+//  Many copies of one triangle mesh or sphere set, each placed by its own
+//  transform (object to world space).  The object's position and rotation
+//  move them all together.  The geometry is traced through the one BVH it
+//  has, from every copy, so a forest of 100k trees costs one tree plus
+//  100k matrices.
+//
+//  The renderer traces each copy as a primitive of its own.  intersect()
+//  here is for picking and tests every copy.
+//
+class Instances : public SceneObject {
+public:
+    Instances(shared_ptr<TriangleMesh> mesh, ofColor diffuse = ofColor::lightGray) { this->mesh = mesh; diffuseColor = diffuse; }
+    Instances(shared_ptr<SphereSet> spheres, ofColor diffuse = ofColor::lightGray) { this->spheres = spheres; diffuseColor = diffuse; }
+    Instances() { }
+    SceneObject * cloneInto(Scene &scene) const;
+    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal);
+    bool getBounds(AABB &bounds);
+    void draw();
+    
+    void add(const glm::mat4 &transform) { transforms.push_back(transform); }
+    
+    shared_ptr<TriangleMesh> mesh;      // one or the other, in object space
+    shared_ptr<SphereSet> spheres;
+    vector<glm::mat4> transforms;       // one per copy
+
+private:
+    shared_ptr<ofVboMesh> vbo;          // built on first draw
+};
+
+
+//  General purpose plane
+//
+class Plane: public SceneObject {
+public:
+    Plane(glm::vec3 p, glm::vec3 n, ofColor diffuse = ofColor::darkOliveGreen, float w = 20, float h = 20 ) {
+        position = p; normal = n;
+        width = w;
+        height = h;
+        diffuseColor = diffuse;
+        plane.rotateDeg(90, 1, 0, 0);
+        isSelectable = false;
+    }
+    Plane() { }
+    SceneObject * cloneInto(Scene &scene) const;
+    glm::vec3 normal = glm::vec3(0, 1, 0);
+    bool intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normal);
+    void draw() {
+        plane.setPosition(position);
+        plane.setWidth(width);
+        plane.setHeight(height);
+        plane.setResolution(4, 4);
+        plane.drawWireframe();
+    }
+    ofPlanePrimitive plane;
+    float width = 20;
+    float height = 20;
+
+};
+
+// view plane for render camera
+//
+class  ViewPlane: public Plane {
+public:
+    ViewPlane(glm::vec2 p0, glm::vec2 p1) { min = p0; max = p1; }
+    
+    ViewPlane() {                         // create reasonable defaults (6x4 aspect)
+        min = glm::vec2(-3, -2);
+        max = glm::vec2(3, 2);
+        position = glm::vec3(0, 0, 5);
+        normal = glm::vec3(0, 0, 1);      // viewplane currently limited to Z axis orientation
+    }
+    
+    SceneObject * cloneInto(Scene &scene) const;
+    void setSize(glm::vec2 min, glm::vec2 max) { this->min = min; this->max = max; }
+    float getAspect() { return width() / height(); }
+    
+    glm::vec3 toWorld(float u, float v);   //   (u, v) --> (x, y, z) [ world space ]
+    
+    void draw() {
+        ofDrawRectangle(glm::vec3(min.x, min.y, position.z), width(), height());
+    }
+    
+    
+    float width() {
+        return (max.x - min.x);
+    }
+    float height() {
+        return (max.y - min.y);
+    }
+    
+    // some convenience methods for returning the corners
+    //
+    glm::vec2 topLeft() { return glm::vec2(min.x, max.y); }
+    glm::vec2 topRight() { return max; }
+    glm::vec2 bottomLeft() { return min;  }
+    glm::vec2 bottomRight() { return glm::vec2(max.x, min.y); }
+    
+    //  To define an infinite plane, we just need a point and normal.
+    //  The ViewPlane is a finite plane so we need to define the boundaries.
+    //  We will define this in terms of min, max  in 2D.
+    //  (in local 2D space of the plane)
+    //  ultimately, will want to locate the ViewPlane with RenderCam anywhere
+    //  in the scene, so it is easier to define the View rectangle in a local'
+    //  coordinate system.
+    //
+    glm::vec2 min, max;
+};
+
+
+//  render camera  - currently must be z axis aligned (we will improve this in project 4)
+//
+class RenderCam: public SceneObject {
+public:
+    RenderCam() {
+        position = glm::vec3(0, 0, 10);
+        aim = glm::vec3(0, 0, -1);
+    }
+    SceneObject * cloneInto(Scene &scene) const;
+    Ray getRay(float u, float v);
+    void draw() { ofDrawBox(position, 1.0); };
+    void drawFrustum();
+    
+    // true if both cameras would generate the same rays
+    //
+    bool sameView(const RenderCam &cam) const {
+        return position == cam.position && aim == cam.aim && view.position == cam.view.position &&
+               view.min == cam.view.min && view.max == cam.view.max;
+    }
+    
+    glm::vec3 aim;
+    ViewPlane view;          // The camera viewplane, this is the view that we will render
+};
+
+
+//  Keyframe interpolation between two keys at currentFrame out of frameMax
+//
+glm::vec3 linearAnimation(glm::vec3 key1, glm::vec3 key2, int currentFrame, int frameMax);
+glm::vec3 easeInOutAnimation(glm::vec3 key1, glm::vec3 key2, int currentFrame, int frameMax);
+
+//  Animates one object's position between two keyframes
+//
+class AnimationTrack {
+public:
+    AnimationTrack(SceneObject *obj, glm::vec3 key1, glm::vec3 key2, bool easeInOut) {
+        this->obj = obj; this->key1 = key1; this->key2 = key2; this->easeInOut = easeInOut;
+    }
+    glm::vec3 evaluate(int frame, int frameMax) {
+        return easeInOut ? easeInOutAnimation(key1, key2, frame, frameMax) : linearAnimation(key1, key2, frame, frameMax);
+    }
+    
+    SceneObject *obj;
+    glm::vec3 key1, key2;
+    bool easeInOut;
+};
+
+//  The scene BVHs compiled into a binary scene file, in the mapped file
+//  they keep open.  Only valid for the scene layout they were loaded with.
+//
+struct PrebuiltScene {
+    shared_ptr<const MappedFile> file;
+    PrebuiltBVH bvh;
+    PrebuiltBVH occluders;          // without the lights (BVH::bSkipLights)
+    unsigned long layoutVersion = 0;
+};
+
+//  The world the renderer traces: objects, lights, the render camera and
+//  the keyframe animation.  Kept free of any GUI/GL state so it can be
+//  rendered headless.
+//
+//  The scene owns its objects: add() creates them in pools, one per type,
+//  and remove() destroys them, both in O(1).  objects (and lights) stay
+//  packed for the renderer to walk - remove() moves the last object into
+//  the hole - so an object's index can change, but its handle always finds
+//  it, until it is removed.
+//
+class Scene {
+public:
+    Scene() { }
+    ~Scene() { clear(); }
+    Scene(const Scene &) = delete;
+    Scene & operator=(const Scene &) = delete;
+    
+    void setupDefault(float lightIntensity, int spotlightAngle);   // the 3 sphere demo scene
+    void setFrame(int frame);     // move animated objects to their position at frame
+    void clear();
+    
+    template <class T, class... Args> T * add(Args &&... args) {
+        T *obj = pool<T>().create(std::forward<Args>(args)...);
+        adopt(obj);
+        return obj;
+    }
+    void remove(SceneObject *obj);      // and any animation track of it
+    SceneObject * get(ObjectHandle handle) const;   // nullptr once it was removed
+    
+    // Replace the scene with the one in a scene file, either the text format
+    // or one compiled by save() (see SceneFile.h).  Relative paths are in
+    // bin/data.  save() writes text if path ends in .scene, otherwise the
+    // compiled form.
+    //
+    bool load(const string &path);
+    bool save(const string &path) const;
+    
+    // The same for a compiled scene already in memory, which the scene keeps
+    // as long as it uses it
+    //
+    bool loadCompiled(shared_ptr<const MappedFile> file);
+    
+    // BVHs that came compiled with the scene, while they still match it
+    //
+    const PrebuiltScene * getPrebuilt() const {
+        return prebuilt && prebuilt->layoutVersion == layoutVersion ? prebuilt.get() : nullptr;
+    }
+    
+    // Snapshots for rendering on another thread: copyTo() deep copies the
+    // whole scene, copyPositionsTo() only refreshes object positions and
+    // rotations in a copy whose objects still line up with ours (same
+    // getLayoutVersion())
+    //
+    void copyTo(Scene &copy) const;
+    void copyPositionsTo(Scene &copy) const;
+    
+    // Anything that edits the scene in a way that changes the image must
+    // call markMoved() (object positions and rotations only) or
+    // markChanged() (anything else, including adding or removing objects or
+    // copies of Instances), so the app knows to render again
+    //
+    void markMoved() { version++; }
+    void markChanged() { version++; layoutVersion++; }
+    unsigned long getVersion() const { return version; }
+    unsigned long getLayoutVersion() const { return layoutVersion; }
+    
+    vector<SceneObject *> objects;
+    vector<Light *> lights;       // lights are also in objects, so they render and can be selected
+    RenderCam renderCam;
+    
+    // KEYFRAME ANIMATION
+    vector<AnimationTrack> tracks;
+    int frameMin = 1;
+    int frameMax = 200;
+
+private:
+    void replaceWith(Scene &loaded, shared_ptr<PrebuiltScene> compiled);
+    void adopt(SceneObject *obj);
+    
+    template <class T> ObjectPool<T, SceneObject> & pool() {
+        unique_ptr<ObjectPoolBase<SceneObject>> &p = pools[std::type_index(typeid(T))];
+        if (!p) p.reset(new ObjectPool<T, SceneObject>());
+        return static_cast<ObjectPool<T, SceneObject> &>(*p);
+    }
+    
+    std::unordered_map<std::type_index, unique_ptr<ObjectPoolBase<SceneObject>>> pools;
+    HandleTable handles;
+    unsigned long version = 0;
+    unsigned long layoutVersion = 0;
+    shared_ptr<const PrebuiltScene> prebuilt;
+};
+
+inline SceneObject * PointLight::cloneInto(Scene &scene) const { return scene.add<PointLight>(*this); }
+inline SceneObject * SpotLight::cloneInto(Scene &scene) const { return scene.add<SpotLight>(*this); }
+inline SceneObject * Sphere::cloneInto(Scene &scene) const { return scene.add<Sphere>(*this); }
+inline SceneObject * Mesh::cloneInto(Scene &scene) const { return scene.add<Mesh>(*this); }
+inline SceneObject * Instances::cloneInto(Scene &scene) const { return scene.add<Instances>(*this); }
+inline SceneObject * Plane::cloneInto(Scene &scene) const { return scene.add<Plane>(*this); }
+inline SceneObject * ViewPlane::cloneInto(Scene &scene) const { return scene.add<ViewPlane>(*this); }
+inline SceneObject * RenderCam::cloneInto(Scene &scene) const { return scene.add<RenderCam>(*this); }
@@ -0,0 +1,915 @@
+#include "SceneFile.h"
+#include "Scene.h"
+#include "SceneStore.h"
+#include "MeshLoader.h"
+
+#include <set>
+
+//--------------------------------------------------------------
+// TEXT
+
+//  One statement: its keyword, the name that follows material, animate,
+//  sphereset and instance, and the values of each property.  The getters
+//  leave the value alone if the property isn't there and set error if it
+//  can't be parsed.
+//
+struct Statement {
+    string keyword;
+    string name;
+    std::map<string, vector<string>> properties;
+    string error;
+    
+    bool has(const string &property) const { return properties.count(property) > 0; }
+    
+    void get(const string &property, float *values, int n) {
+        auto found = properties.find(property);
+        if (found == properties.end()) return;
+        for (int i = 0; i < n; i++) {
+            const char *text = found->second[i].c_str();
+            char *end;
+            float value = strtof(text, &end);
+            if (end == text || *end != 0) {
+                error = "bad number '" + found->second[i] + "' for " + property;
+                return;
+            }
+            values[i] = value;
+        }
+    }
+    void get(const string &property, float &value) { get(property, &value, 1); }
+    void get(const string &property, glm::vec2 &value) { get(property, &value.x, 2); }
+    void get(const string &property, glm::vec3 &value) { get(property, &value.x, 3); }
+    void get(const string &property, int &value) {
+        float f = value;
+        get(property, f);
+        value = f;
+    }
+    void get(const string &property, glm::mat4 &value) {
+        float rows[12];
+        for (int i = 0; i < 12; i++) rows[i] = value[i % 4][i / 4];
+        get(property, rows, 12);
+        for (int i = 0; i < 12; i++) value[i % 4][i / 4] = rows[i];
+    }
+    void get(const string &property, string &value) {
+        if (has(property)) value = properties[property][0];
+    }
+    void get(const string &property, ofColor &color) {
+        glm::vec3 c(color.r, color.g, color.b);
+        get(property, c);
+        c = glm::min(glm::max(c, glm::vec3(0)), glm::vec3(255));
+        color = ofColor(c.x, c.y, c.z);
+    }
+};
+
+// How many values follow each property name, -1 for unknown properties
+//
+static int arity(const string &property) {
+    static const std::map<string, int> arities = {
+        { "name", 1 }, { "material", 1 }, { "file", 1 },
+        { "position", 3 }, { "rotation", 3 }, { "aim", 3 }, { "normal", 3 }, { "direction", 3 },
+        { "from", 3 }, { "to", 3 }, { "diffuse", 3 }, { "specular", 3 },
+        { "radius", 1 }, { "intensity", 1 }, { "width", 1 }, { "height", 1 },
+        { "reflect", 1 }, { "transparent", 1 }, { "ior", 1 }, { "depth", 1 },
+        { "first", 1 }, { "last", 1 }, { "min", 2 }, { "max", 2 },
+        { "linear", 0 }, { "ease", 0 },
+        { "spheres", 1 }, { "scale", 1 }, { "transform", 12 },
+        { "diffusemap", 1 }, { "specularmap", 1 }, { "mapscale", 1 },
+    };
+    auto found = arities.find(property);
+    return found == arities.end() ? -1 : found->second;
+}
+
+// Split a line into a statement, false with error set if it's malformed.
+// Blank and comment lines give an empty keyword.
+//
+static bool parseStatement(const string &line, Statement &statement) {
+    istringstream in(line.substr(0, line.find('#')));
+    if (!(in >> statement.keyword)) return true;
+    static const std::set<string> named = { "material", "animate", "sphereset", "instance" };
+    if (named.count(statement.keyword) && !(in >> statement.name)) {
+        statement.error = statement.keyword + " needs a name";
+        return false;
+    }
+    string property;
+    while (in >> property) {
+        int n = arity(property);
+        if (n < 0) {
+            statement.error = "unknown property '" + property + "'";
+            return false;
+        }
+        vector<string> &values = statement.properties[property];
+        values.resize(n);
+        for (int i = 0; i < n; i++) {
+            if (!(in >> values[i])) {
+                statement.error = property + " needs " + ofToString(n) + " values";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+struct TextMaterial {
+    ofColor diffuse = ofColor::lightGray;
+    ofColor specular = ofColor::lightGray;
+    float reflectivity = 0;
+    float transparency = 0;
+    float refractiveIndex = 1.5;
+    int maxDepth = 8;
+    string diffuseMap;
+    string specularMap;
+    float mapScale = 1;
+    
+    void get(Statement &s, const string &directory) {
+        s.get("diffuse", diffuse);
+        s.get("specular", specular);
+        s.get("reflect", reflectivity);
+        s.get("transparent", transparency);
+        s.get("ior", refractiveIndex);
+        s.get("depth", maxDepth);
+        getMap(s, "diffusemap", directory, diffuseMap);
+        getMap(s, "specularmap", directory, specularMap);
+        s.get("mapscale", mapScale);
+    }
+    
+    // image files are relative to the scene file, like mesh files
+    //
+    static void getMap(Statement &s, const string &property, const string &directory, string &path) {
+        if (!s.has(property)) return;
+        s.get(property, path);
+        if (!ofFilePath::isAbsolute(path)) path = ofFilePath::join(directory, path);
+    }
+};
+
+bool loadSceneText(const char *data, size_t size, const string &directory, Scene &scene, string &error) {
+    std::map<string, TextMaterial> materials;
+    std::map<string, SceneObject *> named;
+    std::map<string, shared_ptr<TriangleMesh>> meshes;     // by file, so copies share geometry
+    std::map<string, shared_ptr<SphereSet>> sphereSets;
+    
+    const char *p = data, *end = data + size;
+    for (int lineNumber = 1; p < end; lineNumber++) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        Statement s;
+        bool parsed = parseStatement(string(p, eol), s);
+        p = eol + 1;
+        if (parsed && s.keyword.empty()) continue;
+        
+        SceneObject *obj = nullptr;
+        const string &k = s.keyword;
+        if (!parsed) {
+            // s.error says why
+        }
+        else if (k == "camera") {
+            s.get("position", scene.renderCam.position);
+            s.get("aim", scene.renderCam.aim);
+        }
+        else if (k == "view") {
+            s.get("position", scene.renderCam.view.position);
+            s.get("min", scene.renderCam.view.min);
+            s.get("max", scene.renderCam.view.max);
+        }
+        else if (k == "frames") {
+            s.get("first", scene.frameMin);
+            s.get("last", scene.frameMax);
+        }
+        else if (k == "material") {
+            materials[s.name].get(s, directory);
+        }
+        else if (k == "sphere") {
+            Sphere *sphere = scene.add<Sphere>(glm::vec3(0), 1.0);
+            s.get("radius", sphere->radius);
+            obj = sphere;
+        }
+        else if (k == "plane") {
+            Plane *plane = scene.add<Plane>(glm::vec3(0), glm::vec3(0, 1, 0));
+            s.get("normal", plane->normal);
+            s.get("width", plane->width);
+            s.get("height", plane->height);
+            obj = plane;
+        }
+        else if (k == "mesh" || (k == "instances" && !s.has("spheres"))) {
+            string file;
+            s.get("file", file);
+            if (file.empty()) {
+                s.error = k == "mesh" ? "mesh needs a file" : "instances needs a file or spheres";
+            }
+            else {
+                if (!ofFilePath::isAbsolute(file)) file = ofFilePath::join(directory, file);
+                shared_ptr<TriangleMesh> &mesh = meshes[file];
+                if (!mesh) {
+                    mesh = make_shared<TriangleMesh>();
+                    if (!mesh->load(file)) s.error = "can't load mesh " + file;
+                }
+                if (s.error.empty() && k == "mesh") obj = scene.add<Mesh>(mesh, glm::vec3(0));
+                else if (s.error.empty()) obj = scene.add<Instances>(mesh);
+            }
+        }
+        else if (k == "instances") {
+            auto found = sphereSets.find(s.properties["spheres"][0]);
+            if (found == sphereSets.end()) s.error = "no sphere set named '" + s.properties["spheres"][0] + "'";
+            else obj = scene.add<Instances>(found->second);
+        }
+        else if (k == "sphereset") {
+            shared_ptr<SphereSet> &set = sphereSets[s.name];
+            if (!set) set = make_shared<SphereSet>();
+            glm::vec3 center(0);
+            float radius = 1;
+            s.get("position", center);
+            s.get("radius", radius);
+            set->add(center, radius);
+        }
+        else if (k == "instance") {
+            auto found = named.find(s.name);
+            Instances *copies = found == named.end() ? nullptr : dynamic_cast<Instances *>(found->second);
+            if (!copies) {
+                s.error = "no instances named '" + s.name + "'";
+            }
+            else {
+                glm::vec3 position(0), rotation(0);
+                float scale = 1;
+                s.get("position", position);
+                s.get("rotation", rotation);
+                s.get("scale", scale);
+                glm::mat4 transform = makeTransform(position, rotation, scale);
+                s.get("transform", transform);
+                copies->add(transform);
+            }
+        }
+        else if (k == "pointlight" || k == "spotlight") {
+            Light *light;
+            if (k == "pointlight") {
+                light = scene.add<PointLight>(glm::vec3(0), 1.0);
+            }
+            else {
+                SpotLight *spot = scene.add<SpotLight>(glm::vec3(0), 1.0, glm::vec3(0, -1, 0), 0);
+                s.get("direction", spot->direction);
+                light = spot;
+            }
+            s.get("intensity", light->intensity);
+            s.get("radius", light->radius);
+            obj = light;
+        }
+        else if (k == "animate") {
+            auto found = named.find(s.name);
+            if (found == named.end()) {
+                s.error = "no object named '" + s.name + "'";
+            }
+            else {
+                glm::vec3 from = found->second->position, to = from;
+                s.get("from", from);
+                s.get("to", to);
+                scene.tracks.push_back(AnimationTrack(found->second, from, to, !s.has("linear")));
+            }
+        }
+        else {
+            s.error = "unknown statement '" + k + "'";
+        }
+        
+        // properties every object has
+        //
+        if (obj) {
+            s.get("position", obj->position);
+            s.get("rotation", obj->rotation);
+            if (s.has("material")) {
+                auto found = materials.find(s.properties["material"][0]);
+                if (found == materials.end()) {
+                    s.error = "no material named '" + s.properties["material"][0] + "'";
+                }
+                else {
+                    obj->diffuseColor = found->second.diffuse;
+                    obj->specularColor = found->second.specular;
+                    obj->reflectivity = found->second.reflectivity;
+                    obj->transparency = found->second.transparency;
+                    obj->refractiveIndex = found->second.refractiveIndex;
+                    obj->maxDepth = found->second.maxDepth;
+                    obj->diffuseMap = found->second.diffuseMap;
+                    obj->specularMap = found->second.specularMap;
+                    obj->mapScale = found->second.mapScale;
+                }
+            }
+            s.get("diffuse", obj->diffuseColor);
+            s.get("specular", obj->specularColor);
+            s.get("reflect", obj->reflectivity);
+            s.get("transparent", obj->transparency);
+            s.get("ior", obj->refractiveIndex);
+            s.get("depth", obj->maxDepth);
+            TextMaterial::getMap(s, "diffusemap", directory, obj->diffuseMap);
+            TextMaterial::getMap(s, "specularmap", directory, obj->specularMap);
+            s.get("mapscale", obj->mapScale);
+            if (s.has("name")) named[s.properties["name"][0]] = obj;
+        }
+        if (!s.error.empty()) {
+            error = "line " + ofToString(lineNumber) + ": " + s.error;
+            return false;
+        }
+    }
+    for (auto &set : sphereSets) set.second->build();
+    return true;
+}
+
+// Shortest text that reads back as exactly the same float
+//
+static string toText(float value) {
+    ostringstream out;
+    out.precision(6);
+    out << value;
+    if (strtof(out.str().c_str(), nullptr) == value) return out.str();
+    out.str("");
+    out.precision(9);
+    out << value;
+    return out.str();
+}
+
+static string toText(const glm::vec3 &v) { return toText(v.x) + " " + toText(v.y) + " " + toText(v.z); }
+static string toText(const glm::vec2 &v) { return toText(v.x) + " " + toText(v.y); }
+static string toText(const ofColor &c) { return ofToString((int)c.r) + " " + ofToString((int)c.g) + " " + ofToString((int)c.b); }
+
+bool saveSceneText(const Scene &scene, ostream &out, string &error) {
+    const RenderCam &cam = scene.renderCam;
+    out << "camera position " << toText(cam.position) << " aim " << toText(cam.aim) << endl;
+    out << "view position " << toText(cam.view.position) << " min " << toText(cam.view.min) << " max " << toText(cam.view.max) << endl;
+    out << "frames first " << scene.frameMin << " last " << scene.frameMax << endl;
+    
+    // animated objects need names for their tracks
+    //
+    std::set<const SceneObject *> animated;
+    for (const AnimationTrack &track : scene.tracks) animated.insert(track.obj);
+    
+    // sphere sets first, each once, for the instances that use them
+    //
+    std::map<const SphereSet *, int> sphereSets;
+    for (SceneObject *obj : scene.objects) {
+        Instances *copies = dynamic_cast<Instances *>(obj);
+        if (!copies || !copies->spheres || !sphereSets.emplace(copies->spheres.get(), sphereSets.size()).second) continue;
+        const SphereSetArrays &a = copies->spheres->getArrays();
+        for (int i = 0; i < a.count; i++) {
+            out << "sphereset set" << sphereSets[copies->spheres.get()] << " position " << toText(glm::vec3(a.spheres[i])) << " radius " << toText(a.spheres[i].w) << endl;
+        }
+    }
+    
+    for (int i = 0; i < scene.objects.size(); i++) {
+        SceneObject *obj = scene.objects[i];
+        string keyword;
+        ostringstream properties;
+        if (Sphere *sphere = dynamic_cast<Sphere *>(obj)) {
+            keyword = "sphere";
+            properties << " radius " << toText(sphere->radius);
+        }
+        else if (Plane *plane = dynamic_cast<Plane *>(obj)) {
+            keyword = "plane";
+            properties << " normal " << toText(plane->normal) << " width " << toText(plane->width) << " height " << toText(plane->height);
+        }
+        else if (Mesh *mesh = dynamic_cast<Mesh *>(obj)) {
+            if (!mesh->mesh || mesh->mesh->path.empty()) {
+                error = "object " + ofToString(i) + " is a mesh that wasn't loaded from a file";
+                return false;
+            }
+            keyword = "mesh";
+            properties << " file " << mesh->mesh->path;
+        }
+        else if (Instances *copies = dynamic_cast<Instances *>(obj)) {
+            keyword = "instances";
+            if (copies->spheres) properties << " spheres set" << sphereSets[copies->spheres.get()];
+            else if (copies->mesh && !copies->mesh->path.empty()) properties << " file " << copies->mesh->path;
+            else {
+                error = "object " + ofToString(i) + " is instances of a mesh that wasn't loaded from a file";
+                return false;
+            }
+        }
+        else if (SpotLight *spot = dynamic_cast<SpotLight *>(obj)) {
+            keyword = "spotlight";
+            properties << " direction " << toText(spot->direction) << " intensity " << toText(spot->intensity) << " radius " << toText(spot->radius);
+        }
+        else if (PointLight *light = dynamic_cast<PointLight *>(obj)) {
+            keyword = "pointlight";
+            properties << " intensity " << toText(light->intensity) << " radius " << toText(light->radius);
+        }
+        else {
+            error = "object " + ofToString(i) + " has a type scene files can't describe";
+            return false;
+        }
+        Instances *copies = dynamic_cast<Instances *>(obj);
+        out << keyword;
+        if (animated.count(obj) || copies) out << " name object" << i;
+        out << " position " << toText(obj->position) << properties.str();
+        if (obj->rotation != glm::vec3(0)) out << " rotation " << toText(obj->rotation);
+        out << " diffuse " << toText(obj->diffuseColor) << " specular " << toText(obj->specularColor);
+        if (obj->reflectivity != 0 || obj->transparency != 0) {
+            out << " reflect " << toText(obj->reflectivity) << " transparent " << toText(obj->transparency)
+                << " ior " << toText(obj->refractiveIndex) << " depth " << obj->maxDepth;
+        }
+        if (!obj->diffuseMap.empty()) out << " diffusemap " << obj->diffuseMap;
+        if (!obj->specularMap.empty()) out << " specularmap " << obj->specularMap;
+        if (obj->mapScale != 1) out << " mapscale " << toText(obj->mapScale);
+        out << endl;
+        
+        // the copies, as the top 3 rows of their matrices
+        //
+        for (int c = 0; copies && c < copies->transforms.size(); c++) {
+            const glm::mat4 &m = copies->transforms[c];
+            out << "instance object" << i << " transform";
+            for (int k = 0; k < 12; k++) out << " " << toText(m[k % 4][k / 4]);
+            out << endl;
+        }
+    }
+    
+    for (const AnimationTrack &track : scene.tracks) {
+        int i = std::find(scene.objects.begin(), scene.objects.end(), track.obj) - scene.objects.begin();
+        out << "animate object" << i << " from " << toText(track.key1) << " to " << toText(track.key2) << (track.easeInOut ? " ease" : " linear") << endl;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------
+// COMPILED
+//
+//  Every array is a Section of the file.  Records are plain structs of
+//  fixed size types, written and read as they are in memory.
+
+static const char magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+static const uint32_t formatVersion = 4;
+static const uint32_t byteOrderMark = 0x01020304;
+static const uint64_t alignment = 64;
+
+struct Section {
+    uint64_t offset = 0;        // bytes from the start of the file
+    uint64_t count = 0;         // elements
+};
+
+struct BVHSections {
+    Section nodes, prims, unbounded;
+};
+
+struct SceneHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeSize;          // sizeof(BVHNode), in case its layout changes
+    int32_t frameMin, frameMax;
+    float cameraPosition[3], cameraAim[3];
+    float viewPosition[3], viewMin[2], viewMax[2];
+    Section objects, lights, tracks, meshes, sphereSets;
+    BVHSections bvh, occluders;
+    uint64_t fileSize;
+};
+
+enum ObjectType : uint32_t { OBJECT_SPHERE, OBJECT_PLANE, OBJECT_MESH, OBJECT_POINT_LIGHT, OBJECT_SPOT_LIGHT, OBJECT_INSTANCES };
+
+struct ObjectRecord {
+    uint32_t type;
+    int32_t mesh;               // index of its MeshRecord, -1 if it has no mesh
+    int32_t sphereSet;          // index of its SphereSetRecord, -1 if it has none
+    Section copies;             // glm::mat4s, the transforms of instances
+    float position[3];
+    float rotation[3];
+    float axis[3];              // plane normal, spotlight direction
+    float radius;               // spheres and lights
+    float intensity;
+    float width, height;        // planes
+    uint8_t diffuse[4];
+    uint8_t specular[4];
+    float reflectivity, transparency, refractiveIndex;
+    int32_t maxDepth;
+    uint32_t selectable;
+    Section diffuseMap;         // chars, image paths, empty for none
+    Section specularMap;
+    float mapScale;
+};
+
+struct TrackRecord {
+    int32_t object;
+    int32_t easeInOut;
+    float key1[3], key2[3];
+};
+
+struct MeshRecord {
+    Section path;               // chars, the file it was loaded from
+    Section vertices, normals, indices;
+    Section texcoords;          // glm::vec2s, none or one per vertex
+    Section nodes, order, triangles;
+    float boundsMin[3], boundsMax[3];
+};
+
+struct SphereSetRecord {
+    Section spheres, nodes;
+    float boundsMin[3], boundsMax[3];
+};
+
+static void put(float *to, const glm::vec3 &v) { to[0] = v.x; to[1] = v.y; to[2] = v.z; }
+static void put(float *to, const glm::vec2 &v) { to[0] = v.x; to[1] = v.y; }
+static void put(uint8_t *to, const ofColor &c) { to[0] = c.r; to[1] = c.g; to[2] = c.b; to[3] = c.a; }
+static glm::vec3 vec3(const float *v) { return glm::vec3(v[0], v[1], v[2]); }
+static glm::vec2 vec2(const float *v) { return glm::vec2(v[0], v[1]); }
+static ofColor color(const uint8_t *c) { return ofColor(c[0], c[1], c[2], c[3]); }
+
+//  Appends aligned arrays to the file, tracking the offset
+//
+class SectionWriter {
+public:
+    SectionWriter(ostream &out) : out(out) { }
+    
+    template <class T> Section write(const T *data, size_t count) {
+        pad();
+        Section section;
+        section.offset = offset;
+        section.count = count;
+        if (count > 0) out.write((const char *)data, count * sizeof(T));
+        offset += count * sizeof(T);
+        return section;
+    }
+    template <class T> Section write(const vector<T> &data) { return write(data.data(), data.size()); }
+    void pad() {
+        static const char zeros[alignment] = { 0 };
+        uint64_t padding = (alignment - offset % alignment) % alignment;
+        out.write(zeros, padding);
+        offset += padding;
+    }
+    
+    ostream &out;
+    uint64_t offset = 0;
+};
+
+static BVHSections writeBVH(SectionWriter &writer, const BVH &bvh) {
+    PrebuiltBVH prebuilt = bvh.getPrebuilt();
+    BVHSections sections;
+    sections.nodes = writer.write(prebuilt.nodes, prebuilt.nodeCount);
+    sections.prims = writer.write(prebuilt.prims, prebuilt.primCount);
+    sections.unbounded = writer.write(prebuilt.unbounded, prebuilt.unboundedCount);
+    return sections;
+}
+
+bool saveSceneBinary(const Scene &scene, ostream &out, string &error) {
+    SceneHeader header = SceneHeader();
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = formatVersion;
+    header.byteOrder = byteOrderMark;
+    header.nodeSize = sizeof(BVHNode);
+    header.frameMin = scene.frameMin;
+    header.frameMax = scene.frameMax;
+    put(header.cameraPosition, scene.renderCam.position);
+    put(header.cameraAim, scene.renderCam.aim);
+    put(header.viewPosition, scene.renderCam.view.position);
+    put(header.viewMin, scene.renderCam.view.min);
+    put(header.viewMax, scene.renderCam.view.max);
+    
+    // objects, with each distinct mesh and sphere set written once.  The
+    // copies of instances are written after the header, when their sections
+    // are known.
+    //
+    vector<ObjectRecord> objects(scene.objects.size());
+    vector<const TriangleMesh *> meshes;
+    std::map<const TriangleMesh *, int> meshIndex;
+    vector<const SphereSet *> sphereSets;
+    std::map<const SphereSet *, int> sphereSetIndex;
+    for (int i = 0; i < scene.objects.size(); i++) {
+        SceneObject *obj = scene.objects[i];
+        ObjectRecord &r = objects[i];
+        r = ObjectRecord();
+        r.mesh = -1;
+        r.sphereSet = -1;
+        if (Sphere *sphere = dynamic_cast<Sphere *>(obj)) {
+            r.type = OBJECT_SPHERE;
+            r.radius = sphere->radius;
+        }
+        else if (Plane *plane = dynamic_cast<Plane *>(obj)) {
+            r.type = OBJECT_PLANE;
+            put(r.axis, plane->normal);
+            r.width = plane->width;
+            r.height = plane->height;
+        }
+        else if (Mesh *mesh = dynamic_cast<Mesh *>(obj)) {
+            if (!mesh->mesh) {
+                error = "object " + ofToString(i) + " is a mesh without geometry";
+                return false;
+            }
+            auto inserted = meshIndex.emplace(mesh->mesh.get(), meshes.size());
+            if (inserted.second) meshes.push_back(mesh->mesh.get());
+            r.type = OBJECT_MESH;
+            r.mesh = inserted.first->second;
+        }
+        else if (Instances *copies = dynamic_cast<Instances *>(obj)) {
+            if (copies->mesh) {
+                auto inserted = meshIndex.emplace(copies->mesh.get(), meshes.size());
+                if (inserted.second) meshes.push_back(copies->mesh.get());
+                r.mesh = inserted.first->second;
+            }
+            else if (copies->spheres) {
+                auto inserted = sphereSetIndex.emplace(copies->spheres.get(), sphereSets.size());
+                if (inserted.second) sphereSets.push_back(copies->spheres.get());
+                r.sphereSet = inserted.first->second;
+            }
+            else {
+                error = "object " + ofToString(i) + " is instances without geometry";
+                return false;
+            }
+            r.type = OBJECT_INSTANCES;
+        }
+        else if (Light *light = dynamic_cast<Light *>(obj)) {
+            SpotLight *spot = dynamic_cast<SpotLight *>(obj);
+            r.type = spot ? OBJECT_SPOT_LIGHT : OBJECT_POINT_LIGHT;
+            if (spot) put(r.axis, spot->direction);
+            r.radius = light->radius;
+            r.intensity = light->intensity;
+        }
+        else {
+            error = "object " + ofToString(i) + " has a type scene files can't describe";
+            return false;
+        }
+        put(r.position, obj->position);
+        put(r.rotation, obj->rotation);
+        put(r.diffuse, obj->diffuseColor);
+        put(r.specular, obj->specularColor);
+        r.reflectivity = obj->reflectivity;
+        r.transparency = obj->transparency;
+        r.refractiveIndex = obj->refractiveIndex;
+        r.maxDepth = obj->maxDepth;
+        r.selectable = obj->isSelectable;
+        r.mapScale = obj->mapScale;
+    }
+    
+    std::unordered_map<const SceneObject *, int> objectIndex;
+    for (int i = 0; i < scene.objects.size(); i++) objectIndex[scene.objects[i]] = i;
+    vector<int32_t> lights;
+    for (Light *light : scene.lights) lights.push_back(objectIndex.at(light));
+    vector<TrackRecord> tracks;
+    for (const AnimationTrack &track : scene.tracks) {
+        TrackRecord r;
+        r.object = objectIndex.at(track.obj);
+        r.easeInOut = track.easeInOut;
+        put(r.key1, track.key1);
+        put(r.key2, track.key2);
+        tracks.push_back(r);
+    }
+    
+    // the scene BVHs, built over the same store the renderer will sync
+    // from these objects
+    //
+    SceneStore store;
+    store.sync(scene.objects);
+    BVH bvh, occluders;
+    occluders.bSkipLights = true;
+    bvh.build(store);
+    occluders.build(store);
+    
+    SectionWriter writer(out);
+    out.write((const char *)&header, sizeof(header));       // placeholder until the sections are known
+    writer.offset = sizeof(header);
+    for (int i = 0; i < scene.objects.size(); i++) {
+        if (objects[i].type == OBJECT_INSTANCES) objects[i].copies = writer.write(static_cast<Instances *>(scene.objects[i])->transforms);
+        objects[i].diffuseMap = writer.write(scene.objects[i]->diffuseMap.data(), scene.objects[i]->diffuseMap.size());
+        objects[i].specularMap = writer.write(scene.objects[i]->specularMap.data(), scene.objects[i]->specularMap.size());
+    }
+    header.objects = writer.write(objects);
+    header.lights = writer.write(lights);
+    header.tracks = writer.write(tracks);
+    
+    vector<MeshRecord> meshRecords(meshes.size());
+    for (int m = 0; m < meshes.size(); m++) {
+        const MeshArrays &a = meshes[m]->getArrays();
+        MeshRecord &r = meshRecords[m];
+        r.path = writer.write(meshes[m]->path.data(), meshes[m]->path.size());
+        r.vertices = writer.write(a.vertices, a.vertexCount);
+        r.normals = writer.write(a.normals, a.normals ? a.vertexCount : 0);
+        r.texcoords = writer.write(a.texcoords, a.texcoords ? a.vertexCount : 0);
+        r.indices = writer.write(a.indices, 3 * (size_t)a.triangleCount);
+        r.nodes = writer.write(a.nodes, a.nodeCount);
+        r.order = writer.write(a.order, a.triangleCount);
+        r.triangles = writer.write(a.triangles, a.triangleCount > 0 ? TriangleArrays::blockSize(a.triangleCount) : 0);
+        put(r.boundsMin, a.bounds.min);
+        put(r.boundsMax, a.bounds.max);
+    }
+    header.meshes = writer.write(meshRecords);
+    
+    vector<SphereSetRecord> sphereSetRecords(sphereSets.size());
+    for (int m = 0; m < sphereSets.size(); m++) {
+        const SphereSetArrays &a = sphereSets[m]->getArrays();
+        SphereSetRecord &r = sphereSetRecords[m];
+        r.spheres = writer.write(a.spheres, a.count);
+        r.nodes = writer.write(a.nodes, a.nodeCount);
+        put(r.boundsMin, a.bounds.min);
+        put(r.boundsMax, a.bounds.max);
+    }
+    header.sphereSets = writer.write(sphereSetRecords);
+    header.bvh = writeBVH(writer, bvh);
+    header.occluders = writeBVH(writer, occluders);
+    writer.pad();
+    header.fileSize = writer.offset;
+    
+    out.seekp(0);
+    out.write((const char *)&header, sizeof(header));
+    if (!out) {
+        error = "write failed";
+        return false;
+    }
+    return true;
+}
+
+bool isSceneBinary(const char *data, size_t size) {
+    return size >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+// Point p at a section of the file, false if it isn't entirely inside it
+//
+template <class T> static bool view(const MappedFile &file, const Section &section, const T *&p) {
+    p = nullptr;
+    if (section.count == 0) return true;
+    if (section.offset % alignment != 0 || section.offset > file.size()) return false;
+    if (section.count > (file.size() - section.offset) / sizeof(T)) return false;
+    p = (const T *)(file.data() + section.offset);
+    return true;
+}
+
+static bool viewBVH(const MappedFile &file, const BVHSections &sections, PrebuiltBVH &bvh) {
+    bvh.nodeCount = sections.nodes.count;
+    bvh.primCount = sections.prims.count;
+    bvh.unboundedCount = sections.unbounded.count;
+    return view(file, sections.nodes, bvh.nodes) && view(file, sections.prims, bvh.prims) && view(file, sections.unbounded, bvh.unbounded);
+}
+
+// Checks the header and that every array is inside the file and sized
+// consistently, but not the arrays' contents: that would mean reading the
+// whole file, which loading in place is there to avoid.
+//
+bool loadSceneBinary(shared_ptr<const MappedFile> file, Scene &scene, shared_ptr<PrebuiltScene> &prebuilt, string &error) {
+    SceneHeader header;
+    if (file->size() < sizeof(header) || !isSceneBinary(file->data(), file->size())) {
+        error = "not a compiled scene";
+        return false;
+    }
+    memcpy(&header, file->data(), sizeof(header));
+    if (header.version != formatVersion || header.byteOrder != byteOrderMark || header.nodeSize != sizeof(BVHNode)) {
+        error = "compiled by a different version or on a different platform - compile it again from the text scene";
+        return false;
+    }
+    if (header.fileSize != file->size()) {
+        error = "truncated";
+        return false;
+    }
+    
+    const ObjectRecord *objects;
+    const int32_t *lights;
+    const TrackRecord *tracks;
+    const MeshRecord *meshRecords;
+    const SphereSetRecord *sphereSetRecords;
+    if (!view(*file, header.objects, objects) || !view(*file, header.lights, lights) ||
+        !view(*file, header.tracks, tracks) || !view(*file, header.meshes, meshRecords) ||
+        !view(*file, header.sphereSets, sphereSetRecords)) {
+        error = "corrupt section table";
+        return false;
+    }
+    
+    vector<shared_ptr<TriangleMesh>> meshes;
+    for (int m = 0; m < header.meshes.count; m++) {
+        const MeshRecord &r = meshRecords[m];
+        MeshArrays a;
+        const char *path;
+        bool ok = view(*file, r.path, path) && view(*file, r.vertices, a.vertices) && view(*file, r.normals, a.normals) &&
+                  view(*file, r.texcoords, a.texcoords) && view(*file, r.indices, a.indices) && view(*file, r.nodes, a.nodes) && view(*file, r.order, a.order) &&
+                  view(*file, r.triangles, a.triangles);
+        a.vertexCount = r.vertices.count;
+        a.triangleCount = r.indices.count / 3;
+        a.nodeCount = r.nodes.count;
+        a.bounds = AABB(vec3(r.boundsMin), vec3(r.boundsMax));
+        ok = ok && r.indices.count % 3 == 0 && (r.normals.count == 0 || r.normals.count == r.vertices.count) &&
+             (r.texcoords.count == 0 || r.texcoords.count == r.vertices.count) &&
+             r.order.count == a.triangleCount && (a.triangleCount == 0 || r.triangles.count == TriangleArrays::blockSize(a.triangleCount)) &&
+             (a.nodeCount > 0) == (a.triangleCount > 0);
+        if (!ok) {
+            error = "corrupt mesh " + ofToString(m);
+            return false;
+        }
+        meshes.push_back(make_shared<TriangleMesh>());
+        meshes.back()->attach(file, a);
+        meshes.back()->path = string(path ? path : "", r.path.count);
+    }
+    
+    vector<shared_ptr<SphereSet>> sphereSets;
+    for (int m = 0; m < header.sphereSets.count; m++) {
+        const SphereSetRecord &r = sphereSetRecords[m];
+        SphereSetArrays a;
+        bool ok = view(*file, r.spheres, a.spheres) && view(*file, r.nodes, a.nodes);
+        a.count = r.spheres.count;
+        a.nodeCount = r.nodes.count;
+        a.bounds = AABB(vec3(r.boundsMin), vec3(r.boundsMax));
+        if (!ok || (a.nodeCount > 0) != (a.count > 0)) {
+            error = "corrupt sphere set " + ofToString(m);
+            return false;
+        }
+        sphereSets.push_back(make_shared<SphereSet>());
+        sphereSets.back()->attach(file, a);
+    }
+    
+    for (int i = 0; i < header.objects.count; i++) {
+        const ObjectRecord &r = objects[i];
+        glm::vec3 position = vec3(r.position);
+        SceneObject *obj;
+        switch (r.type) {
+            case OBJECT_SPHERE:
+                obj = scene.add<Sphere>(position, r.radius);
+                break;
+            case OBJECT_PLANE: {
+                Plane *plane = scene.add<Plane>(position, vec3(r.axis));
+                plane->width = r.width;
+                plane->height = r.height;
+                obj = plane;
+                break;
+            }
+            case OBJECT_MESH:
+                if (r.mesh < 0 || r.mesh >= meshes.size()) {
+                    error = "object " + ofToString(i) + " has no mesh";
+                    return false;
+                }
+                obj = scene.add<Mesh>(meshes[r.mesh], position);
+                break;
+            case OBJECT_INSTANCES: {
+                const glm::mat4 *copies;
+                Instances *instances;
+                if (r.mesh >= 0 && r.mesh < meshes.size()) instances = scene.add<Instances>(meshes[r.mesh]);
+                else if (r.sphereSet >= 0 && r.sphereSet < sphereSets.size()) instances = scene.add<Instances>(sphereSets[r.sphereSet]);
+                else {
+                    error = "object " + ofToString(i) + " has no geometry";
+                    return false;
+                }
+                if (!view(*file, r.copies, copies)) {
+                    error = "object " + ofToString(i) + " has corrupt copies";
+                    return false;
+                }
+                instances->transforms.assign(copies, copies + r.copies.count);
+                instances->position = position;
+                obj = instances;
+                break;
+            }
+            case OBJECT_POINT_LIGHT:
+            case OBJECT_SPOT_LIGHT: {
+                Light *light;
+                if (r.type == OBJECT_POINT_LIGHT) light = scene.add<PointLight>(position, r.intensity);
+                else light = scene.add<SpotLight>(position, r.intensity, vec3(r.axis), 0);
+                light->radius = r.radius;
+                obj = light;
+                break;
+            }
+            default:
+                error = "object " + ofToString(i) + " has an unknown type";
+                return false;
+        }
+        obj->rotation = vec3(r.rotation);
+        obj->diffuseColor = color(r.diffuse);
+        obj->specularColor = color(r.specular);
+        obj->reflectivity = r.reflectivity;
+        obj->transparency = r.transparency;
+        obj->refractiveIndex = r.refractiveIndex;
+        obj->maxDepth = r.maxDepth;
+        obj->isSelectable = r.selectable;
+        const char *diffuseMap, *specularMap;
+        if (!view(*file, r.diffuseMap, diffuseMap) || !view(*file, r.specularMap, specularMap)) {
+            error = "object " + ofToString(i) + " has corrupt texture paths";
+            return false;
+        }
+        obj->diffuseMap = string(diffuseMap ? diffuseMap : "", r.diffuseMap.count);
+        obj->specularMap = string(specularMap ? specularMap : "", r.specularMap.count);
+        obj->mapScale = r.mapScale;
+    }
+    
+    // the lights in the order they were saved, which is the order they're
+    // sampled in
+    //
+    if (header.lights.count != scene.lights.size()) {
+        error = "the light list doesn't match the lights";
+        return false;
+    }
+    for (Light *light : scene.lights) light->lightIndex = -1;
+    for (int i = 0; i < header.lights.count; i++) {
+        Light *light = lights[i] >= 0 && lights[i] < scene.objects.size() ? dynamic_cast<Light *>(scene.objects[lights[i]]) : nullptr;
+        if (!light || light->lightIndex >= 0) {
+            error = "light " + ofToString(i) + " isn't a light";
+            return false;
+        }
+        light->lightIndex = i;
+        scene.lights[i] = light;
+    }
+    for (int i = 0; i < header.tracks.count; i++) {
+        const TrackRecord &r = tracks[i];
+        if (r.object < 0 || r.object >= scene.objects.size()) {
+            error = "track " + ofToString(i) + " has no object";
+            return false;
+        }
+        scene.tracks.push_back(AnimationTrack(scene.objects[r.object], vec3(r.key1), vec3(r.key2), r.easeInOut));
+    }
+    
+    scene.frameMin = header.frameMin;
+    scene.frameMax = header.frameMax;
+    scene.renderCam.position = vec3(header.cameraPosition);
+    scene.renderCam.aim = vec3(header.cameraAim);
+    scene.renderCam.view.position = vec3(header.viewPosition);
+    scene.renderCam.view.min = vec2(header.viewMin);
+    scene.renderCam.view.max = vec2(header.viewMax);
+    
+    prebuilt = make_shared<PrebuiltScene>();
+    prebuilt->file = file;
+    if (!viewBVH(*file, header.bvh, prebuilt->bvh) || !viewBVH(*file, header.occluders, prebuilt->occluders)) {
+        error = "corrupt scene BVH";
+        return false;
+    }
+    return true;
+}
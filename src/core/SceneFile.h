@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofMain.h"
+
+class Scene;
+class MappedFile;
+struct PrebuiltScene;
+
+//  Scene files
+//
+//  The text format (.scene) has one statement per line: a keyword, then
+//  property names each followed by their values.  Colors are 0..255, #
+//  starts a comment, and anything left out keeps the default the app uses.
+//
+//    camera position 0 0 10 aim 0 0 -1
+//    view position 0 0 5 min -3 -2 max 3 2
+//    frames first 1 last 200
+//    material red diffuse 255 0 0 specular 211 211 211
+//    material glass diffuse 0 0 0 transparent 0.9 ior 1.5 depth 6
+//    material wood diffusemap wood.png specularmap wood-spec.png mapscale 2
+//    sphere name ball position 0 0 2 radius 1 material red
+//    plane position 0 -2 0 normal 0 1 0 diffuse 128 128 128
+//    mesh name bunny file bunny.ply position 0 -2 0 diffuse 135 206 250
+//    instances name forest file tree.ply material bark
+//    instance forest position 3 0 -2 rotation 0 45 0 scale 1.5
+//    sphereset pebbles position 0 0 0 radius 0.2
+//    instances name pile spheres pebbles position 0 -2 0
+//    instance pile transform 1 0 0 2  0 1 0 0  0 0 1 -1
+//    pointlight position 4 6 4 intensity 0.8 diffuse 255 255 255
+//    spotlight position 0 6 3 direction 0 -1 -0.5 intensity 0.8
+//    animate ball from 0 8 2 to 0 0 2 linear
+//
+//  Objects also take rotation (which turns meshes and instances), width
+//  and height (planes) and radius (lights).  Objects and materials take
+//  reflect and transparent (the fractions of light mirrored and refracted,
+//  0..1), ior (index of refraction) and depth (the most bounces a ray may
+//  have taken before it is reflected or refracted there), and diffusemap
+//  and specularmap (images that replace the colors, see TextureCache) and
+//  mapscale (what texture coordinates are divided by).  animate moves the
+//  named object between two keys over the frames, linear or ease (in and
+//  out, the default).  Mesh and image files are relative to the scene
+//  file.
+//
+//  instances is one object made of many copies of a mesh file, or of a
+//  sphere set (built up one sphere per sphereset line), that share its
+//  geometry.  Each instance line adds a copy of the named instances,
+//  placed by position, rotation and scale, or by the top 3 rows of its
+//  transform matrix - relative to the instances object's own position and
+//  rotation, which move every copy.
+//
+//  The compiled form (anything else) is what the text compiles to, laid out
+//  to be used in place: a header, then every array 64 byte aligned - the
+//  objects (with their image paths) and the transforms of their copies,
+//  the meshes' vertex, texture coordinate and index buffers with their
+//  triangle BVHs and leaf order triangle arrays, the sphere sets and their
+//  BVHs, and the scene BVHs.  Loading maps the
+//  file, creates the objects, and points the meshes and the renderer at the
+//  mapped arrays, so nothing is parsed or built and only the pages rays
+//  actually touch are ever read.  The file is specific to the byte order
+//  and the version that wrote it; anything else is rejected with a message
+//  to recompile.
+//
+//  The loaders fill an empty scene and return false with a message in
+//  error on failure.
+//
+bool loadSceneText(const char *data, size_t size, const string &directory, Scene &scene, string &error);
+bool loadSceneBinary(shared_ptr<const MappedFile> file, Scene &scene, shared_ptr<PrebuiltScene> &prebuilt, string &error);
+bool isSceneBinary(const char *data, size_t size);
+
+bool saveSceneText(const Scene &scene, ostream &out, string &error);
+bool saveSceneBinary(const Scene &scene, ostream &out, string &error);
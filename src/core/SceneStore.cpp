@@ -0,0 +1,310 @@
+#include "SceneStore.h"
+#include "Scene.h"
+#include "SphereSet.h"
+#include "TextureCache.h"
+
+// layouts are numbered globally so a BVH can't mistake a different store
+// (or a store that was cleared and refilled) for the one it was built over
+//
+static std::atomic<unsigned long> nextLayout(1);
+
+void SceneStore::sync(const vector<SceneObject *> &objects) {
+    bool same = objects == source && layout != 0;
+    for (int i = 0; same && i < objects.size(); i++) {
+        same = objects[i]->handle == sourceHandles[i] &&
+               (kinds[i] != KIND_INSTANCES || static_cast<Instances *>(objects[i])->transforms.size() == primCount[i]);
+    }
+    if (!same) {
+        rebuild(objects);
+        return;
+    }
+    for (int i = 0; i < source.size(); i++) {
+        SceneObject *obj = source[i];
+        int prim = primOf[i];
+        switch (kinds[i]) {
+            case KIND_SPHERE: spheres.set(prim, obj->position, static_cast<Sphere *>(obj)->radius); break;
+            case KIND_LIGHT: spheres.set(prim, obj->position, static_cast<Light *>(obj)->radius); break;
+            case KIND_PLANE: planes.set(prim - sphereCount(), obj->position, static_cast<Plane *>(obj)->normal); break;
+            case KIND_MESH: instances[prim - firstInstance()].set(static_cast<Mesh *>(obj)->mesh.get(), nullptr, obj->getTransform()); break;
+            case KIND_INSTANCES: setInstances(i); break;
+            case KIND_OBJECT: break;
+        }
+        materials[i].set(*obj);
+    }
+}
+
+// Sort the objects by type into fresh arrays.  Material i belongs to
+// source object i.
+//
+void SceneStore::rebuild(const vector<SceneObject *> &objects) {
+    source = objects;
+    sourceHandles.resize(objects.size());
+    for (int i = 0; i < objects.size(); i++) sourceHandles[i] = objects[i]->handle;
+    layout = nextLayout++;
+    kinds.resize(objects.size());
+    primOf.resize(objects.size());
+    primCount.assign(objects.size(), 1);
+    materials.resize(objects.size());
+    
+    int nSpheres = 0, nPlanes = 0, nInstances = 0, nPrims = 0;
+    for (int i = 0; i < objects.size(); i++) {
+        SceneObject *obj = objects[i];
+        Mesh *mesh = dynamic_cast<Mesh *>(obj);
+        Instances *copies = dynamic_cast<Instances *>(obj);
+        if (dynamic_cast<Sphere *>(obj)) kinds[i] = KIND_SPHERE;
+        else if (dynamic_cast<Light *>(obj)) kinds[i] = KIND_LIGHT;
+        else if (dynamic_cast<Plane *>(obj)) kinds[i] = KIND_PLANE;
+        else if (mesh && mesh->mesh) kinds[i] = KIND_MESH;
+        else if (copies) kinds[i] = KIND_INSTANCES;
+        else kinds[i] = KIND_OBJECT;
+        if (copies) primCount[i] = copies->transforms.size();
+        if (kinds[i] == KIND_SPHERE || kinds[i] == KIND_LIGHT) nSpheres++;
+        else if (kinds[i] == KIND_PLANE) nPlanes++;
+        else if (kinds[i] == KIND_MESH || kinds[i] == KIND_INSTANCES) nInstances += primCount[i];
+        nPrims += primCount[i];
+    }
+    
+    spheres.clear();
+    spheres.resize(nSpheres);
+    sphereLight.assign(nSpheres, 0);
+    planes.clear();
+    instances.assign(nInstances, Instance());
+    this->objects.assign(nPrims, nullptr);
+    materialIndex.assign(nPrims, 0);
+    
+    int nextSphere = 0, nextPlane = nSpheres, nextInstance = nSpheres + nPlanes, nextObject = nSpheres + nPlanes + nInstances;
+    for (int i = 0; i < objects.size(); i++) {
+        SceneObject *obj = objects[i];
+        int prim;
+        switch (kinds[i]) {
+            case KIND_SPHERE:
+                prim = nextSphere++;
+                spheres.set(prim, obj->position, static_cast<Sphere *>(obj)->radius);
+                break;
+            case KIND_LIGHT:
+                prim = nextSphere++;
+                spheres.set(prim, obj->position, static_cast<Light *>(obj)->radius);
+                sphereLight[prim] = 1;
+                break;
+            case KIND_PLANE:
+                prim = nextPlane++;
+                planes.add(obj->position, static_cast<Plane *>(obj)->normal);
+                break;
+            case KIND_MESH:
+                prim = nextInstance++;
+                instances[prim - firstInstance()].set(static_cast<Mesh *>(obj)->mesh.get(), nullptr, obj->getTransform());
+                break;
+            case KIND_INSTANCES:
+                prim = nextInstance;
+                nextInstance += primCount[i];
+                break;
+            default:
+                prim = nextObject++;
+                break;
+        }
+        primOf[i] = prim;
+        for (int k = prim; k < prim + primCount[i]; k++) {
+            this->objects[k] = obj;
+            materialIndex[k] = i;
+        }
+        if (kinds[i] == KIND_INSTANCES) setInstances(i);
+        materials[i].set(*obj);
+    }
+}
+
+// Place every copy of source object i: its own transform under the
+// object's
+//
+void SceneStore::setInstances(int source) {
+    Instances *copies = static_cast<Instances *>(this->source[source]);
+    glm::mat4 transform = copies->getTransform();
+    Instance *instance = &instances[primOf[source] - firstInstance()];
+    for (int k = 0; k < primCount[source]; k++) {
+        instance[k].set(copies->mesh.get(), copies->spheres.get(), transform * copies->transforms[k]);
+    }
+}
+
+void Material::set(const SceneObject &obj) {
+    diffuse = glm::vec3(obj.diffuseColor.r, obj.diffuseColor.g, obj.diffuseColor.b) / 255.0f;
+    specular = glm::vec3(obj.specularColor.r, obj.specularColor.g, obj.specularColor.b) / 255.0f;
+    reflectivity = glm::clamp(obj.reflectivity, 0.0f, 1.0f);
+    transparency = glm::clamp(obj.transparency, 0.0f, 1 - reflectivity);
+    refractiveIndex = std::max(obj.refractiveIndex, 0.01f);
+    maxDepth = std::max(obj.maxDepth, 0);
+    diffuseMap = TextureCache::shared().open(obj.diffuseMap);
+    specularMap = TextureCache::shared().open(obj.specularMap);
+    mapScale = obj.mapScale > 0 ? obj.mapScale : 1;
+}
+
+bool SceneStore::intersect(int prim, const Ray &ray, float &t) const {
+    switch (type(prim)) {
+        case PRIM_SPHERE:
+            return glm::intersectRaySphere(ray.p, ray.d, spheres.center(prim), spheres.radius2[prim], t);
+        case PRIM_PLANE:
+            return glm::intersectRayPlane(ray.p, ray.d, planes.point(prim - sphereCount()), planes.normal(prim - sphereCount()), t);
+        case PRIM_INSTANCE:
+            return instances[prim - firstInstance()].intersect(ray, t);
+        default: {
+            glm::vec3 point, normal;
+            if (!objects[prim]->intersect(ray, point, normal)) return false;
+            t = glm::length(point - ray.p);
+            return true;
+        }
+    }
+}
+
+// Same point and normal the front end object's intersect() would return
+//
+bool SceneStore::intersect(int prim, const Ray &ray, glm::vec3 &point, glm::vec3 &normal) const {
+    switch (type(prim)) {
+        case PRIM_SPHERE:
+            return glm::intersectRaySphere(ray.p, ray.d, spheres.center(prim), spheres.radius[prim], point, normal);
+        case PRIM_PLANE: {
+            int plane = prim - sphereCount();
+            float t;
+            if (!glm::intersectRayPlane(ray.p, ray.d, planes.point(plane), planes.normal(plane), t)) return false;
+            point = ray.p + t * ray.d;
+            normal = planes.normal(plane);
+            return true;
+        }
+        case PRIM_INSTANCE: {
+            float t;
+            if (!instances[prim - firstInstance()].intersect(ray, t, normal)) return false;
+            point = ray.p + t * ray.d;
+            return true;
+        }
+        default:
+            return objects[prim]->intersect(ray, point, normal);
+    }
+}
+
+// Textured hits get coordinates in each type's own way: a sphere's wrap
+// around it once (u with longitude, v with latitude), a plane's are world
+// units along it, and instances have their mesh's or sphere's own
+//
+bool SceneStore::resolve(int prim, const Ray &ray, Hit &hit) const {
+    const Material &material = materials[materialIndex[prim]];
+    hit.uvScale = 0;
+    if (material.isTextured() && type(prim) == PRIM_INSTANCE) {
+        float t;
+        if (!instances[prim - firstInstance()].intersect(ray, t, hit.normal, &hit)) return false;
+        hit.point = ray.p + t * ray.d;
+    }
+    else if (!intersect(prim, ray, hit.point, hit.normal)) return false;
+    hit.t = glm::dot(hit.point - ray.p, ray.d);
+    hit.prim = prim;
+    hit.material = materialIndex[prim];
+    if (!material.isTextured()) return true;
+    
+    const glm::vec3 &n = hit.normal;
+    if (type(prim) == PRIM_SPHERE) {
+        hit.uv = glm::vec2(0.5f + atan2f(n.x, n.z) / TWO_PI, 0.5f + asinf(glm::clamp(n.y, -1.0f, 1.0f)) / PI);
+        hit.uvScale = 1 / (PI * spheres.radius[prim]);
+    }
+    else if (type(prim) == PRIM_PLANE) {
+        glm::vec3 u = glm::normalize(glm::cross(n, fabs(n.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0)));
+        glm::vec3 v = glm::cross(n, u);
+        glm::vec3 p = hit.point - planes.point(prim - sphereCount());
+        hit.uv = glm::vec2(glm::dot(p, u), glm::dot(p, v));
+        hit.uvScale = 1;
+    }
+    hit.uv /= material.mapScale;
+    hit.uvScale /= material.mapScale;
+    return true;
+}
+
+bool SceneStore::occluded(int prim, const Ray &ray, float tMax) const {
+    if (type(prim) == PRIM_INSTANCE) return instances[prim - firstInstance()].occluded(ray, tMax);
+    float t;
+    return intersect(prim, ray, t) && t < tMax;
+}
+
+void Instance::set(const TriangleMesh *mesh, const SphereSet *spheres, const glm::mat4 &transform) {
+    this->mesh = mesh;
+    this->spheres = spheres;
+    toWorld = transform;
+    toObject = glm::inverse(transform);
+}
+
+// The ray in object space keeps its parameterization - a point t along it
+// is the world ray's point t - so a mesh hit's t needs no conversion.  The
+// sphere test wants a unit direction, so for sphere sets the direction is
+// normalized and t scaled back.
+//
+bool Instance::intersect(const Ray &ray, float &t) const {
+    glm::vec3 p = glm::vec3(toObject * glm::vec4(ray.p, 1));
+    glm::vec3 d = glm::vec3(toObject * glm::vec4(ray.d, 0));
+    if (mesh) {
+        MeshHit hit;
+        if (!mesh->intersect(Ray(p, d), hit)) return false;
+        t = hit.t;
+        return true;
+    }
+    if (spheres) {
+        float scale = glm::length(d);
+        SphereSetHit hit;
+        if (!spheres->intersect(Ray(p, d / scale), hit)) return false;
+        t = hit.t / scale;
+        return true;
+    }
+    return false;
+}
+
+// Normals go back to world space by the inverse transpose, which for the
+// upper 3x3 of toWorld is the transpose of toObject's
+//
+bool Instance::intersect(const Ray &ray, float &t, glm::vec3 &normal, Hit *coords) const {
+    glm::vec3 p = glm::vec3(toObject * glm::vec4(ray.p, 1));
+    glm::vec3 d = glm::vec3(toObject * glm::vec4(ray.d, 0));
+    glm::vec3 n;
+    if (mesh) {
+        MeshHit hit;
+        if (!mesh->intersect(Ray(p, d), hit)) return false;
+        t = hit.t;
+        n = mesh->getNormal(hit);
+        if (coords && !mesh->getTexcoords(hit, glm::mat3(toWorld), coords->uv, coords->uvScale)) coords->uvScale = 0;
+    }
+    else if (spheres) {
+        float scale = glm::length(d);
+        Ray local(p, d / scale);
+        SphereSetHit hit;
+        if (!spheres->intersect(local, hit)) return false;
+        t = hit.t / scale;
+        n = spheres->getNormal(local, hit);
+        
+        // the same wrapping as a sphere primitive's, in object space
+        //
+        if (coords) {
+            coords->uv = glm::vec2(0.5f + atan2f(n.x, n.z) / TWO_PI, 0.5f + asinf(glm::clamp(n.y, -1.0f, 1.0f)) / PI);
+            coords->uvScale = scale / (PI * spheres->getArrays().spheres[hit.sphere].w);
+        }
+    }
+    else return false;
+    normal = glm::normalize(glm::transpose(glm::mat3(toObject)) * n);
+    if (mesh && glm::dot(normal, ray.d) > 0) normal = -normal;
+    return true;
+}
+
+bool Instance::occluded(const Ray &ray, float tMax) const {
+    glm::vec3 p = glm::vec3(toObject * glm::vec4(ray.p, 1));
+    glm::vec3 d = glm::vec3(toObject * glm::vec4(ray.d, 0));
+    if (mesh) return mesh->occluded(Ray(p, d), tMax);
+    if (spheres) {
+        float scale = glm::length(d);
+        return spheres->occluded(Ray(p, d / scale), tMax * scale);
+    }
+    return false;
+}
+
+// The box around the object space box's 8 corners
+//
+bool Instance::getBounds(AABB &bounds) const {
+    const AABB *local = mesh ? &mesh->getBounds() : (spheres ? &spheres->getBounds() : nullptr);
+    if (!local || local->isEmpty()) return false;
+    bounds = AABB();
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 p((corner & 1) ? local->max.x : local->min.x, (corner & 2) ? local->max.y : local->min.y, (corner & 4) ? local->max.z : local->min.z);
+        bounds.grow(glm::vec3(toWorld * glm::vec4(p, 1)));
+    }
+    return true;
+}
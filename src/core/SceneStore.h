@@ -0,0 +1,148 @@
+#pragma once
+
+#include "ofMain.h"
+#include "RayPacket.h"
+#include "ObjectPool.h"
+
+class Ray;
+class SceneObject;
+class TriangleMesh;
+class SphereSet;
+class AABB;
+
+//  Surface properties a primitive is shaded with, as linear float RGB
+//  (0..1) for the renderer
+//
+struct Material {
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float reflectivity = 0;
+    float transparency = 0;
+    float refractiveIndex = 1.5;
+    int maxDepth = 0;
+    int diffuseMap = -1;        // TextureCache ids, -1 for none
+    int specularMap = -1;
+    float mapScale = 1;
+    
+    bool isTextured() const { return diffuseMap >= 0 || specularMap >= 0; }
+    void set(const SceneObject &obj);
+};
+
+//  A ray's closest hit, resolved: what shading needs to know about it.
+//  Tracing finds this first and shades once afterwards, whatever else the
+//  ray passed through on the way.
+//
+struct Hit {
+    float t = 0;                // along the ray's (normalized) direction
+    int prim = -1;              // -1 for a miss
+    int material = -1;          // into SceneStore::materials
+    glm::vec3 point;
+    glm::vec3 normal;
+    glm::vec2 uv;               // texture coordinates, only for textured materials
+    float uvScale = 0;          // how fast uv changes per unit of distance, 0 if the hit has none
+    
+    bool isHit() const { return prim >= 0; }
+};
+
+//  A copy of shared geometry (a triangle mesh or a sphere set) placed in
+//  the world by a transform: a Mesh object, or one of the copies of an
+//  Instances object.  Rays are moved into the geometry's object space and
+//  traced through its own BVH, so each copy costs two matrices rather than
+//  its own triangles and tree.
+//
+struct Instance {
+    const TriangleMesh *mesh = nullptr;     // one or the other
+    const SphereSet *spheres = nullptr;
+    glm::mat4 toWorld = glm::mat4(1.0);     // object to world space
+    glm::mat4 toObject = glm::mat4(1.0);    // its inverse
+    
+    void set(const TriangleMesh *mesh, const SphereSet *spheres, const glm::mat4 &transform);
+    
+    // Distances are along the world ray, which must be normalized.  Meshes
+    // are two-sided: their normal is flipped to face the ray.  If coords is
+    // given its uv and uvScale are set too (uvScale 0 for a mesh without
+    // texture coordinates).
+    //
+    bool intersect(const Ray &ray, float &t) const;
+    bool intersect(const Ray &ray, float &t, glm::vec3 &normal, Hit *coords = nullptr) const;
+    bool occluded(const Ray &ray, float tMax) const;
+    bool getBounds(AABB &bounds) const;     // in world space, false if there is no geometry
+};
+
+enum PrimType { PRIM_SPHERE, PRIM_PLANE, PRIM_INSTANCE, PRIM_OBJECT };
+
+//  Renderer-side copy of the scene geometry
+//
+//  The SceneObject hierarchy stays the editing/UI front end; before each
+//  render, sync() copies what the ray tracer needs into flat per-type
+//  arrays - sphere centers and radii, plane points and normals, and one
+//  material index per primitive - so the hot loops read contiguous memory
+//  instead of chasing a pointer and making a virtual call per object.
+//
+//  Every primitive has an id: spheres (including the lights' spheres) come
+//  first, then planes, then instances of meshes and sphere sets (a Mesh
+//  object is one, an Instances object one per copy, each with the shared
+//  geometry's BVH underneath), then any other object type, which is still
+//  traced through its virtual SceneObject::intersect().  The scene BVH over
+//  these ids is the top level of a two-level BVH.
+//
+class SceneStore {
+public:
+    // Copy the objects' current state in.  If the object list (and the
+    // number of copies of each Instances object) is the same as last time
+    // only positions, radii, normals, transforms and colors are refreshed
+    // and the primitive ids stay valid; otherwise the store is rebuilt and
+    // getLayout() changes.
+    //
+    void sync(const vector<SceneObject *> &objects);
+    
+    unsigned long getLayout() const { return layout; }
+    
+    int size() const { return materialIndex.size(); }
+    int sphereCount() const { return spheres.x.size(); }
+    int planeCount() const { return planes.size(); }
+    int instanceCount() const { return instances.size(); }
+    int firstInstance() const { return sphereCount() + planeCount(); }
+    
+    PrimType type(int prim) const {
+        if (prim < sphereCount()) return PRIM_SPHERE;
+        if (prim < firstInstance()) return PRIM_PLANE;
+        return prim < firstInstance() + instanceCount() ? PRIM_INSTANCE : PRIM_OBJECT;
+    }
+    bool isLight(int prim) const { return prim < sphereCount() && sphereLight[prim]; }
+    const Material & getMaterial(int prim) const { return materials[materialIndex[prim]]; }
+    SceneObject * getObject(int prim) const { return objects[prim]; }      // the front end object
+    
+    // Ray against one primitive, through the same glm tests the
+    // SceneObjects use, so hits match theirs exactly
+    //
+    bool intersect(int prim, const Ray &ray, float &t) const;
+    bool intersect(int prim, const Ray &ray, glm::vec3 &point, glm::vec3 &normal) const;
+    bool occluded(int prim, const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;   // any hit before tMax, cheaper for instances
+    
+    // Fill hit for ray's hit on prim, false if the scalar test misses it.
+    // Texture coordinates are only worked out for textured materials.
+    //
+    bool resolve(int prim, const Ray &ray, Hit &hit) const;
+    
+    SphereArrays spheres;               // by sphere id
+    vector<unsigned char> sphereLight;  // 1 for a light's sphere
+    PlaneArrays planes;                 // by prim id - sphereCount()
+    vector<Instance> instances;         // by prim id - firstInstance()
+    vector<int> materialIndex;          // by prim id
+    vector<Material> materials;         // one per object for now
+
+private:
+    enum Kind : unsigned char { KIND_SPHERE, KIND_LIGHT, KIND_PLANE, KIND_MESH, KIND_INSTANCES, KIND_OBJECT };
+    
+    void rebuild(const vector<SceneObject *> &objects);
+    void setInstances(int source);
+    
+    vector<SceneObject *> objects;      // by prim id
+    vector<SceneObject *> source;       // object list sync() last saw
+    vector<ObjectHandle> sourceHandles; // and their handles - a new object can take a removed one's place in its pool
+    vector<int> primOf;                 // (first) prim id of each source object
+    vector<int> primCount;              // and how many it has - several for Instances
+    vector<Kind> kinds;                 // by source index
+    unsigned long layout = 0;
+};
@@ -0,0 +1,115 @@
+#include "SequenceRenderer.h"
+
+SequenceRenderer::SequenceRenderer(int nThreads) {
+    this->nThreads = nThreads > 0 ? nThreads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+SequenceRenderer::~SequenceRenderer() {
+    cancel();
+    wait();
+}
+
+bool SequenceRenderer::render(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext) {
+    start(scene, settings, width, height, first, last, prefix, ext);
+    return wait();
+}
+
+void SequenceRenderer::start(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext) {
+    cancel();
+    wait();
+    
+    startTime = ofGetElapsedTimeMicros();
+    scene.copyTo(source);
+    this->settings = settings;
+    this->width = width;
+    this->height = height;
+    this->prefix = prefix;
+    this->ext = ext;
+    stats = SequenceStats();
+    bCancel = false;
+    
+    frames.clear();
+    for (int frame = first; frame <= last; frame++) {
+        if (bResume && ofFile::doesFileExist(ImageWriter::framePath(prefix, frame, ext))) stats.skipped++;
+        else frames.push_back(frame);
+    }
+    nextFrame = 0;
+    unfinished = frames.size();
+    if (frames.empty()) return;
+    
+    // as many frames at once as there are threads, frames and memory for
+    //
+    int inFlight = framesInFlight > 0 ? framesInFlight : nThreads;
+    size_t budget = (size_t)std::max(1, memoryBudgetMB) << 20;
+    inFlight = std::min<size_t>(inFlight, std::max<size_t>(1, budget / frameBytes(source, width, height)));
+    inFlight = std::min<int>(inFlight, frames.size());
+    stats.framesInFlight = inFlight;
+    
+    // finished images wait in the writer's queue, so it is bounded by the
+    // number of slots too
+    //
+    writer.reset(new ImageWriter(std::min(inFlight, 4), inFlight));
+    activeSlots = inFlight;
+    for (int slot = 0; slot < inFlight; slot++) slots.push_back(std::thread(&SequenceRenderer::slotLoop, this, slot));
+}
+
+bool SequenceRenderer::wait() {
+    for (std::thread &slot : slots) slot.join();
+    slots.clear();
+    if (!writer) return true;
+    writer->flush();
+    bool ok = writer->getErrors() == 0 && !bCancel;
+    writer.reset();
+    stats.wallMs = (ofGetElapsedTimeMicros() - startTime) / 1000.0f;
+    return ok;
+}
+
+void SequenceRenderer::cancel() {
+    bCancel = true;
+}
+
+void SequenceRenderer::slotLoop(int slot) {
+    Scene snapshot;
+    source.copyTo(snapshot);
+    Renderer renderer(1);
+    renderer.tileRenderer.cancel = &bCancel;
+    
+    int index;
+    while (!bCancel && (index = nextFrame++) < frames.size()) {
+        int frame = frames[index];
+        
+        // the threads of slots that have run out of frames go to the frames
+        // still being rendered
+        //
+        int sharing = std::max(1, std::min<int>(stats.framesInFlight, unfinished));
+        int threads = std::max(1, nThreads / sharing);
+        if (renderer.tileRenderer.getThreads() != threads) renderer.setThreads(threads);
+        
+        snapshot.setFrame(frame);
+        ofPixels pixels = writer->recycle(width, height);
+        renderer.render(snapshot, settings, pixels);
+        if (bCancel) break;
+        writer->writeFrame(std::move(pixels), prefix, frame, ext);
+        unfinished--;
+        
+        std::lock_guard<std::mutex> guard(lock);
+        const RenderStats &frameStats = renderer.getStats();
+        stats.frames++;
+        stats.rays += frameStats.rays();
+        stats.renderMs += frameStats.renderMs;
+        if (onFrame) onFrame(frame, frameStats);
+    }
+    activeSlots--;
+}
+
+// What one frame in flight holds: the frame buffer, the 8 bit image (and
+// its copy in the writer's queue), adaptive anti-aliasing's scratch, and a
+// copy of the scene with its primitive store and two BVHs.  Meshes are
+// shared between the copies.
+//
+size_t SequenceRenderer::frameBytes(const Scene &scene, int width, int height) {
+    size_t pixels = (size_t)width * height;
+    size_t perPixel = sizeof(glm::vec4) + 2 * 3 + 1 + sizeof(glm::vec3);
+    size_t perObject = 512;
+    return pixels * perPixel + scene.objects.size() * perObject;
+}
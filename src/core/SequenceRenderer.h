@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "ImageWriter.h"
+
+//  Totals for a sequence, filled in as frames finish
+//
+struct SequenceStats {
+    int frames = 0;             // rendered by this run
+    int skipped = 0;            // already on disk (resume)
+    int framesInFlight = 0;     // frames rendered at once
+    uint64_t rays = 0;
+    float renderMs = 0;         // summed over frames
+    float wallMs = 0;           // whole sequence
+};
+
+//  Offline animation sequence renderer
+//
+//  Renders frames first..last of the scene's animation to numbered images
+//  (see ImageWriter::writeFrame()), several frames at once.  Each frame slot
+//  runs on its own thread with its own snapshot of the scene, which it
+//  moves to every frame it picks up with Scene::setFrame(), and its own
+//  Renderer, so slots never share mutable state.
+//
+//  Threads are split between the two levels.  Frames in flight scale almost
+//  perfectly - they share nothing and each one's serial parts (syncing the
+//  store, refitting the BVH, resolving) overlap the others' tracing - so
+//  there are as many slots as threads, as long as the frames fit in
+//  memoryBudgetMB (estimated from the image size and the object count) and
+//  there are frames to go around.  The threads left over go to tiles within
+//  each frame, and once fewer frames remain than slots, each new frame gets
+//  the threads of the slots that ran out of work.
+//
+//  Frames are written atomically, so with bResume set, frames whose image
+//  already exists are skipped and a crashed or cancelled sequence picks up
+//  where it stopped.
+//
+class SequenceRenderer {
+public:
+    SequenceRenderer(int nThreads = 0);     // 0 = one per hardware thread
+    ~SequenceRenderer();                    // cancels a sequence in progress
+    
+    // Render and write the sequence, blocking until it is done.  False if
+    // any frame couldn't be written.
+    //
+    bool render(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext);
+    
+    // The same in the background: start() copies what it needs and returns,
+    // so the caller can keep editing the scene.  isDone() polls, wait()
+    // blocks until the sequence finishes and returns what render() would.
+    //
+    void start(const Scene &scene, const RenderSettings &settings, int width, int height, int first, int last, const string &prefix, const string &ext);
+    bool isDone() const { return activeSlots == 0; }
+    bool wait();
+    void cancel();              // frames in flight are abandoned, not written
+    
+    const SequenceStats & getStats() const { return stats; }     // after wait()
+    
+    // Called on a slot thread (one at a time) after each frame is queued
+    // for writing
+    //
+    std::function<void(int frame, const RenderStats &stats)> onFrame;
+    
+    int framesInFlight = 0;             // 0 = chosen as above
+    int memoryBudgetMB = 2048;
+    bool bResume = false;
+
+private:
+    void slotLoop(int slot);
+    static size_t frameBytes(const Scene &scene, int width, int height);
+    
+    int nThreads;
+    vector<std::thread> slots;
+    std::atomic<int> activeSlots{0};
+    std::atomic<bool> bCancel{false};
+    unique_ptr<ImageWriter> writer;
+    uint64_t startTime = 0;
+    
+    // the sequence (read only while slots run)
+    //
+    Scene source;
+    RenderSettings settings;
+    int width = 0;
+    int height = 0;
+    string prefix;
+    string ext;
+    vector<int> frames;                 // still to render
+    std::atomic<int> nextFrame{0};      // index into frames
+    std::atomic<int> unfinished{0};     // frames not yet written
+    
+    std::mutex lock;                    // guards stats and onFrame calls
+    SequenceStats stats;
+};
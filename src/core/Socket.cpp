@@ -0,0 +1,243 @@
+#include "Socket.h"
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+static const int sendFlags = MSG_NOSIGNAL;     // a closed peer is an error, not SIGPIPE
+#else
+static const int sendFlags = 0;
+#endif
+
+//  Message header: type and payload size
+//
+struct MessageHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+static const uint64_t maxMessageSize = 1ull << 36;     // anything bigger is a corrupt header
+
+#ifdef _WIN32
+
+bool Socket::listen(const string &address) { ofLogError("Socket") << "sockets aren't supported on Windows"; return false; }
+bool Socket::connect(const string &address) { ofLogError("Socket") << "sockets aren't supported on Windows"; return false; }
+unique_ptr<Socket> Socket::accept() { return nullptr; }
+void Socket::close() { }
+void Socket::setTimeout(float seconds) { }
+bool Socket::sendAll(const void *data, size_t size) { return false; }
+bool Socket::receiveAll(void *data, size_t size) { return false; }
+
+#else
+
+// Split "host:port" (host may be empty or *) or "unix:path"
+//
+static bool parseAddress(const string &address, bool &isUnix, string &host, string &port) {
+    isUnix = address.compare(0, 5, "unix:") == 0;
+    if (isUnix) {
+        host = address.substr(5);
+        return !host.empty() && host.size() < sizeof(sockaddr_un::sun_path);
+    }
+    size_t colon = address.rfind(':');
+    if (colon == string::npos || colon + 1 == address.size()) return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host == "*") host.clear();
+    return true;
+}
+
+static sockaddr_un unixAddress(const string &path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+static void configure(int fd, bool isUnix) {
+    int one = 1;
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    // messages are sent whole, so don't hold back their last segment
+    //
+    if (!isUnix) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+bool Socket::listen(const string &address) {
+    close();
+    bool isUnix;
+    string host, port;
+    if (!parseAddress(address, isUnix, host, port)) {
+        ofLogError("Socket") << "bad address " << address << ", expected host:port or unix:path";
+        return false;
+    }
+    name = address;
+    if (isUnix) {
+        sockaddr_un addr = unixAddress(host);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(host.c_str());       // left over from a listener that crashed
+        if (fd < 0 || bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(fd, 64) != 0) {
+            ofLogError("Socket") << "can't listen on " << address << ": " << strerror(errno);
+            close();
+            return false;
+        }
+        unixPath = host;
+        return true;
+    }
+    
+    addrinfo hints, *found = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0) {
+        ofLogError("Socket") << "can't resolve " << address;
+        return false;
+    }
+    for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || ::listen(fd, 64) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+        ofLogError("Socket") << "can't listen on " << address << ": " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool Socket::connect(const string &address) {
+    close();
+    bool isUnix;
+    string host, port;
+    if (!parseAddress(address, isUnix, host, port)) {
+        ofLogError("Socket") << "bad address " << address << ", expected host:port or unix:path";
+        return false;
+    }
+    name = address;
+    if (isUnix) {
+        sockaddr_un addr = unixAddress(host);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && ::connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+            configure(fd, true);
+            return true;
+        }
+        close();
+        return false;
+    }
+    
+    addrinfo hints, *found = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &found) != 0) return false;
+    for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) return false;
+    configure(fd, false);
+    return true;
+}
+
+unique_ptr<Socket> Socket::accept() {
+    sockaddr_storage addr;
+    socklen_t length = sizeof(addr);
+    int client = ::accept(fd, (sockaddr *)&addr, &length);
+    if (client < 0) return nullptr;
+    
+    unique_ptr<Socket> connection = make_unique<Socket>();
+    connection->fd = client;
+    connection->name = name;
+    char host[256], port[32];
+    if (addr.ss_family != AF_UNIX && getnameinfo((sockaddr *)&addr, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+        connection->name = string(host) + ":" + port;
+    }
+    configure(client, addr.ss_family == AF_UNIX);
+    return connection;
+}
+
+void Socket::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    if (!unixPath.empty()) unlink(unixPath.c_str());
+    unixPath.clear();
+}
+
+void Socket::setTimeout(float seconds) {
+    timeval tv;
+    tv.tv_sec = (time_t)seconds;
+    tv.tv_usec = (suseconds_t)((seconds - tv.tv_sec) * 1e6);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool Socket::sendAll(const void *data, size_t size) {
+    const char *p = (const char *)data;
+    while (size > 0) {
+        ssize_t sent = ::send(fd, p, size, sendFlags);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool Socket::receiveAll(void *data, size_t size) {
+    char *p = (char *)data;
+    while (size > 0) {
+        ssize_t received = ::recv(fd, p, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        p += received;
+        size -= received;
+    }
+    return true;
+}
+
+#endif
+
+bool Socket::send(uint32_t type, const void *data, size_t size) {
+    if (fd < 0) return false;
+    MessageHeader header = { type, 0, size };
+    if (!sendAll(&header, sizeof(header)) || !sendAll(data, size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool Socket::receive(uint32_t &type, vector<char> &payload) {
+    if (fd < 0) return false;
+    MessageHeader header;
+    if (!receiveAll(&header, sizeof(header)) || header.size > maxMessageSize) {
+        close();
+        return false;
+    }
+    payload.resize(header.size);
+    if (!receiveAll(payload.data(), payload.size())) {
+        close();
+        return false;
+    }
+    type = header.type;
+    return true;
+}
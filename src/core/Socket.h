@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Blocking stream socket, TCP or Unix domain
+//
+//  Addresses are "host:port" for TCP ("*:port" or ":port" to listen on
+//  every interface) or "unix:path" for a Unix domain socket, which is
+//  faster between processes on one machine.  Data is exchanged as
+//  messages: a type and a payload, sent and received whole.  Nothing is
+//  converted to network byte order, so both ends must share a byte order -
+//  the messages carry compiled scenes, which do anyway.
+//
+//  Only POSIX systems are supported; on Windows every call fails.
+//
+class Socket {
+public:
+    Socket() { }
+    ~Socket() { close(); }
+    Socket(const Socket &) = delete;
+    Socket & operator=(const Socket &) = delete;
+    
+    bool listen(const string &address);
+    bool connect(const string &address);
+    unique_ptr<Socket> accept();    // null if no connection is pending or it failed
+    void close();
+    
+    bool isOpen() const { return fd >= 0; }
+    int getHandle() const { return fd; }                // for poll()
+    const string & getName() const { return name; }     // the address, or the peer's, for messages
+    
+    // send() and receive() give up after this long without progress, 0 =
+    // wait forever
+    //
+    void setTimeout(float seconds);
+    
+    // False (with the socket closed) if the connection failed or the other
+    // end closed it
+    //
+    bool send(uint32_t type, const void *data, size_t size);
+    bool receive(uint32_t &type, vector<char> &payload);
+
+private:
+    bool sendAll(const void *data, size_t size);
+    bool receiveAll(void *data, size_t size);
+    
+    int fd = -1;
+    string name;
+    string unixPath;        // removed when a Unix domain listener closes
+};
@@ -0,0 +1,115 @@
+#include "SphereSet.h"
+#include "Scene.h"
+
+static const int stackSize = 128;
+
+void SphereSet::build() {
+    file.reset();
+    int n = spheres.size();
+    vector<BVHBuildRef> refs(n);
+    AABB bounds;
+    for (int i = 0; i < n; i++) {
+        glm::vec3 center(spheres[i].x, spheres[i].y, spheres[i].z);
+        AABB b(center - glm::vec3(spheres[i].w), center + glm::vec3(spheres[i].w));
+        refs[i] = { b, center, i };
+        bounds.grow(b);
+    }
+    nodes.clear();
+    vector<int> order;
+    buildBVH(refs, maxLeafSize, nodes, order);
+    
+    vector<glm::vec4> sorted(n);
+    for (int k = 0; k < n; k++) sorted[k] = spheres[order[k]];
+    spheres.swap(sorted);
+    
+    arrays.spheres = spheres.data();
+    arrays.count = n;
+    arrays.nodes = nodes.data();
+    arrays.nodeCount = nodes.size();
+    arrays.bounds = bounds;
+}
+
+void SphereSet::attach(shared_ptr<const MappedFile> file, const SphereSetArrays &arrays) {
+    spheres.clear();
+    nodes.clear();
+    this->file = file;
+    this->arrays = arrays;
+}
+
+bool SphereSet::intersect(const Ray &ray, SphereSetHit &hit) const {
+    if (arrays.nodeCount == 0) return false;
+    const BVHNode *nodes = arrays.nodes;
+    glm::vec3 invDir = 1.0f / ray.d;
+    float closest = std::numeric_limits<float>::infinity();
+    int best = -1;
+    
+    int stack[stackSize];
+    int top = 0;
+    int current = 0;
+    while (true) {
+        const BVHNode &node = nodes[current];
+        float tEntry;
+        if (intersectBox(node.min, node.max, ray.p, invDir, closest, tEntry)) {
+            if (node.count > 0) {
+                for (int k = node.offset; k < node.offset + node.count; k++) {
+                    const glm::vec4 &s = arrays.spheres[k];
+                    float t;
+                    if (glm::intersectRaySphere(ray.p, ray.d, glm::vec3(s.x, s.y, s.z), s.w * s.w, t) && t < closest) {
+                        closest = t;
+                        best = k;
+                    }
+                }
+            }
+            else {
+                if (ray.d[node.axis] < 0) {
+                    stack[top++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[top++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (top == 0) break;
+        current = stack[--top];
+    }
+    if (best < 0) return false;
+    hit.t = closest;
+    hit.sphere = best;
+    return true;
+}
+
+bool SphereSet::occluded(const Ray &ray, float tMax) const {
+    if (arrays.nodeCount == 0) return false;
+    const BVHNode *nodes = arrays.nodes;
+    glm::vec3 invDir = 1.0f / ray.d;
+    
+    int stack[stackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int current = stack[--top];
+        const BVHNode &node = nodes[current];
+        float tEntry;
+        if (!intersectBox(node.min, node.max, ray.p, invDir, tMax, tEntry)) continue;
+        if (node.count > 0) {
+            for (int k = node.offset; k < node.offset + node.count; k++) {
+                const glm::vec4 &s = arrays.spheres[k];
+                float t;
+                if (glm::intersectRaySphere(ray.p, ray.d, glm::vec3(s.x, s.y, s.z), s.w * s.w, t) && t < tMax) return true;
+            }
+        }
+        else {
+            stack[top++] = node.offset;
+            stack[top++] = current + 1;
+        }
+    }
+    return false;
+}
+
+glm::vec3 SphereSet::getNormal(const Ray &ray, const SphereSetHit &hit) const {
+    const glm::vec4 &s = arrays.spheres[hit.sphere];
+    return (ray.p + hit.t * ray.d - glm::vec3(s.x, s.y, s.z)) / s.w;
+}
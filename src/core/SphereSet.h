@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ofMain.h"
+#include "BVH.h"
+
+class Ray;
+class MappedFile;
+
+//  Where a ray hit a sphere set
+//
+struct SphereSetHit {
+    float t;
+    int sphere;             // leaf slot
+};
+
+//  Everything a sphere set traces from, in its own vectors or in a binary
+//  scene file (see SceneFile.h)
+//
+struct SphereSetArrays {
+    const glm::vec4 *spheres = nullptr;     // center and radius, in leaf order
+    int count = 0;
+    const BVHNode *nodes = nullptr;
+    int nodeCount = 0;
+    AABB bounds;
+};
+
+//  Spheres placed together as one piece of geometry - a pile of pebbles,
+//  the leaves of a tree - so that Instances can share them like a
+//  TriangleMesh.  Like a mesh it has its own BVH, which sits under the
+//  scene BVH as a single primitive.
+//
+//  build() sorts the spheres into the BVH's leaf order, so a leaf's spheres
+//  are contiguous and a hit names a sphere by its slot.
+//
+class SphereSet {
+public:
+    SphereSet() { }
+    SphereSet(const SphereSet &) = delete;
+    SphereSet & operator=(const SphereSet &) = delete;
+    
+    void add(const glm::vec3 &center, float radius) { spheres.push_back(glm::vec4(center, radius)); }
+    void build();           // (re)build the BVH after adding spheres
+    
+    // Trace from arrays that were built earlier, in memory that file keeps
+    // mapped for as long as the set exists
+    //
+    void attach(shared_ptr<const MappedFile> file, const SphereSetArrays &arrays);
+    
+    const SphereSetArrays & getArrays() const { return arrays; }
+    int size() const { return arrays.count; }
+    const AABB & getBounds() const { return arrays.bounds; }
+    
+    // Distances are along ray.d, which must be normalized as for the
+    // scene's own spheres
+    //
+    bool intersect(const Ray &ray, SphereSetHit &hit) const;    // closest hit
+    bool occluded(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;    // any hit before tMax
+    glm::vec3 getNormal(const Ray &ray, const SphereSetHit &hit) const;
+    
+    vector<glm::vec4> spheres;      // what add() fills in, traced after build()
+    int maxLeafSize = 4;
+
+private:
+    vector<BVHNode> nodes;
+    
+    SphereSetArrays arrays;         // what is traced, in the vectors above or in file
+    shared_ptr<const MappedFile> file;
+};
@@ -0,0 +1,349 @@
+#include "TextureCache.h"
+#include "Profiler.h"
+
+//  Tiles files: a header, then every tile of every level, level 0 first and
+//  each level's tiles row by row.  Tiles past a level's right or bottom
+//  edge repeat its last column or row.
+//
+static const char tilesMagic[8] = { 'R', 'T', 'T', 'I', 'L', 'E', 'S', 0 };
+static const uint32_t tilesVersion = 1;
+static const size_t tilesOffset = 64;       // of the first tile
+
+struct TilesHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t levels;
+    uint32_t tileSize;
+    uint8_t average[4];
+};
+
+static const int minSlots = 64;
+
+TextureCache & TextureCache::shared() {
+    // never destroyed, so readers in objects that outlive main() can still
+    // let go of their tiles
+    //
+    static TextureCache *cache = new TextureCache();
+    return *cache;
+}
+
+int TextureCache::open(const string &path) {
+    if (path.empty()) return -1;
+    std::lock_guard<std::mutex> guard(mutex);
+    auto found = ids.find(path);
+    if (found != ids.end()) return found->second;
+    
+    // a path that failed is remembered as -1, so it is only reported once
+    //
+    int &id = ids[path];
+    id = -1;
+    if (textureCount == maxTextures) {
+        ofLogError("TextureCache") << "more than " << maxTextures << " textures, can't open " << path;
+        return -1;
+    }
+    string image = ofToDataPath(path);
+    string tiles = ofToLower(ofFilePath::getFileExt(image)) == "tiles" ? image : image + ".tiles";
+    if (!ofFile::doesFileExist(tiles, false)) {
+        uint64_t start = ofGetElapsedTimeMicros();
+        if (!convert(image, tiles)) return -1;
+        ofLogNotice("TextureCache") << "converted " << path << " to tiles in " << (ofGetElapsedTimeMicros() - start) / 1000 << " ms";
+    }
+    unique_ptr<Texture> texture(new Texture());
+    if (!readTiles(*texture, tiles)) return -1;
+    textures[textureCount] = std::move(texture);
+    id = textureCount++;
+    return id;
+}
+
+// Check the header and size of a tiles file and lay out its levels
+//
+bool TextureCache::readTiles(Texture &texture, const string &path) {
+    texture.path = path;
+    texture.file.open(path, std::ios::binary);
+    TilesHeader header;
+    if (!texture.file.read((char *)&header, sizeof(header)) || memcmp(header.magic, tilesMagic, sizeof(tilesMagic)) != 0) {
+        ofLogError("TextureCache") << path << " isn't a tiles file";
+        return false;
+    }
+    if (header.version != tilesVersion || header.tileSize != tileSize || header.levels == 0 || header.levels > 32 ||
+        header.width == 0 || header.height == 0) {
+        ofLogError("TextureCache") << path << " was written by a different version - delete it to convert the image again";
+        return false;
+    }
+    int width = header.width, height = header.height, tiles = 0;
+    for (int l = 0; l < header.levels; l++) {
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.tilesX = (width + tileSize - 1) / tileSize;
+        level.tilesY = (height + tileSize - 1) / tileSize;
+        level.firstTile = tiles;
+        tiles += level.tilesX * level.tilesY;
+        texture.levels.push_back(level);
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    texture.file.seekg(0, std::ios::end);
+    if ((size_t)texture.file.tellg() < tilesOffset + tiles * tileBytes) {
+        ofLogError("TextureCache") << path << " is truncated";
+        return false;
+    }
+    texture.average = glm::vec3(header.average[0], header.average[1], header.average[2]) / 255.0f;
+    texture.slotOf.reset(new std::atomic<int32_t>[tiles]);
+    for (int t = 0; t < tiles; t++) texture.slotOf[t].store(-1, std::memory_order_relaxed);
+    return true;
+}
+
+bool TextureCache::convert(const string &image, const string &tiles) {
+    ofPixels pixels;
+    if (!ofLoadImage(pixels, image) || pixels.getWidth() == 0 || pixels.getHeight() == 0) {
+        ofLogError("TextureCache") << "can't load image " << image;
+        return false;
+    }
+    int width = pixels.getWidth(), height = pixels.getHeight();
+    int channels = pixels.getNumChannels();
+    vector<unsigned char> level((size_t)width * height * 4);
+    const unsigned char *from = pixels.getData();
+    for (size_t i = 0; i < (size_t)width * height; i++, from += channels) {
+        unsigned char *to = &level[4 * i];
+        to[0] = from[0];
+        to[1] = channels >= 3 ? from[1] : from[0];
+        to[2] = channels >= 3 ? from[2] : from[0];
+        to[3] = channels == 4 ? from[3] : channels == 2 ? from[1] : 255;
+    }
+    pixels.clear();
+    
+    TilesHeader header = TilesHeader();
+    memcpy(header.magic, tilesMagic, sizeof(tilesMagic));
+    header.version = tilesVersion;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.levels = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2) header.levels++;
+    
+    // written under another name and renamed when it is complete, so a
+    // crash (or another process converting the same image) never leaves a
+    // partial file behind
+    //
+    string partial = tiles + ".partial";
+    ofstream out(partial, std::ios::binary);
+    static const char zeros[tilesOffset] = { 0 };
+    out.write(zeros, tilesOffset);
+    vector<unsigned char> tile(tileBytes);
+    for (int l = 0; l < header.levels; l++) {
+        for (int ty = 0; ty < height; ty += tileSize) {
+            for (int tx = 0; tx < width; tx += tileSize) {
+                for (int y = 0; y < tileSize; y++) {
+                    for (int x = 0; x < tileSize; x++) {
+                        size_t texel = (size_t)std::min(ty + y, height - 1) * width + std::min(tx + x, width - 1);
+                        memcpy(&tile[4 * (y * tileSize + x)], &level[4 * texel], 4);
+                    }
+                }
+                out.write((const char *)tile.data(), tileBytes);
+            }
+        }
+        if (l + 1 == header.levels) break;
+        
+        // the next level down, each texel the average of 2 x 2
+        //
+        int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        vector<unsigned char> smaller((size_t)w * h * 4);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+                for (int c = 0; c < 4; c++) {
+                    int sum = level[4 * ((size_t)y0 * width + x0) + c] + level[4 * ((size_t)y0 * width + x1) + c] +
+                              level[4 * ((size_t)y1 * width + x0) + c] + level[4 * ((size_t)y1 * width + x1) + c];
+                    smaller[4 * ((size_t)y * w + x) + c] = (sum + 2) / 4;
+                }
+            }
+        }
+        level.swap(smaller);
+        width = w;
+        height = h;
+    }
+    memcpy(header.average, level.data(), 4);
+    out.seekp(0);
+    out.write((const char *)&header, sizeof(header));
+    out.close();
+    if (out.fail() || std::rename(partial.c_str(), tiles.c_str()) != 0) {
+        std::remove(partial.c_str());
+        ofLogError("TextureCache") << "can't write " << tiles;
+        return false;
+    }
+    return true;
+}
+
+void TextureCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (slots) {
+        ofLogWarning("TextureCache") << "the budget can't change once tiles are loaded";
+        return;
+    }
+    budget = bytes;
+}
+
+TextureCacheStats TextureCache::getStats() {
+    std::lock_guard<std::mutex> guard(mutex);
+    TextureCacheStats current = stats;
+    current.textures = textureCount;
+    current.budgetBytes = budget;
+    return current;
+}
+
+int TextureCache::acquire(int id, int tile) {
+    int slot = textures[id]->slotOf[tile].load(std::memory_order_acquire);
+    if (slot >= 0 && pin(slot, (uint64_t)id << 32 | tile)) return slot;
+    return load(id, tile);
+}
+
+// Pin slot if it still holds owner's tile.  A slot that is locked, or was
+// refilled with another tile since the caller looked it up, is let go.
+//
+bool TextureCache::pin(int slot, uint64_t owner) {
+    Slot &s = slots[slot];
+    uint32_t pins = s.pins.fetch_add(1, std::memory_order_acquire);
+    if (!(pins & locked) && s.owner.load(std::memory_order_relaxed) == owner) {
+        if (!s.used.load(std::memory_order_relaxed)) s.used.store(1, std::memory_order_relaxed);
+        return true;
+    }
+    release(slot);
+    return false;
+}
+
+// Read a tile into a slot, pinned for the caller
+//
+int TextureCache::load(int id, int tile) {
+    std::lock_guard<std::mutex> guard(mutex);
+    Texture &texture = *textures[id];
+    uint64_t owner = (uint64_t)id << 32 | tile;
+    int slot = texture.slotOf[tile].load(std::memory_order_acquire);
+    if (slot >= 0 && pin(slot, owner)) return slot;     // another thread loaded it meanwhile
+    
+    if (!slots) {
+        slotCount = std::max((size_t)minSlots, budget / tileBytes);
+        slots.reset(new Slot[slotCount]);
+        data.reset(new unsigned char[slotCount * tileBytes]);
+    }
+    slot = evict();
+    if (slot < 0) {
+        stats.failedLoads++;
+        return -1;
+    }
+    
+    // the slot is locked: readers back off it until it is unlocked below
+    //
+    Slot &s = slots[slot];
+    uint64_t previous = s.owner.load(std::memory_order_relaxed);
+    if (previous != noOwner) {
+        textures[previous >> 32]->slotOf[(uint32_t)previous].store(-1, std::memory_order_relaxed);
+        stats.evictions++;
+    }
+    else {
+        stats.residentBytes += tileBytes;
+    }
+    unsigned char *to = data.get() + slot * tileBytes;
+    texture.file.clear();
+    texture.file.seekg(tilesOffset + tile * tileBytes);
+    if (!texture.file.read((char *)to, tileBytes)) {
+        ofLogError("TextureCache") << "can't read tile " << tile << " of " << texture.path;
+        for (size_t i = 0; i < tileBytes; i += 4) {
+            for (int c = 0; c < 3; c++) to[i + c] = texture.average[c] * 255 + 0.5f;
+            to[i + 3] = 255;
+        }
+    }
+    stats.tileReads++;
+    PROFILE_COUNT(COUNTER_TILE_READS, 1);
+    
+    s.owner.store(owner, std::memory_order_relaxed);
+    s.used.store(1, std::memory_order_relaxed);
+    s.pins.fetch_sub(locked - 1, std::memory_order_release);   // unlocked, and pinned once
+    texture.slotOf[tile].store(slot, std::memory_order_release);
+    return slot;
+}
+
+// A slot to refill, locked, or -1 if every slot is pinned.  The clock hand
+// clears the used flags it passes, so in two turns it finds any slot that
+// isn't pinned.
+//
+int TextureCache::evict() {
+    for (int n = 0; n < 2 * slotCount; n++) {
+        int slot = hand;
+        hand = (hand + 1) % slotCount;
+        Slot &s = slots[slot];
+        if (s.used.load(std::memory_order_relaxed)) {
+            s.used.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        uint32_t unpinned = 0;
+        if (s.pins.compare_exchange_strong(unpinned, locked, std::memory_order_acquire)) return slot;
+    }
+    return -1;
+}
+
+//--------------------------------------------------------------
+// READER
+
+void TextureReader::release() {
+    for (Held &h : held) {
+        if (h.slot >= 0) TextureCache::shared().release(h.slot);
+        h = Held();
+    }
+}
+
+// Trilinear: bilinear in the two mip levels around the footprint, blended
+//
+glm::vec3 TextureReader::sample(int id, const glm::vec2 &uv, float footprint) {
+    const TextureCache::Texture &texture = TextureCache::shared().texture(id);
+    int levels = texture.levels.size();
+    float texels = footprint * std::max(texture.levels[0].width, texture.levels[0].height);
+    if (!(texels > 1)) texels = 1;
+    float level = std::min(log2f(texels), levels - 1.0f);
+    int l0 = (int)level;
+    float blend = level - l0;
+    glm::vec3 color = bilinear(id, l0, uv);
+    if (blend > 0 && l0 + 1 < levels) color = glm::mix(color, bilinear(id, l0 + 1, uv), blend);
+    return color;
+}
+
+glm::vec3 TextureReader::bilinear(int id, int level, const glm::vec2 &uv) {
+    const TextureCache::Level &l = TextureCache::shared().texture(id).levels[level];
+    float x = (uv.x - floorf(uv.x)) * l.width - 0.5f;
+    float y = (1 - (uv.y - floorf(uv.y))) * l.height - 0.5f;
+    float fx = x - floorf(x), fy = y - floorf(y);
+    int x0 = ((int)floorf(x) + l.width) % l.width, x1 = (x0 + 1) % l.width;
+    int y0 = ((int)floorf(y) + l.height) % l.height, y1 = (y0 + 1) % l.height;
+    glm::vec3 top = glm::mix(texel(id, level, x0, y0), texel(id, level, x1, y0), fx);
+    glm::vec3 bottom = glm::mix(texel(id, level, x0, y1), texel(id, level, x1, y1), fx);
+    return glm::mix(top, bottom, fy);
+}
+
+glm::vec3 TextureReader::texel(int id, int level, int x, int y) {
+    TextureCache &cache = TextureCache::shared();
+    const TextureCache::Texture &texture = cache.texture(id);
+    const TextureCache::Level &l = texture.levels[level];
+    static const int tileSize = TextureCache::tileSize;
+    int tile = l.firstTile + (y / tileSize) * l.tilesX + x / tileSize;
+    uint64_t owner = (uint64_t)id << 32 | tile;
+    int slot = -1;
+    for (const Held &h : held) {
+        if (h.owner == owner) {
+            slot = h.slot;
+            break;
+        }
+    }
+    if (slot < 0) {
+        slot = cache.acquire(id, tile);
+        if (slot < 0) return texture.average;
+        Held &h = held[next];
+        if (h.slot >= 0) cache.release(h.slot);
+        h.owner = owner;
+        h.slot = slot;
+        next = (next + 1) % heldTiles;
+    }
+    const unsigned char *p = cache.tileData(slot) + 4 * ((y % tileSize) * tileSize + x % tileSize);
+    return glm::vec3(p[0], p[1], p[2]) / 255.0f;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  What the texture cache has done since the program started
+//
+struct TextureCacheStats {
+    int textures = 0;
+    uint64_t tileReads = 0;         // tiles read from disk
+    uint64_t evictions = 0;         // tiles dropped to make room for another
+    uint64_t failedLoads = 0;       // reads that found every slot in use
+    size_t residentBytes = 0;       // tiles in memory
+    size_t budgetBytes = 0;
+};
+
+//  Image textures, paged in as tiles
+//
+//  Textures are read from tiled files: each mip level cut into tileSize x
+//  tileSize RGBA tiles, stored one after another.  open() converts an image
+//  (anything ofLoadImage reads) to one the first time it sees it, saved
+//  next to it as <image>.tiles, and from then on uses that; delete it if
+//  the image changes.  Converting is the only time a whole image is ever
+//  in memory.
+//
+//  Tiles live in a fixed number of slots - the memory budget - shared by
+//  every texture.  A tile is read from disk the first time a ray needs it,
+//  into a free slot or the least recently used one (CLOCK: a slot read
+//  since the hand last passed it gets another round).  So a scene can have
+//  many gigabytes of textures and render in the budget, as long as the
+//  tiles a frame actually touches fit.
+//
+//  Lookups are lock-free: every texture has a table of the slot each of
+//  its tiles is in, and a reader pins a slot with one atomic add and checks
+//  it still holds its tile before reading it.  Only misses take the lock,
+//  to evict a slot nobody has pinned and read into it.
+//
+//  There is one cache per process, shared by every renderer.
+//
+class TextureCache {
+public:
+    static TextureCache & shared();
+    
+    // Texture id for an image or tiles file (relative paths are in
+    // bin/data), converting an image the first time; -1 with an error
+    // logged if it can't be read.  Opening the same path again gives the
+    // same id.
+    //
+    int open(const string &path);
+    
+    // Set before anything is rendered with textures: the slots are
+    // allocated on the first tile read and never resized
+    //
+    void setBudget(size_t bytes);
+    size_t getBudget() const { return budget; }
+    
+    TextureCacheStats getStats();
+    
+    // Write image as a tiles file, false with an error logged on failure
+    //
+    static bool convert(const string &image, const string &tiles);
+    
+    static const int tileSize = 64;
+    static const size_t tileBytes = tileSize * tileSize * 4;
+
+private:
+    friend class TextureReader;
+    
+    struct Level {
+        int width, height;
+        int tilesX, tilesY;
+        int firstTile;          // in the file, and in slotOf
+    };
+    
+    struct Texture {
+        string path;            // the tiles file
+        vector<Level> levels;
+        glm::vec3 average;      // 0..1, what lookups return if a tile can't be loaded
+        unique_ptr<std::atomic<int32_t>[]> slotOf;      // by tile, -1 if it isn't loaded
+        std::ifstream file;     // only read with the lock held
+    };
+    
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> pins { 0 };               // readers, plus locked while it is being refilled
+        std::atomic<uint32_t> used { 0 };               // read since the clock hand last passed
+        std::atomic<uint64_t> owner { noOwner };        // texture << 32 | tile
+    };
+    
+    static const uint32_t locked = 0x80000000;
+    static const uint64_t noOwner = ~(uint64_t)0;
+    static const int maxTextures = 4096;
+    
+    TextureCache() { }
+    
+    const Texture & texture(int id) const { return *textures[id]; }
+    int acquire(int id, int tile);      // pinned slot holding the tile, -1 if none could be freed
+    void release(int slot) { slots[slot].pins.fetch_sub(1, std::memory_order_release); }
+    const unsigned char * tileData(int slot) const { return data.get() + slot * tileBytes; }
+    
+    bool pin(int slot, uint64_t owner);
+    int load(int id, int tile);
+    int evict();
+    bool readTiles(Texture &texture, const string &path);
+    
+    std::mutex mutex;           // guards opening, loading and evicting
+    std::map<string, int> ids;  // by the path open() was given
+    unique_ptr<Texture> textures[maxTextures];
+    int textureCount = 0;
+    
+    size_t budget = 256 << 20;
+    unique_ptr<Slot[]> slots;
+    unique_ptr<unsigned char[]> data;
+    int slotCount = 0;
+    int hand = 0;
+    TextureCacheStats stats;
+};
+
+//  One thread's access to the texture cache.  It keeps the last few tiles
+//  it read pinned, so texels read close together - most of a bilinear
+//  lookup, most of a pixel's samples - cost no atomics at all, and lets
+//  them go on release() or when it is destroyed.  A copy starts out
+//  holding nothing.
+//
+class TextureReader {
+public:
+    TextureReader() { }
+    TextureReader(const TextureReader &) { }
+    TextureReader & operator=(const TextureReader &) { release(); return *this; }
+    ~TextureReader() { release(); }
+    
+    // Filtered color (0..1) of texture at uv, which wraps around.  v runs
+    // up the image.  footprint is how much of the texture (in uv units) the
+    // lookup covers, for picking the mip levels blended between.
+    //
+    glm::vec3 sample(int texture, const glm::vec2 &uv, float footprint);
+    
+    void release();
+
+private:
+    glm::vec3 bilinear(int texture, int level, const glm::vec2 &uv);
+    glm::vec3 texel(int texture, int level, int x, int y);
+    
+    static const int heldTiles = 4;
+    struct Held {
+        uint64_t owner = TextureCache::noOwner;
+        int slot = -1;
+    };
+    Held held[heldTiles];
+    int next = 0;               // the one replaced next
+};
@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int nThreads) {
+    if (nThreads <= 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < nThreads; i++) workers.push_back(new Worker());
+    
+    // worker 0 is whichever thread calls parallelFor()
+    //
+    for (int i = 1; i < nThreads; i++) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        bQuit = true;
+    }
+    wakeWorkers.notify_all();
+    for (auto &t : threads) t.join();
+    for (auto w : workers) delete w;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)> &task) {
+    if (count <= 0) return;
+    std::lock_guard<std::mutex> serialize(jobLock);
+    
+    // Deal out contiguous runs of tasks so each worker starts on its own
+    // region of the image.
+    //
+    int n = size();
+    for (int w = 0; w < n; w++) {
+        int first = (int)((long)count * w / n);
+        int last = (int)((long)count * (w + 1) / n);
+        std::lock_guard<std::mutex> guard(workers[w]->lock);
+        for (int i = first; i < last; i++) workers[w]->tasks.push_back(i);
+    }
+    remaining = count;
+    
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        job = &task;
+        busyWorkers = n - 1;
+        jobId++;
+    }
+    wakeWorkers.notify_all();
+    
+    drain(0);
+    
+    // wait for the other workers to finish their last task and let go of
+    // the job, so the caller's task object can safely go out of scope
+    //
+    std::unique_lock<std::mutex> guard(stateLock);
+    jobDone.wait(guard, [this] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::workerLoop(int workerIndex) {
+    unsigned long lastJob = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(stateLock);
+            wakeWorkers.wait(guard, [&] { return bQuit || jobId != lastJob; });
+            if (bQuit) return;
+            lastJob = jobId;
+        }
+        drain(workerIndex);
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            busyWorkers--;
+        }
+        jobDone.notify_all();
+    }
+}
+
+void ThreadPool::drain(int workerIndex) {
+    int task;
+    while (remaining > 0 && popTask(workerIndex, task)) {
+        (*job)(task, workerIndex);
+        remaining--;
+    }
+}
+
+bool ThreadPool::popTask(int workerIndex, int &task) {
+    Worker *own = workers[workerIndex];
+    {
+        std::lock_guard<std::mutex> guard(own->lock);
+        if (!own->tasks.empty()) {
+            task = own->tasks.front();
+            own->tasks.pop_front();
+            return true;
+        }
+    }
+    
+    // out of local work - steal from the back of someone else's run
+    //
+    int n = size();
+    for (int k = 1; k < n; k++) {
+        Worker *victim = workers[(workerIndex + k) % n];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.back();
+            victim->tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
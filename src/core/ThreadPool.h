@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//  Work-stealing thread pool
+//
+//  parallelFor() hands out task indices in contiguous runs, one run per worker
+//  deque, so neighbouring tasks (tiles) stay on the same core.  A worker pops
+//  from the front of its own deque and, once that is empty, steals from the
+//  back of the others.  The calling thread takes part as worker 0, so a pool
+//  of size 1 runs everything inline on the caller.
+//
+class ThreadPool {
+public:
+    ThreadPool(int nThreads = 0);   // 0 = one worker per hardware thread
+    ~ThreadPool();
+    
+    int size() const { return (int)workers.size(); }
+    
+    // Runs task(index, workerIndex) for every index in [0, count) and
+    // blocks until all of them are done.  workerIndex is in [0, size()).
+    //
+    void parallelFor(int count, const std::function<void(int, int)> &task);
+    
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+    
+    void workerLoop(int workerIndex);
+    void drain(int workerIndex);
+    bool popTask(int workerIndex, int &task);
+    
+    std::vector<Worker *> workers;
+    std::vector<std::thread> threads;
+    
+    std::mutex jobLock;                 // serializes parallelFor() callers
+    std::mutex stateLock;
+    std::condition_variable wakeWorkers;
+    std::condition_variable jobDone;
+    const std::function<void(int, int)> *job = nullptr;
+    unsigned long jobId = 0;
+    std::atomic<int> remaining{0};
+    int busyWorkers = 0;
+    bool bQuit = false;
+};
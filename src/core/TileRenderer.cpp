@@ -0,0 +1,36 @@
+#include "TileRenderer.h"
+#include "Profiler.h"
+
+void TileRenderer::setThreads(int nThreads) {
+    pool.reset(new ThreadPool(nThreads));
+}
+
+void TileRenderer::render(FrameBuffer &frame, const std::function<glm::vec4(int, int, int)> &shade) {
+    render(frame, 1, [&](int i, int j, int count, int worker, glm::vec4 *samples) { samples[0] = shade(i, j, worker); });
+}
+
+void TileRenderer::render(FrameBuffer &frame, int spanWidth, const std::function<void(int, int, int, int, glm::vec4 *)> &shadeSpan) {
+    int width = frame.getWidth();
+    int height = frame.getHeight();
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    
+    pool->parallelFor(tilesX * tilesY, [&](int tile, int worker) {
+        if (cancel && *cancel) return;
+        PROFILE_SPAN("tile");
+        PROFILE_COUNT(COUNTER_TILES, 1);
+        int x0 = (tile % tilesX) * tileSize;
+        int y0 = (tile / tilesX) * tileSize;
+        int x1 = std::min(x0 + tileSize, width);
+        int y1 = std::min(y0 + tileSize, height);
+        vector<glm::vec4> samples(spanWidth);
+        
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i += spanWidth) {
+                int count = std::min(spanWidth, x1 - i);
+                shadeSpan(i, j, count, worker, samples.data());
+                for (int c = 0; c < count; c++) frame.add(i + c, j, samples[c]);
+            }
+        }
+    });
+}
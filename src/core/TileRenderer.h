@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ThreadPool.h"
+#include "FrameBuffer.h"
+
+//  Tile scheduler for the ray tracer
+//
+//  Splits the image into square tiles and shades them on a work-stealing
+//  thread pool, adding each pixel's samples straight into the frame buffer.
+//  Tiles never share a pixel, and a tile row is tileSize * 16 bytes, so with
+//  the default size the threads never share a cache line while shading.
+//  Every pixel is computed by the same shade() call no matter which thread
+//  or tile order produced it, so the output is bit-identical for any number
+//  of threads.
+//
+class TileRenderer {
+public:
+    TileRenderer(int nThreads = 0) { setThreads(nThreads); }
+    
+    void setThreads(int nThreads);     // 0 = one per hardware thread, 1 = single threaded
+    int getThreads() const { return pool->size(); }
+    ThreadPool & getPool() { return *pool; }
+    
+    // shade(i, j, worker) returns the samples for pixel column i, row j (row
+    // 0 at the top) - the sum of their colors in xyz, how many in w - which
+    // are added to frame.  worker is the index of the calling thread in
+    // [0, getThreads()).
+    //
+    void render(FrameBuffer &frame, const std::function<glm::vec4(int, int, int)> &shade);
+    
+    // Span version for shaders that work on several pixels at once (packet
+    // tracing): shadeSpan(i, j, count, worker, samples) fills samples[0..count)
+    // for pixels i .. i + count - 1 of row j, count <= spanWidth.  Spans
+    // never cross a tile edge.
+    //
+    void render(FrameBuffer &frame, int spanWidth, const std::function<void(int, int, int, int, glm::vec4 *)> &shadeSpan);
+    
+    int tileSize = 32;
+    
+    // if set, tiles not yet started are skipped once *cancel becomes true
+    //
+    const std::atomic<bool> *cancel = nullptr;
+    
+private:
+    std::unique_ptr<ThreadPool> pool;
+};
@@ -0,0 +1,384 @@
+#include "TriangleMesh.h"
+#include "MeshLoader.h"
+#include "Scene.h"
+
+#ifdef PACKET_SIMD_X86
+#include <immintrin.h>
+#endif
+
+static const float epsilon = std::numeric_limits<float>::epsilon();     // same as glm's intersect tests
+static const int stackSize = 128;
+
+//  A ray set up for the watertight test: the axis the ray mostly runs along
+//  becomes z, and the shear S maps the ray direction onto +z
+//
+struct WatertightRay {
+    WatertightRay(const Ray &ray) {
+        glm::vec3 a = glm::abs(ray.d);
+        kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (ray.d[kz] < 0) std::swap(kx, ky);      // keep the winding direction
+        Sx = ray.d[kx] / ray.d[kz];
+        Sy = ray.d[ky] / ray.d[kz];
+        Sz = 1.0f / ray.d[kz];
+        org = ray.p;
+    }
+    glm::vec3 org;
+    int kx, ky, kz;
+    float Sx, Sy, Sz;
+};
+
+// Closest hit in triangle slots [first, first + count) closer than tBest -
+// updates tBest and best (the slot)
+//
+typedef void (*TriangleKernel)(const WatertightRay &r, const TriangleArrays &tris, int first, int count, float &tBest, int &best);
+
+// Scalar watertight test of slot k, returning the unnormalized barycentrics
+// U, V, W (weights of corners a, b, c).  When an edge function comes out
+// exactly 0 the ray passes through an edge or vertex in float precision, so
+// it is recomputed in double to decide the hit consistently for neighbors.
+//
+static bool watertight(const WatertightRay &r, const TriangleArrays &tris, int k, float &t, float &U, float &V, float &W) {
+    glm::vec3 A = glm::vec3(tris.ax[k], tris.ay[k], tris.az[k]) - r.org;
+    glm::vec3 B = glm::vec3(tris.bx[k], tris.by[k], tris.bz[k]) - r.org;
+    glm::vec3 C = glm::vec3(tris.cx[k], tris.cy[k], tris.cz[k]) - r.org;
+    float Ax = A[r.kx] - r.Sx * A[r.kz];
+    float Ay = A[r.ky] - r.Sy * A[r.kz];
+    float Bx = B[r.kx] - r.Sx * B[r.kz];
+    float By = B[r.ky] - r.Sy * B[r.kz];
+    float Cx = C[r.kx] - r.Sx * C[r.kz];
+    float Cy = C[r.ky] - r.Sy * C[r.kz];
+    U = Cx * By - Cy * Bx;
+    V = Ax * Cy - Ay * Cx;
+    W = Bx * Ay - By * Ax;
+    if (U == 0 || V == 0 || W == 0) {
+        U = (float)((double)Cx * (double)By - (double)Cy * (double)Bx);
+        V = (float)((double)Ax * (double)Cy - (double)Ay * (double)Cx);
+        W = (float)((double)Bx * (double)Ay - (double)By * (double)Ax);
+    }
+    if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0)) return false;
+    float det = U + V + W;
+    if (det == 0) return false;
+    float T = U * (r.Sz * A[r.kz]) + V * (r.Sz * B[r.kz]) + W * (r.Sz * C[r.kz]);
+    t = T / det;
+    return t > epsilon;
+}
+
+static void trianglesScalar(const WatertightRay &r, const TriangleArrays &tris, int first, int count, float &tBest, int &best) {
+    for (int k = first; k < first + count; k++) {
+        float t, U, V, W;
+        if (watertight(r, tris, k, t, U, V, W) && t < tBest) {
+            tBest = t;
+            best = k;
+        }
+    }
+}
+
+#ifdef PACKET_SIMD_X86
+
+// Lanes whose edge functions hit exactly 0 go to the scalar test, which
+// redoes them in double
+//
+static inline void collectHits(const WatertightRay &r, const TriangleArrays &tris, int k, int hitMask, int edgeMask, const float *t, float &tBest, int &best) {
+    while (hitMask) {
+        int lane = __builtin_ctz(hitMask);
+        hitMask &= hitMask - 1;
+        if (t[lane] < tBest) {
+            tBest = t[lane];
+            best = k + lane;
+        }
+    }
+    while (edgeMask) {
+        int lane = __builtin_ctz(edgeMask);
+        edgeMask &= edgeMask - 1;
+        trianglesScalar(r, tris, k + lane, 1, tBest, best);
+    }
+}
+
+//  SSE4.1 - 4 triangles per register
+//
+__attribute__((target("sse4.1")))
+static void trianglesSSE(const WatertightRay &r, const TriangleArrays &tris, int first, int count, float &tBest, int &best) {
+    const float *a[3] = { tris.ax, tris.ay, tris.az };
+    const float *b[3] = { tris.bx, tris.by, tris.bz };
+    const float *c[3] = { tris.cx, tris.cy, tris.cz };
+    const __m128 zero = _mm_setzero_ps();
+    __m128 ox = _mm_set1_ps(r.org[r.kx]), oy = _mm_set1_ps(r.org[r.ky]), oz = _mm_set1_ps(r.org[r.kz]);
+    __m128 Sx = _mm_set1_ps(r.Sx), Sy = _mm_set1_ps(r.Sy), Sz = _mm_set1_ps(r.Sz);
+    alignas(16) float t[4];
+    for (int i = 0; i < count; i += 4) {
+        int k = first + i;
+        __m128 Az = _mm_sub_ps(_mm_loadu_ps(a[r.kz] + k), oz);
+        __m128 Bz = _mm_sub_ps(_mm_loadu_ps(b[r.kz] + k), oz);
+        __m128 Cz = _mm_sub_ps(_mm_loadu_ps(c[r.kz] + k), oz);
+        __m128 Ax = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(a[r.kx] + k), ox), _mm_mul_ps(Sx, Az));
+        __m128 Ay = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(a[r.ky] + k), oy), _mm_mul_ps(Sy, Az));
+        __m128 Bx = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(b[r.kx] + k), ox), _mm_mul_ps(Sx, Bz));
+        __m128 By = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(b[r.ky] + k), oy), _mm_mul_ps(Sy, Bz));
+        __m128 Cx = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(c[r.kx] + k), ox), _mm_mul_ps(Sx, Cz));
+        __m128 Cy = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(c[r.ky] + k), oy), _mm_mul_ps(Sy, Cz));
+        __m128 U = _mm_sub_ps(_mm_mul_ps(Cx, By), _mm_mul_ps(Cy, Bx));
+        __m128 V = _mm_sub_ps(_mm_mul_ps(Ax, Cy), _mm_mul_ps(Ay, Cx));
+        __m128 W = _mm_sub_ps(_mm_mul_ps(Bx, Ay), _mm_mul_ps(By, Ax));
+        __m128 edge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(U, zero), _mm_cmpeq_ps(V, zero)), _mm_cmpeq_ps(W, zero));
+        __m128 anyNeg = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero), _mm_cmplt_ps(V, zero)), _mm_cmplt_ps(W, zero));
+        __m128 anyPos = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_cmpgt_ps(V, zero)), _mm_cmpgt_ps(W, zero));
+        __m128 det = _mm_add_ps(_mm_add_ps(U, V), W);
+        __m128 T = _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, _mm_mul_ps(Sz, Az)), _mm_mul_ps(V, _mm_mul_ps(Sz, Bz))), _mm_mul_ps(W, _mm_mul_ps(Sz, Cz)));
+        __m128 dist = _mm_div_ps(T, det);
+        __m128 hit = _mm_andnot_ps(_mm_and_ps(anyNeg, anyPos), _mm_cmpneq_ps(det, zero));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(dist, _mm_set1_ps(epsilon)), _mm_cmplt_ps(dist, _mm_set1_ps(tBest))));
+        int lanes = (1 << std::min(4, count - i)) - 1;
+        int edgeMask = _mm_movemask_ps(edge) & lanes;
+        int hitMask = _mm_movemask_ps(hit) & lanes & ~edgeMask;
+        if (!(hitMask | edgeMask)) continue;
+        _mm_store_ps(t, dist);
+        collectHits(r, tris, k, hitMask, edgeMask, t, tBest, best);
+    }
+}
+
+//  AVX2 - a whole leaf of 8 triangles per register
+//
+__attribute__((target("avx2")))
+static void trianglesAVX2(const WatertightRay &r, const TriangleArrays &tris, int first, int count, float &tBest, int &best) {
+    const float *a[3] = { tris.ax, tris.ay, tris.az };
+    const float *b[3] = { tris.bx, tris.by, tris.bz };
+    const float *c[3] = { tris.cx, tris.cy, tris.cz };
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 ox = _mm256_set1_ps(r.org[r.kx]), oy = _mm256_set1_ps(r.org[r.ky]), oz = _mm256_set1_ps(r.org[r.kz]);
+    __m256 Sx = _mm256_set1_ps(r.Sx), Sy = _mm256_set1_ps(r.Sy), Sz = _mm256_set1_ps(r.Sz);
+    alignas(32) float t[8];
+    for (int i = 0; i < count; i += 8) {
+        int k = first + i;
+        __m256 Az = _mm256_sub_ps(_mm256_loadu_ps(a[r.kz] + k), oz);
+        __m256 Bz = _mm256_sub_ps(_mm256_loadu_ps(b[r.kz] + k), oz);
+        __m256 Cz = _mm256_sub_ps(_mm256_loadu_ps(c[r.kz] + k), oz);
+        __m256 Ax = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(a[r.kx] + k), ox), _mm256_mul_ps(Sx, Az));
+        __m256 Ay = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(a[r.ky] + k), oy), _mm256_mul_ps(Sy, Az));
+        __m256 Bx = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(b[r.kx] + k), ox), _mm256_mul_ps(Sx, Bz));
+        __m256 By = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(b[r.ky] + k), oy), _mm256_mul_ps(Sy, Bz));
+        __m256 Cx = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(c[r.kx] + k), ox), _mm256_mul_ps(Sx, Cz));
+        __m256 Cy = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(c[r.ky] + k), oy), _mm256_mul_ps(Sy, Cz));
+        __m256 U = _mm256_sub_ps(_mm256_mul_ps(Cx, By), _mm256_mul_ps(Cy, Bx));
+        __m256 V = _mm256_sub_ps(_mm256_mul_ps(Ax, Cy), _mm256_mul_ps(Ay, Cx));
+        __m256 W = _mm256_sub_ps(_mm256_mul_ps(Bx, Ay), _mm256_mul_ps(By, Ax));
+        __m256 edge = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_EQ_OQ), _mm256_cmp_ps(V, zero, _CMP_EQ_OQ)), _mm256_cmp_ps(W, zero, _CMP_EQ_OQ));
+        __m256 anyNeg = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_LT_OQ), _mm256_cmp_ps(V, zero, _CMP_LT_OQ)), _mm256_cmp_ps(W, zero, _CMP_LT_OQ));
+        __m256 anyPos = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_GT_OQ), _mm256_cmp_ps(V, zero, _CMP_GT_OQ)), _mm256_cmp_ps(W, zero, _CMP_GT_OQ));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(U, V), W);
+        __m256 T = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(U, _mm256_mul_ps(Sz, Az)), _mm256_mul_ps(V, _mm256_mul_ps(Sz, Bz))), _mm256_mul_ps(W, _mm256_mul_ps(Sz, Cz)));
+        __m256 dist = _mm256_div_ps(T, det);
+        __m256 hit = _mm256_andnot_ps(_mm256_and_ps(anyNeg, anyPos), _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(dist, _mm256_set1_ps(epsilon), _CMP_GT_OQ), _mm256_cmp_ps(dist, _mm256_set1_ps(tBest), _CMP_LT_OQ)));
+        int lanes = (1 << std::min(8, count - i)) - 1;
+        int edgeMask = _mm256_movemask_ps(edge) & lanes;
+        int hitMask = _mm256_movemask_ps(hit) & lanes & ~edgeMask;
+        if (!(hitMask | edgeMask)) continue;
+        _mm256_store_ps(t, dist);
+        collectHits(r, tris, k, hitMask, edgeMask, t, tBest, best);
+    }
+}
+
+#endif
+
+static TriangleKernel triangleKernel() {
+#ifdef PACKET_SIMD_X86
+    static TriangleKernel kernel = detectSimdLevel() >= SIMD_AVX2 ? trianglesAVX2 : (detectSimdLevel() == SIMD_SSE ? trianglesSSE : trianglesScalar);
+    return kernel;
+#else
+    return trianglesScalar;
+#endif
+}
+
+void TriangleArrays::set(const float *block, int triangles) {
+    size_t stride = triangles + padding;
+    const float **arrays[9] = { &ax, &ay, &az, &bx, &by, &bz, &cx, &cy, &cz };
+    for (int i = 0; i < 9; i++) *arrays[i] = block + i * stride;
+}
+
+bool TriangleMesh::load(const string &path) {
+    uint64_t start = ofGetElapsedTimeMicros();
+    MappedFile file;
+    if (!file.open(ofToDataPath(path))) {
+        ofLogError("TriangleMesh") << "can't open " << path;
+        return false;
+    }
+    string ext = ofToLower(ofFilePath::getFileExt(path));
+    string error;
+    bool ok;
+    if (ext == "obj") ok = loadOBJ(file.data(), file.size(), *this, error);
+    else if (ext == "ply") ok = loadPLY(file.data(), file.size(), *this, error);
+    else {
+        ok = false;
+        error = "unknown mesh format ." + ext + " (expected .obj or .ply)";
+    }
+    if (!ok) {
+        ofLogError("TriangleMesh") << path << ": " << error;
+        return false;
+    }
+    this->path = path;
+    build();
+    ofLogNotice("TriangleMesh") << path << ": " << triangleCount() << " triangles, " << vertexCount() << " vertices in "
+                                << (ofGetElapsedTimeMicros() - start) / 1000 << " ms";
+    return true;
+}
+
+void TriangleMesh::build() {
+    file.reset();
+    int n = indices.size() / 3;
+    vector<BVHBuildRef> refs(n);
+    AABB bounds;
+    for (int i = 0; i < n; i++) {
+        AABB b;
+        b.grow(vertices[indices[3 * i]]);
+        b.grow(vertices[indices[3 * i + 1]]);
+        b.grow(vertices[indices[3 * i + 2]]);
+        refs[i] = { b, b.center(), i };
+        bounds.grow(b);
+    }
+    nodes.clear();
+    order.clear();
+    buildBVH(refs, maxLeafSize, nodes, order);
+    
+    triangleBlock.assign(TriangleArrays::blockSize(n), 0);
+    size_t stride = n + TriangleArrays::padding;
+    for (int k = 0; k < n; k++) {
+        const uint32_t *tri = &indices[3 * order[k]];
+        const glm::vec3 *corner[3] = { &vertices[tri[0]], &vertices[tri[1]], &vertices[tri[2]] };
+        for (int i = 0; i < 9; i++) triangleBlock[i * stride + k] = (*corner[i / 3])[i % 3];
+    }
+    
+    arrays.vertices = vertices.data();
+    arrays.normals = normals.empty() ? nullptr : normals.data();
+    arrays.texcoords = texcoords.size() == vertices.size() && !texcoords.empty() ? texcoords.data() : nullptr;
+    arrays.indices = indices.data();
+    arrays.vertexCount = vertices.size();
+    arrays.triangleCount = n;
+    arrays.nodes = nodes.data();
+    arrays.nodeCount = nodes.size();
+    arrays.order = order.data();
+    arrays.triangles = triangleBlock.data();
+    arrays.bounds = bounds;
+    triangles.set(arrays.triangles, n);
+}
+
+void TriangleMesh::attach(shared_ptr<const MappedFile> file, const MeshArrays &arrays) {
+    vertices.clear();
+    normals.clear();
+    texcoords.clear();
+    indices.clear();
+    nodes.clear();
+    order.clear();
+    triangleBlock.clear();
+    this->file = file;
+    this->arrays = arrays;
+    triangles.set(arrays.triangles, arrays.triangleCount);
+}
+
+bool TriangleMesh::intersect(const Ray &ray, MeshHit &hit) const {
+    if (arrays.nodeCount == 0) return false;
+    const BVHNode *nodes = arrays.nodes;
+    TriangleKernel kernel = triangleKernel();
+    WatertightRay r(ray);
+    glm::vec3 invDir = 1.0f / ray.d;
+    float closest = std::numeric_limits<float>::infinity();
+    int best = -1;
+    
+    int stack[stackSize];
+    int top = 0;
+    int current = 0;
+    while (true) {
+        const BVHNode &node = nodes[current];
+        float tEntry;
+        if (intersectBox(node.min, node.max, ray.p, invDir, closest, tEntry)) {
+            if (node.count > 0) {
+                kernel(r, triangles, node.offset, node.count, closest, best);
+            }
+            else {
+                if (ray.d[node.axis] < 0) {
+                    stack[top++] = current + 1;
+                    current = node.offset;
+                }
+                else {
+                    stack[top++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (top == 0) break;
+        current = stack[--top];
+    }
+    if (best < 0) return false;
+    
+    // barycentrics for the winner only
+    //
+    float t, U, V, W;
+    watertight(r, triangles, best, t, U, V, W);
+    float det = U + V + W;
+    hit.t = closest;
+    hit.triangle = arrays.order[best];
+    hit.u = U / det;
+    hit.v = V / det;
+    hit.w = W / det;
+    return true;
+}
+
+bool TriangleMesh::occluded(const Ray &ray, float tMax) const {
+    if (arrays.nodeCount == 0) return false;
+    const BVHNode *nodes = arrays.nodes;
+    TriangleKernel kernel = triangleKernel();
+    WatertightRay r(ray);
+    glm::vec3 invDir = 1.0f / ray.d;
+    
+    int stack[stackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int current = stack[--top];
+        const BVHNode &node = nodes[current];
+        float tEntry;
+        if (!intersectBox(node.min, node.max, ray.p, invDir, tMax, tEntry)) continue;
+        if (node.count > 0) {
+            int best = -1;
+            kernel(r, triangles, node.offset, node.count, tMax, best);
+            if (best >= 0) return true;
+        }
+        else {
+            stack[top++] = node.offset;
+            stack[top++] = current + 1;
+        }
+    }
+    return false;
+}
+
+glm::vec3 TriangleMesh::getNormal(const MeshHit &hit) const {
+    const uint32_t *tri = &arrays.indices[3 * hit.triangle];
+    const glm::vec3 *vertices = arrays.vertices;
+    const glm::vec3 *normals = arrays.normals;
+    if (normals) {
+        glm::vec3 n = hit.u * normals[tri[0]] + hit.v * normals[tri[1]] + hit.w * normals[tri[2]];
+        float length = glm::length(n);
+        if (length > 0) return n / length;
+    }
+    return glm::normalize(glm::cross(vertices[tri[1]] - vertices[tri[0]], vertices[tri[2]] - vertices[tri[0]]));
+}
+
+bool TriangleMesh::getTexcoords(const MeshHit &hit, const glm::mat3 &toWorld, glm::vec2 &uv, float &uvScale) const {
+    const glm::vec2 *texcoords = arrays.texcoords;
+    if (!texcoords) return false;
+    const uint32_t *tri = &arrays.indices[3 * hit.triangle];
+    uv = hit.u * texcoords[tri[0]] + hit.v * texcoords[tri[1]] + hit.w * texcoords[tri[2]];
+    
+    // the square root of the ratio of the triangle's areas in texture and
+    // world space
+    //
+    const glm::vec3 *vertices = arrays.vertices;
+    glm::vec2 t1 = texcoords[tri[1]] - texcoords[tri[0]];
+    glm::vec2 t2 = texcoords[tri[2]] - texcoords[tri[0]];
+    float uvArea = fabs(t1.x * t2.y - t1.y * t2.x);
+    float worldArea = glm::length(glm::cross(toWorld * (vertices[tri[1]] - vertices[tri[0]]), toWorld * (vertices[tri[2]] - vertices[tri[0]])));
+    uvScale = worldArea > 0 ? sqrtf(uvArea / worldArea) : 0;
+    return true;
+}
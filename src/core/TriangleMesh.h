@@ -0,0 +1,116 @@
+#pragma once
+
+#include "ofMain.h"
+#include "BVH.h"
+
+class Ray;
+class MappedFile;
+
+//  Where a ray hit a triangle mesh
+//
+struct MeshHit {
+    float t;
+    int triangle;
+    float u, v, w;          // barycentric weights of the triangle's 3 corners
+};
+
+//  Triangle corners copied into a mesh BVH's leaf order, so the triangles
+//  of a leaf are contiguous for the SIMD test.  The 9 arrays are stored back
+//  to back in one block, each padded at the end so a vector load past the
+//  last triangle stays inside it.
+//
+struct TriangleArrays {
+    const float *ax, *ay, *az;
+    const float *bx, *by, *bz;
+    const float *cx, *cy, *cz;
+    
+    static const int padding = 8;       // widest SIMD test
+    static size_t blockSize(int triangles) { return 9 * ((size_t)triangles + padding); }
+    void set(const float *block, int triangles);
+};
+
+//  Everything a mesh traces from: its buffers plus its BVH, either in the
+//  mesh's own vectors or in a binary scene file it was loaded from (see
+//  SceneFile.h)
+//
+struct MeshArrays {
+    const glm::vec3 *vertices = nullptr;
+    const glm::vec3 *normals = nullptr;     // null if there are none
+    const glm::vec2 *texcoords = nullptr;   // null if there are none
+    const uint32_t *indices = nullptr;
+    int vertexCount = 0;
+    int triangleCount = 0;
+    const BVHNode *nodes = nullptr;
+    int nodeCount = 0;
+    const int *order = nullptr;             // triangleCount
+    const float *triangles = nullptr;       // TriangleArrays::blockSize(triangleCount)
+    AABB bounds;
+};
+
+//  Triangle mesh with indexed vertex, normal and texture coordinate buffers
+//
+//  Every mesh has its own BVH over its triangles, which sits under the
+//  scene BVH: the whole mesh is a single primitive up there.  Leaves hold
+//  up to maxLeafSize triangles, tested against the ray 4 (SSE4.1) or 8
+//  (AVX2) at a time.
+//
+//  Ray/triangle tests use the watertight algorithm of Woop, Benthin and
+//  Wald (JCGT 2013), so a ray through a shared edge or vertex always hits
+//  at least one of the triangles and meshes render without cracks.
+//
+//  A mesh loaded from a compiled scene file doesn't copy anything: attach()
+//  points it at the buffers and BVH in the mapped file, and its vertices,
+//  normals, texture coordinates and indices vectors stay empty.
+//
+class TriangleMesh {
+public:
+    TriangleMesh() { }
+    TriangleMesh(const TriangleMesh &) = delete;
+    TriangleMesh & operator=(const TriangleMesh &) = delete;
+    
+    // Load an OBJ or binary PLY file (memory mapped) and build the BVH.
+    // Relative paths are in bin/data.
+    //
+    bool load(const string &path);
+    
+    void build();           // (re)build the BVH after changing the buffers
+    
+    // Trace from arrays that were built earlier, in memory that file keeps
+    // mapped for as long as the mesh exists
+    //
+    void attach(shared_ptr<const MappedFile> file, const MeshArrays &arrays);
+    
+    const MeshArrays & getArrays() const { return arrays; }
+    int triangleCount() const { return arrays.triangleCount; }
+    int vertexCount() const { return arrays.vertexCount; }
+    const AABB & getBounds() const { return arrays.bounds; }
+    
+    bool intersect(const Ray &ray, MeshHit &hit) const;     // closest hit
+    bool occluded(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;    // any hit before tMax
+    glm::vec3 getNormal(const MeshHit &hit) const;            // interpolated vertex normal, or the face normal
+    
+    // Interpolated texture coordinates at hit, and how fast they change per
+    // unit of distance across the triangle once toWorld is applied to it
+    // (for picking a mip level).  False if the mesh has none.
+    //
+    bool getTexcoords(const MeshHit &hit, const glm::mat3 &toWorld, glm::vec2 &uv, float &uvScale) const;
+    
+    // The buffers the loaders fill in, traced after build()
+    //
+    vector<glm::vec3> vertices;
+    vector<glm::vec3> normals;      // per vertex, empty if the file had none
+    vector<glm::vec2> texcoords;    // per vertex, empty if the file had none
+    vector<uint32_t> indices;       // 3 per triangle
+    
+    string path;                    // file the mesh was loaded from, if any
+    int maxLeafSize = 8;
+
+private:
+    vector<BVHNode> nodes;
+    vector<int> order;              // triangle ids in leaf order
+    vector<float> triangleBlock;    // TriangleArrays storage
+    
+    MeshArrays arrays;              // what is traced, in the vectors above or in file
+    TriangleArrays triangles;       // by leaf slot
+    shared_ptr<const MappedFile> file;
+};
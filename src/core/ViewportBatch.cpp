@@ -0,0 +1,244 @@
+#include "ViewportBatch.h"
+#include "Scene.h"
+
+enum ProxyDetail { DETAIL_FULL, DETAIL_COARSE, DETAIL_POINT, DETAIL_COUNT };
+
+static const int fullSegments = 24;         // per ring of a sphere proxy
+static const int coarseSegments = 6;
+static const int planeLines = 5;            // each way
+static const int boxVertices = 24;
+
+static int ringVertices(int segments) { return 3 * 2 * segments; }
+
+// 3 rings around a sphere, in the xy, yz and zx planes
+//
+static void addRings(ofMesh &lines, const glm::vec3 &center, float radius, int segments, const ofFloatColor &color) {
+    for (int axis = 0; axis < 3; axis++) {
+        glm::vec3 u(0), v(0);
+        u[axis] = radius;
+        v[(axis + 1) % 3] = radius;
+        for (int i = 0; i < segments; i++) {
+            float a0 = TWO_PI * i / segments;
+            float a1 = TWO_PI * (i + 1) / segments;
+            lines.addVertex(center + cosf(a0) * u + sinf(a0) * v);
+            lines.addVertex(center + cosf(a1) * u + sinf(a1) * v);
+            lines.addColor(color);
+            lines.addColor(color);
+        }
+    }
+}
+
+// The 12 edges of an object space box, placed by transform
+//
+static void addBox(ofMesh &lines, const AABB &box, const glm::mat4 &transform, const ofFloatColor &color) {
+    glm::vec3 corners[8];
+    for (int c = 0; c < 8; c++) {
+        glm::vec3 p((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+        corners[c] = glm::vec3(transform * glm::vec4(p, 1));
+    }
+    for (int c = 0; c < 8; c++) {
+        for (int bit = 1; bit < 8; bit <<= 1) {
+            if (c & bit) continue;
+            lines.addVertex(corners[c]);
+            lines.addVertex(corners[c | bit]);
+            lines.addColor(color);
+            lines.addColor(color);
+        }
+    }
+}
+
+static void addMesh(ofMesh &surfaces, const MeshArrays &arrays, const glm::mat4 &transform, const ofFloatColor &color) {
+    uint32_t base = surfaces.getNumVertices();
+    for (int i = 0; i < arrays.vertexCount; i++) {
+        surfaces.addVertex(glm::vec3(transform * glm::vec4(arrays.vertices[i], 1)));
+        surfaces.addColor(color);
+    }
+    for (int i = 0; i < 3 * arrays.triangleCount; i++) surfaces.addIndex(base + arrays.indices[i]);
+}
+
+// What one object costs to draw, in vertices, at each level of detail
+//
+struct Proxy {
+    SceneObject *obj;
+    ofColor color;
+    int copies = 1;
+    size_t cost[DETAIL_COUNT];
+    int detail = DETAIL_FULL;
+};
+
+bool ViewportBatch::update(const Scene &scene, const SceneObject *selected) {
+    ObjectHandle handle = selected ? selected->handle : ObjectHandle();
+    if (built && scene.getVersion() == version && handle == this->selected) return false;
+    rebuild(scene, selected);
+    built = true;
+    version = scene.getVersion();
+    this->selected = handle;
+    return true;
+}
+
+void ViewportBatch::rebuild(const Scene &scene, const SceneObject *selected) {
+    uint64_t start = ofGetElapsedTimeMicros();
+    stats = ViewportStats();
+    surfaces.clear();
+    lines.clear();
+    points.clear();
+    surfaces.setMode(OF_PRIMITIVE_TRIANGLES);
+    lines.setMode(OF_PRIMITIVE_LINES);
+    points.setMode(OF_PRIMITIVE_POINTS);
+    others.clear();
+    
+    // cost every object at each level of detail
+    //
+    vector<Proxy> proxies;
+    proxies.reserve(scene.objects.size());
+    size_t total = 0;
+    for (SceneObject *obj : scene.objects) {
+        Proxy proxy;
+        proxy.obj = obj;
+        proxy.color = obj == selected ? ofColor::white : dynamic_cast<SpotLight *>(obj) ? ofColor::coral : obj->diffuseColor;
+        Mesh *mesh = dynamic_cast<Mesh *>(obj);
+        Instances *copies = dynamic_cast<Instances *>(obj);
+        if (dynamic_cast<Sphere *>(obj) || dynamic_cast<Light *>(obj)) {
+            proxy.cost[DETAIL_FULL] = ringVertices(fullSegments);
+            proxy.cost[DETAIL_COARSE] = ringVertices(coarseSegments);
+            proxy.cost[DETAIL_POINT] = 1;
+        }
+        else if (dynamic_cast<Plane *>(obj)) {
+            proxy.cost[DETAIL_FULL] = proxy.cost[DETAIL_COARSE] = proxy.cost[DETAIL_POINT] = 4 * planeLines;
+        }
+        else if ((mesh && mesh->mesh) || (copies && (copies->mesh || copies->spheres))) {
+            size_t each;
+            if (mesh) each = 3 * (size_t)mesh->mesh->getArrays().triangleCount;
+            else if (copies->mesh) each = 3 * (size_t)copies->mesh->getArrays().triangleCount;
+            else each = (size_t)ringVertices(coarseSegments) * copies->spheres->size();
+            proxy.copies = copies ? copies->transforms.size() : 1;
+            proxy.cost[DETAIL_FULL] = proxy.copies * each;
+            proxy.cost[DETAIL_COARSE] = proxy.copies * (size_t)boxVertices;
+            proxy.cost[DETAIL_POINT] = proxy.copies;
+        }
+        else {
+            others.push_back(make_pair(obj, proxy.color));
+            continue;
+        }
+        total += proxy.cost[DETAIL_FULL];
+        proxies.push_back(proxy);
+    }
+    
+    // over budget: coarsen the costliest objects first, so small ones keep
+    // their detail, then thin out the points
+    //
+    vector<int> order(proxies.size());
+    for (int i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return proxies[a].cost[DETAIL_FULL] > proxies[b].cost[DETAIL_FULL]; });
+    for (int detail = DETAIL_COARSE; detail < DETAIL_COUNT; detail++) {
+        for (int i = 0; i < order.size() && total > maxVertices; i++) {
+            Proxy &proxy = proxies[order[i]];
+            if (proxy.cost[detail] >= proxy.cost[proxy.detail]) continue;
+            total += proxy.cost[detail] - proxy.cost[proxy.detail];
+            proxy.detail = detail;
+        }
+    }
+    size_t pointCount = 0;
+    for (const Proxy &proxy : proxies) {
+        if (proxy.detail == DETAIL_POINT) pointCount += proxy.cost[DETAIL_POINT];
+    }
+    if (total > maxVertices && pointCount > 0) {
+        size_t room = std::max(maxVertices - std::min(maxVertices, total - pointCount), (size_t)1);
+        stats.pointStride = (pointCount + room - 1) / room;
+    }
+    
+    size_t nextPoint = 0;
+    auto addPoint = [&](const glm::vec3 &p, const ofFloatColor &color) {
+        if (nextPoint++ % stats.pointStride) return;
+        points.addVertex(p);
+        points.addColor(color);
+    };
+    
+    for (const Proxy &proxy : proxies) {
+        SceneObject *obj = proxy.obj;
+        ofFloatColor color = proxy.color;
+        if (proxy.detail == DETAIL_COARSE) stats.coarse++;
+        else if (proxy.detail == DETAIL_POINT) stats.points++;
+        
+        if (Plane *plane = dynamic_cast<Plane *>(obj)) {
+            // in the xz plane, like the ofPlanePrimitive it is otherwise drawn with
+            //
+            glm::vec3 u(plane->width / 2, 0, 0), v(0, 0, plane->height / 2);
+            for (int i = 0; i < planeLines; i++) {
+                float s = 2.0f * i / (planeLines - 1) - 1;
+                lines.addVertex(plane->position + s * u - v);
+                lines.addVertex(plane->position + s * u + v);
+                lines.addVertex(plane->position - u + s * v);
+                lines.addVertex(plane->position + u + s * v);
+                for (int k = 0; k < 4; k++) lines.addColor(color);
+            }
+            continue;
+        }
+        
+        Mesh *mesh = dynamic_cast<Mesh *>(obj);
+        Instances *copies = dynamic_cast<Instances *>(obj);
+        if (!mesh && !copies) {
+            float radius = dynamic_cast<Sphere *>(obj) ? static_cast<Sphere *>(obj)->radius : static_cast<Light *>(obj)->radius;
+            if (proxy.detail == DETAIL_POINT) addPoint(obj->position, color);
+            else addRings(lines, obj->position, radius, proxy.detail == DETAIL_FULL ? fullSegments : coarseSegments, color);
+            continue;
+        }
+        
+        const TriangleMesh *geometry = mesh ? mesh->mesh.get() : copies->mesh.get();
+        const SphereSet *spheres = copies ? copies->spheres.get() : nullptr;
+        AABB bounds = geometry ? geometry->getArrays().bounds : spheres->getBounds();
+        glm::vec3 center = bounds.center();
+        glm::mat4 transform = obj->getTransform();
+        for (int c = 0; c < proxy.copies; c++) {
+            glm::mat4 toWorld = copies ? transform * copies->transforms[c] : transform;
+            if (proxy.detail == DETAIL_POINT) addPoint(glm::vec3(toWorld * glm::vec4(center, 1)), color);
+            else if (proxy.detail == DETAIL_COARSE) addBox(lines, bounds, toWorld, color);
+            else if (geometry) addMesh(surfaces, geometry->getArrays(), toWorld, color);
+            else {
+                const SphereSetArrays &arrays = spheres->getArrays();
+                float scale = glm::length(glm::vec3(toWorld[0]));
+                for (int i = 0; i < arrays.count; i++) {
+                    const glm::vec4 &s = arrays.spheres[i];
+                    addRings(lines, glm::vec3(toWorld * glm::vec4(s.x, s.y, s.z, 1)), s.w * scale, coarseSegments, color);
+                }
+            }
+        }
+    }
+    
+    stats.vertices = surfaces.getNumVertices() + lines.getNumVertices() + points.getNumVertices();
+    stats.buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+}
+
+void ViewportBatch::draw() {
+    surfaces.draw();
+    lines.draw();
+    points.draw();
+    for (auto &other : others) {
+        ofSetColor(other.second);
+        other.first->draw();
+    }
+}
+
+// Lines between the pixels of a columns x rows image on the render camera's
+// view plane
+//
+void ViewportBatch::updateGrid(RenderCam &cam, int columns, int rows) {
+    ViewPlane &view = cam.view;
+    if (columns == gridColumns && rows == gridRows && view.min == gridMin && view.max == gridMax && view.position.z == gridZ) return;
+    gridColumns = columns;
+    gridRows = rows;
+    gridMin = view.min;
+    gridMax = view.max;
+    gridZ = view.position.z;
+    
+    grid.clear();
+    grid.setMode(OF_PRIMITIVE_LINES);
+    for (int x = 1; x < columns; x++) {
+        grid.addVertex(view.toWorld(x / (float)columns, 1));
+        grid.addVertex(view.toWorld(x / (float)columns, 0));
+    }
+    for (int y = 1; y < rows; y++) {
+        grid.addVertex(view.toWorld(0, y / (float)rows));
+        grid.addVertex(view.toWorld(1, y / (float)rows));
+    }
+}
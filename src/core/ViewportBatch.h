@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ObjectPool.h"
+
+class Scene;
+class SceneObject;
+class RenderCam;
+
+//  What the last rebuild of a ViewportBatch drew
+//
+struct ViewportStats {
+    size_t vertices = 0;        // in all three buffers
+    int coarse = 0;             // objects drawn as boxes or coarse rings
+    int points = 0;             // objects drawn as points
+    int pointStride = 1;        // only every n-th point is drawn
+    float buildMs = 0;
+};
+
+//  The editor viewport's drawing of the scene, batched
+//
+//  Drawing each object with its own immediate-mode calls costs a draw call
+//  per object per frame (and many more for a wireframe sphere or an
+//  instanced copy), which is what held the viewport to a few frames a
+//  second on big scenes before anything was traced.  update() bakes a proxy
+//  of every object into world space vertex buffers with per-vertex colors -
+//  mesh triangles in one, the lines of spheres, lights, planes and boxes in
+//  another, points in a third - and draw() sends each in a single call.
+//  The buffers are only rebuilt when the scene's version or the selection
+//  changed.  The render camera's pixel grid is one more line buffer,
+//  rebuilt when the view or image size changes.
+//
+//  Proxies have levels of detail, so the cost stays bounded however big the
+//  scene gets: when the full proxies would draw more than maxVertices, the
+//  costliest objects drop to boxes (spheres to coarse rings), then to a
+//  point per copy, and if the points alone are still too many only every
+//  n-th one is drawn.
+//
+//  Object types it doesn't know are still drawn with their own draw().
+//
+class ViewportBatch {
+public:
+    bool update(const Scene &scene, const SceneObject *selected);     // true if it rebuilt
+    void draw();
+    
+    void updateGrid(RenderCam &cam, int columns, int rows);
+    void drawGrid() { grid.draw(); }
+    
+    const ViewportStats & getStats() const { return stats; }
+    
+    size_t maxVertices = 2000000;
+
+private:
+    void rebuild(const Scene &scene, const SceneObject *selected);
+    
+    ofVboMesh surfaces;         // triangles
+    ofVboMesh lines;
+    ofVboMesh points;
+    vector<pair<SceneObject *, ofColor>> others;
+    
+    bool built = false;
+    unsigned long version = 0;
+    ObjectHandle selected;
+    ViewportStats stats;
+    
+    ofVboMesh grid;
+    glm::vec2 gridMin, gridMax;
+    float gridZ = 0;
+    int gridColumns = -1;
+    int gridRows = -1;
+};
@@ -1,60 +1,5 @@
 #include "ofApp.h"
 
-bool SpotLight::isIlluminated(glm::vec3 lightDirection, int angle) {
-    
-    glm::vec3 spotDirection = glm::normalize(direction);
-    float pointAngle = glm::dot(spotDirection, -lightDirection);
-    if (pointAngle >= glm::radians((float)angle)) return true;
-    return false;
-}
-
-// Intersect Ray with Plane  (wrapper on glm::intersect*
-//
-bool Plane::intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normalAtIntersect) {
-    float dist;
-    bool hit = glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist);
-    if (hit) {
-        Ray r = ray;
-        point = r.evalPoint(dist);
-        normalAtIntersect = this->normal;
-    }
-    return (hit);
-}
-
-
-// Convert (u, v) to (x, y, z)
-// We assume u,v is in [0, 1]
-//
-glm::vec3 ViewPlane::toWorld(float u, float v) {
-    float w = width();
-    float h = height();
-    return (glm::vec3((u * w) + min.x, (v * h) + min.y, position.z));
-}
-
-// Get a ray from the current camera position to the (u, v) position on
-// the ViewPlane
-//
-Ray RenderCam::getRay(float u, float v) {
-    glm::vec3 pointOnPlane = view.toWorld(u, v);
-    return(Ray(position, glm::normalize(pointOnPlane - position)));
-}
-
-// This could be drawn a lot simpler but I wanted to use the getRay call
-// to test it at the corners.
-//
-void RenderCam::drawFrustum() {
-    view.draw();
-    Ray r1 = getRay(0, 0);
-    Ray r2 = getRay(0, 1);
-    Ray r3 = getRay(1, 1);
-    Ray r4 = getRay(1, 0);
-    float dist = glm::length((view.toWorld(0, 0) - position));
-    r1.draw(dist);
-    r2.draw(dist);
-    r3.draw(dist);
-    r4.draw(dist);
-}
-
 //--------------------------------------------------------------
 void ofApp::setup(){
     
@@ -64,6 +9,13 @@ void ofApp::setup(){
     gui.add(lightIntensity.setup("Light Intensity: ", 0.8, 0, 5));
     gui.add(phongExponent.setup("Phong Exponent: ", 50, 10, 1000));
     gui.add(spotlightAngle.setup("Spotlight Angle: ", 50, 1, 89));
+    gui.add(lightSamples.setup("Light Samples (0 = all): ", 0, 0, 32));
+    gui.add(maxDepth.setup("Reflection Depth: ", 5, 0, maxRayDepth));
+    if (Profiler::isEnabled()) {
+        profileGroup.setup("Profile (ms per second)");
+        for (int s = 0; s < STAGE_COUNT; s++) profileGroup.add(profileLabels[s].setup(ProfileStats::stageName(s), "-"));
+        gui.add(&profileGroup);
+    }
     
     ofSetBackgroundColor(ofColor::black);
     mainCam.setDistance(30);
@@ -73,75 +25,53 @@ void ofApp::setup(){
     previewCam.setPosition(glm::vec3(0, 0, 10));
     theCam = &mainCam;
     
-    Light * light1 = new PointLight(glm::vec3(4, 6, 4), lightIntensity, ofColor::white);
-    Light * light2 = new PointLight(glm::vec3(-4, 6, 4), lightIntensity, ofColor::white);
-    Light * spotlight = new SpotLight(glm::vec3(0, 6, 3), lightIntensity, glm::vec3(0, -1, -.5), spotlightAngle, ofColor::white);
-    
-    scene.push_back(new Sphere(glm::vec3(-1, 0, 0), 2.0, ofColor::blue));
-    scene.push_back(new Sphere(glm::vec3(1, 0, -4), 2.0, ofColor::lightGreen));
-    scene.push_back(new Sphere(glm::vec3(0, 0, 2), 1.0, ofColor::red));
-    scene.push_back(new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray));
-    scene.push_back(light1);
-    scene.push_back(light2);
-//    scene.push_back(spotlight);
-    
-    lights.push_back(light1);
-    lights.push_back(light2);
-//    lights.push_back(spotlight);
-    
-    // RED, BLUE, AND GREEN SPHERES ANIMATED
+    // default scene - RED, BLUE, AND GREEN SPHERES ANIMATED
+    scene.setupDefault(lightIntensity, spotlightAngle);
     ofSetFrameRate(60);
-    key1 = glm::vec3(-8, 0, -8);
-    key2 = glm::vec3(-1, 0, 0);
-
-    key3 = glm::vec3(8, 0, -8);
-    key4 = glm::vec3(1, 0, -4);
-
-    key5 = glm::vec3(0, 8, 2);
-    key6 = glm::vec3(0, 0, 2);
 }
 
 //--------------------------------------------------------------
 void ofApp::update(){
     
+    // the Light Intensity slider sets every light's intensity
+    //
+    if (lightIntensity != appliedLightIntensity) {
+        appliedLightIntensity = lightIntensity;
+        for (Light * light : scene.lights) light->intensity = appliedLightIntensity;
+        scene.markChanged();
+    }
+    
     if (bPlayback) {
         currentFrame++;
-        if (currentFrame > frameMax) currentFrame = frameMin;
+        if (currentFrame > scene.frameMax) currentFrame = scene.frameMin;
         // RED, BLUE, AND GREEN SPHERES ANIMATED
-        scene[0]->position = easeInOutAnimation(key1, key2);
-        scene[1]->position = easeInOutAnimation(key3, key4);
-        scene[2]->position = linearAnimation(key5, key6);
+        scene.setFrame(currentFrame);
         render();
+        
+        const BVHStats &stats = renderer.bvh.getStats();
+        ofLogVerbose("ofApp") << "frame " << currentFrame << " BVH refit " << stats.refitMs << "ms, rebuild " << stats.rebuildMs
+                              << "ms, SAH cost ratio " << stats.costRatio << ", " << renderer.getStats().samplesPerPixel << " samples/pixel";
     }
-}
-
-glm::vec3 ofApp::linearAnimation(glm::vec3 key1, glm::vec3 key2) {
-    float changeX = key2.x - key1.x;
-    float changeY = key2.y - key1.y;
-    float changeZ = key2.z - key1.z;
-    return glm::vec3(changeX * ((float)currentFrame/frameMax) + key1.x,
-                     changeY * ((float)currentFrame/frameMax) + key1.y,
-                     changeZ * ((float)currentFrame/frameMax) + key1.z);
-}
-
-glm::vec3 ofApp::easeInOutAnimation(glm::vec3 key1, glm::vec3 key2) {
-    float changeX = (key2.x - key1.x) / 2;
-    float changeY = (key2.y - key1.y) / 2;
-    float changeZ = (key2.z - key1.z) / 2;
-    float temp = currentFrame;
-    temp /= frameMax/2;
-    if (temp < 1) {
-        return glm::vec3((float)(changeX * temp * temp + key1.x),
-                         (float)(changeY * temp * temp + key1.y),
-                         (float)(changeZ * temp * temp + key1.z));
+    
+    if (bSequence && sequence.isDone()) {
+        bSequence = false;
+        bool ok = sequence.wait();
+        const SequenceStats &stats = sequence.getStats();
+        ofLogNotice("ofApp") << "sequence " << (ok ? "done: " : "stopped: ") << stats.frames << " frames, " << stats.framesInFlight
+                             << " at a time, " << (stats.frames > 0 ? stats.wallMs / stats.frames : 0) << "ms/frame";
+    }
+    
+    if (Profiler::isEnabled()) updateProfile();
+    
+    // show the preview renderer's latest stage, and save it once fully refined
+    //
+    int stage;
+    if (preview.getLatest(previewPixels, stage)) {
+        image.setFromPixels(previewPixels);
+        if (preview.isFinalStage(stage)) writer.write(std::move(previewPixels), "finalSpotlight." + outputExt);
     }
-    temp--;
-    return glm::vec3((float)(-changeX * (temp * (temp - 2) - 1) + key1.x),
-                     (float)(-changeY * (temp * (temp - 2) - 1) + key1.y),
-                     (float)(-changeZ * (temp * (temp - 2) - 1) + key1.z));
 }
 
-
 //--------------------------------------------------------------
 void ofApp::draw(){
     
@@ -151,142 +81,103 @@ void ofApp::draw(){
     
     ofNoFill();
     
-    for (int i = 0; i < scene.size(); i++) {
-        SceneObject * obj = scene[i];
-        if (objSelected() && obj == selected[0]) ofSetColor(ofColor::white);
-        else ofSetColor(obj->diffuseColor);
-        obj->draw();
+    if (viewport.update(scene, objSelected() ? selected[0] : nullptr)) {
+        const ViewportStats &stats = viewport.getStats();
+        ofLogVerbose("ofApp") << "viewport rebuilt in " << stats.buildMs << "ms: " << stats.vertices << " vertices, " << stats.coarse
+                              << " coarse and " << stats.points << " point proxies (every " << stats.pointStride << ")";
     }
+    viewport.draw();
     
     ofSetColor(ofColor::lightSkyBlue);
-    renderCam.drawFrustum();
+    scene.renderCam.drawFrustum();
     
     ofSetColor(ofColor::white);
-    renderCam.draw();
-     render();
+    scene.renderCam.draw();
+    if (needsRender()) {
+        if (bProgressive && !bPlayback) startPreview();
+        else render();
+    }
     
     if (bShowGrid) { drawGrid(); }
     if (bShowImage) {
-        image.draw(renderCam.view.toWorld(0, 0).x, renderCam.view.toWorld(0, 0).y, renderCam.view.toWorld(0, 0).z, renderCam.view.width(), renderCam.view.height());
+        image.draw(scene.renderCam.view.toWorld(0, 0).x, scene.renderCam.view.toWorld(0, 0).y, scene.renderCam.view.toWorld(0, 0).z, scene.renderCam.view.width(), scene.renderCam.view.height());
     }
     
     theCam->end();
-    
+
 }
 
-void ofApp::render(){
-    // Set width and height of the image based on the aspect ratio
-    image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
-    
-    for (float i = 0; i < image.getWidth(); i++) {
-        for (float j = 0; j < image.getHeight(); j++) {
-            float iNudge = i + 0.5f;
-            float jNudge = j + 0.5f;
-            
-            float u = iNudge / image.getWidth();
-            float v = (image.getHeight() - jNudge) / image.getHeight();
-            
-            // ANTI-ALIASING METHOD
-            // Use a 2x2 grid for anti aliasing
-            int nSquares = 2;
-            ofColor colorSum = ofColor::black;
-            for (float x = -(nSquares - 1.0f) / 2.0f; x <= (nSquares - 1.0f) / 2.0f; x++) {
-                for (float y = -(nSquares - 1.0f) / 2.0f; y <= (nSquares - 1.0f) / 2.0f; y++) {
-                    // cout << u << x << image.getWidth() << endl;
-                    float uTemp = u + (x / (image.getWidth() * nSquares));
-                    float vTemp = v + (y / (image.getHeight() * nSquares));
-                    // cout << "(" << uTemp << ", " << vTemp << ")" << endl;
-                    Ray currentRay = renderCam.getRay(uTemp, vTemp);
-                    // currentRay.draw(150);
-                    colorSum += (rayTrace(currentRay) / (nSquares * nSquares));
-                }
-            }
-            // colorSum = colorSum / (nSquares * nSquares);
-            image.setColor(i, j, colorSum);
-            
-            // ALIASING METHOD
-//            Ray currentRay = renderCam.getRay(u, v);
-//            ofColor colorToDraw = rayTrace(currentRay); // default black for when it does not hit
-//            image.setColor(i, j, colorToDraw);
-        }
-    }
-    image.update();
-    // string fileName = "spotlight" + to_string(currentFrame) + ".jpg";
-    // cout << fileName << endl;
-    string fileName = "finalSpotlight.jpg";
-    image.save(fileName, OF_IMAGE_QUALITY_HIGH);
-    
+// True if the scene, render camera, sliders or image size changed since the
+// last render() or startPreview() - otherwise the image is still valid
+//
+bool ofApp::needsRender() {
+    if (!bRendered) return true;
+    return scene.getVersion() != renderedVersion || renderSettings() != renderedSettings ||
+           !scene.renderCam.sameView(renderedCam) ||
+           renderedWidth != imageWidth || renderedHeight != imageHeight;
 }
 
-ofColor ofApp::rayTrace(const Ray &ray) {
-    ofColor colorToDraw = ofColor::black; // default black for when it does not hit
-    float closestObjDistance = std::numeric_limits<float>::infinity();
-    glm::vec3 pt, normal;
-    for (int i = 0; i < scene.size(); i++) {
-        SceneObject* obj = scene[i];
-        bool hit = obj->intersect(ray, pt, normal);
-        if (hit) {
-            float distance = glm::length(pt - renderCam.position);
-            if (distance < closestObjDistance) {
-                closestObjDistance = distance;
-                colorToDraw = scene[i]->diffuseColor;
-                colorToDraw = ambient(colorToDraw, ambientPercent) + phong(pt, normal, colorToDraw, scene[i]->specularColor, phongExponent);
-            }
-        }
-    }
-    return colorToDraw;
+// Remember what the image is being rendered from, so needsRender() can skip
+// identical frames
+//
+void ofApp::markRendered() {
+    bRendered = true;
+    renderedVersion = scene.getVersion();
+    renderedSettings = renderSettings();
+    renderedCam = scene.renderCam;
+    renderedWidth = imageWidth;
+    renderedHeight = imageHeight;
 }
 
-bool ofApp::inShadow (const Ray &ray) {
-    glm::vec3 pt, normal;
-    for (int i = 0; i < scene.size(); i++) {
-        if (scene[i]->intersect(ray, pt, normal) && !scene[i]->isLight) return true;
-    }
-    return false;
+// Hand the current scene to the background preview renderer, update() shows
+// its stages as they come in
+//
+void ofApp::startPreview() {
+    markRendered();
+    preview.restart(scene, renderedSettings, imageWidth, imageHeight);
 }
 
-void ofApp::drawGrid() {
-    for (int x = 1; x < image.getWidth(); x++) {
-        glm::vec3 firstPoint = renderCam.view.toWorld(x / image.getWidth(), renderCam.view.max.y);
-        glm::vec3 secondPoint = renderCam.view.toWorld(x / image.getWidth(), renderCam.view.min.y);
-        ofDrawLine(firstPoint, secondPoint);
-    }
-    for (int y = 1; y < image.getHeight(); y++) {
-        glm::vec3 firstPoint = renderCam.view.toWorld(renderCam.view.min.x, y / image.getHeight());
-        glm::vec3 secondPoint = renderCam.view.toWorld(renderCam.view.max.x, y / image.getHeight());
-        ofDrawLine(firstPoint, secondPoint);
-    }
+void ofApp::render(){
+    // a full render supersedes whatever the preview is still working on
+    //
+    preview.cancel();
+    
+    markRendered();
+    
+    // Shade into a buffer recycled from an earlier written frame, show it,
+    // then hand it to the writer threads so it's encoded and saved while the
+    // next frame is traced.  Playback writes a numbered sequence.
+    //
+    ofPixels frame = writer.recycle(imageWidth, imageHeight);
+    renderer.render(scene, renderedSettings, frame);
+    image.setFromPixels(frame);
+    
+    if (bPlayback) writer.writeFrame(std::move(frame), "spotlight", currentFrame, outputExt);
+    else writer.write(std::move(frame), "finalSpotlight." + outputExt);
 }
 
-ofColor ofApp::ambient(const ofColor diffuse, float percentage) {
-    return diffuse * percentage;
+// Current slider values for the renderer
+//
+RenderSettings ofApp::renderSettings() {
+    RenderSettings settings;
+    settings.ambientPercent = ambientPercent;
+    settings.lightIntensity = lightIntensity;
+    settings.phongExponent = phongExponent;
+    settings.spotlightAngle = spotlightAngle;
+    settings.adaptive = bAdaptive;
+    settings.lightSamples = lightSamples;
+    settings.maxDepth = maxDepth;
+    return settings;
 }
 
-ofColor ofApp::phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power) {
-    ofColor diffusedColor = ofColor::black;
-    for (int i = 0; i < lights.size(); i++) {
-        Light * light = lights[i];
-        glm::vec3 v = glm::normalize(renderCam.position - p);
-        glm::vec3 l = glm::normalize(light->position - p);
-        float epsilon = 0.001;
-        glm::vec3 epsilonDistance = p + epsilon * l;
-        Ray lightRay = Ray(epsilonDistance, l);
-        
-        // Check whether the point is in shadow or not and if it's illuminated by the type of light
-        if (!inShadow(lightRay) && light->isIlluminated(l, spotlightAngle)) {
-            // Solve for the bisector
-            glm::vec3 b = (v + l) / glm::length(v + l);
-            ofColor lambert = max(float(0.0), glm::dot(norm, l)) * lightIntensity * diffuse;
-            ofColor phong = specular * lightIntensity * glm::pow(glm::dot(norm, b), power);
-            diffusedColor += phong + lambert;
-        }
-    }
-    return diffusedColor;
+void ofApp::drawGrid() {
+    viewport.updateGrid(scene.renderCam, image.getWidth(), image.getHeight());
+    viewport.drawGrid();
 }
 
 //--------------------------------------------------------------
 void ofApp::keyPressed(int key){
-    
+
 }
 
 //--------------------------------------------------------------
@@ -312,6 +203,63 @@ void ofApp::keyReleased(int key){
         case 'l':
             addLight();
             break;
+        case 'P':
+        case 'p':
+            bProgressive = !bProgressive;
+            break;
+        case 'A':
+        case 'a':
+            bAdaptive = !bAdaptive;
+            ofLogNotice("ofApp") << "adaptive anti-aliasing " << (bAdaptive ? "on" : "off");
+            break;
+        case 'O':
+        case 'o':
+            // cycle the output format: jpg, lossless png, raw ppm
+            outputExt = outputExt == "jpg" ? "png" : outputExt == "png" ? "ppm" : "jpg";
+            ofLogNotice("ofApp") << "writing ." << outputExt << " images";
+            break;
+        case 'E':
+        case 'e':
+            // save the scene, as text and compiled
+            scene.save("scene.scene");
+            scene.save("scene.scenebin");
+            break;
+        case 'V':
+        case 'v':
+            // render the animation offline, picking up after frames already saved
+            if (bSequence) sequence.cancel();
+            else {
+                sequence.bResume = true;
+                sequence.start(scene, renderSettings(), imageWidth, imageHeight, scene.frameMin, scene.frameMax, "spotlight", outputExt);
+                bSequence = true;
+                ofLogNotice("ofApp") << "rendering frames " << scene.frameMin << " to " << scene.frameMax;
+            }
+            break;
+        case 'M':
+        case 'm':
+            // cycle the selected object's material: plain, mirror, glass
+            if (objSelected() && !selected[0]->isLight) {
+                SceneObject *obj = selected[0];
+                if (obj->transparency > 0) {
+                    obj->transparency = 0;
+                    ofLogNotice("ofApp") << "plain";
+                }
+                else if (obj->reflectivity > 0) {
+                    obj->reflectivity = 0;
+                    obj->transparency = 0.9;
+                    ofLogNotice("ofApp") << "glass";
+                }
+                else {
+                    obj->reflectivity = 0.8;
+                    ofLogNotice("ofApp") << "mirror";
+                }
+                scene.markChanged();
+            }
+            break;
+        case 'N':
+        case 'n':
+            if (objSelected()) scatterInstances(selected[0]);
+            break;
         case 'f':
             ofToggleFullscreen();
             break;
@@ -348,33 +296,77 @@ void ofApp::keyReleased(int key){
         case 'r':
             render();
             break;
+        case 'T':
+        case 't':
+            // save what was traced since the last save
+            if (Profiler::writeChromeTrace("trace.json")) {
+                ofLogNotice("ofApp") << "saved trace.json";
+                Profiler::reset();
+                lastProfile = ProfileStats();
+            }
+            break;
+    }
+}
+
+// Time spent in each stage over the last second, summed over the render
+// threads, and its share of the total
+//
+void ofApp::updateProfile() {
+    uint64_t now = ofGetElapsedTimeMillis();
+    if (now - lastProfileTime < 1000) return;
+    ProfileStats stats = Profiler::getStats();
+    ProfileStats second = stats - lastProfile;
+    double seconds = (now - lastProfileTime) / 1000.0;
+    double total = std::max(second.totalMs(), 1e-6);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        profileLabels[s] = ofToString(second.ms[s] / seconds, 1) + " (" + ofToString(100 * second.ms[s] / total, 0) + "%)";
     }
+    lastProfile = stats;
+    lastProfileTime = now;
 }
 
 void ofApp::addSphere() {
-    SceneObject * sphere = new Sphere(glm::vec3(0, 0, 0), ofRandom(0.5, 2.5), ofColor(ofRandom(0, 255), ofRandom(0, 255), ofRandom(0, 255)));
-    sphere->index = scene.size();
-    scene.push_back(sphere);
+    scene.add<Sphere>(glm::vec3(0, 0, 0), ofRandom(0.5, 2.5), ofColor(ofRandom(0, 255), ofRandom(0, 255), ofRandom(0, 255)));
 }
 
 void ofApp::deleteSphere(SceneObject * obj) {
-    if (obj->isLight) lights.erase(lights.begin() + lights.size() - 1);
-    scene.erase(scene.begin() + obj->index);
-    for (int i = obj->index; i <= scene.size() - 1; i++) {
-        scene[i]->index--;
-    }
+    selected.clear();
+    scene.remove(obj);
 }
 
 void ofApp::addLight() {
-    Light * light = new PointLight(glm::vec3(0, 6, 0), lightIntensity, ofColor::white);
-    light->index = scene.size();
-    scene.push_back(light);
-    lights.push_back(light);
+    scene.add<PointLight>(glm::vec3(0, 6, 0), lightIntensity, ofColor::white);
+}
+
+// Load a triangle mesh and add it centered on the origin, like new spheres
+//
+void ofApp::addMesh(const string &path) {
+    shared_ptr<TriangleMesh> mesh = make_shared<TriangleMesh>();
+    if (!mesh->load(path)) return;
+    scene.add<Mesh>(mesh, -mesh->getBounds().center(), ofColor(ofRandom(0, 255), ofRandom(0, 255), ofRandom(0, 255)));
+}
+
+// Add 100 copies of the selected mesh (or of the selected instances'
+// geometry) scattered over the floor, turned and sized at random - one
+// Instances object that shares the geometry
+//
+void ofApp::scatterInstances(SceneObject * obj) {
+    Instances *copies;
+    if (Mesh *mesh = dynamic_cast<Mesh *>(obj)) copies = scene.add<Instances>(mesh->mesh, obj->diffuseColor);
+    else if (Instances *instances = dynamic_cast<Instances *>(obj)) {
+        copies = instances->spheres ? scene.add<Instances>(instances->spheres, obj->diffuseColor) : scene.add<Instances>(instances->mesh, obj->diffuseColor);
+    }
+    else return;
+    for (int i = 0; i < 100; i++) {
+        glm::vec3 position(ofRandom(-10, 10), -2, ofRandom(-15, 5));
+        copies->add(makeTransform(position, glm::vec3(0, ofRandom(0, 360), 0), ofRandom(0.3, 1.0)));
+    }
+    scene.markChanged();
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseMoved(int x, int y ){
-    
+
 }
 
 //--------------------------------------------------------------
@@ -395,9 +387,10 @@ void ofApp::mouseDragged(int x, int y, int button){
         else {
             selected[0]->position += (point - lastPoint);
         }
+        scene.markMoved();
         lastPoint = point;
     }
-    
+
 }
 
 bool ofApp::mouseToDragPlane(int x, int y, glm::vec3 &point) {
@@ -440,14 +433,14 @@ void ofApp::mousePressed(int x, int y, int button){
     
     // check for selection of scene objects
     //
-    for (int i = 0; i < scene.size(); i++) {
+    for (int i = 0; i < scene.objects.size(); i++) {
         
         glm::vec3 point, norm;
         
         //  We hit an object
         //
-        if (scene[i]->intersect(Ray(p, dn), point, norm) && scene[i]->isSelectable) {
-            hits.push_back(scene[i]);
+        if (scene.objects[i]->intersect(Ray(p, dn), point, norm) && scene.objects[i]->isSelectable) {
+            hits.push_back(scene.objects[i]);
         }
     }
     
@@ -478,30 +471,42 @@ void ofApp::mousePressed(int x, int y, int button){
 
 //--------------------------------------------------------------
 void ofApp::mouseReleased(int x, int y, int button){
-    
+
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseEntered(int x, int y){
-    
+
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseExited(int x, int y){
-    
+
 }
 
 //--------------------------------------------------------------
 void ofApp::windowResized(int w, int h){
-    
+
 }
 
 //--------------------------------------------------------------
 void ofApp::gotMessage(ofMessage msg){
-    
+
 }
 
 //--------------------------------------------------------------
 void ofApp::dragEvent(ofDragInfo dragInfo){
-    
+    // drop .obj or .ply files on the window to add them to the scene, or a
+    // scene file (.scene text or compiled) to replace it
+    //
+    for (const string &path : dragInfo.files) {
+        string ext = ofToLower(ofFilePath::getFileExt(path));
+        if (ext == "obj" || ext == "ply") {
+            addMesh(path);
+        }
+        else if (scene.load(path)) {
+            selected.clear();
+            currentFrame = scene.frameMin;
+        }
+    }
 }
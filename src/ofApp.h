@@ -2,204 +2,13 @@
 
 #include "ofMain.h"
 #include "ofxGui.h"
-
-//  General Purpose Ray class
-//
-class Ray {
-public:
-    Ray(glm::vec3 p, glm::vec3 d) { this->p = p; this->d = d; }
-    void draw(float t) { ofDrawLine(p, p + t * d); }
-    
-    glm::vec3 evalPoint(float t) {
-        return (p + t * d);
-    }
-    
-    glm::vec3 p, d;
-};
-
-//  Base class for any renderable object in the scene
-//
-class SceneObject {
-public:
-    virtual void draw() = 0;    // pure virtual funcs - must be overloaded
-    virtual bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { cout << "SceneObject::intersect" << endl; return false; }
-    
-    // any data common to all scene objects goes here
-    glm::vec3 position = glm::vec3(0, 0, 0);   // translate
-    glm::vec3 rotation = glm::vec3(0, 0, 0);   // rotate
-    
-    // material properties (we will ultimately replace this with a Material class - TBD)
-    //
-    ofColor diffuseColor = ofColor::grey;    // default colors - can be changed.
-    ofColor specularColor = ofColor::lightGray;
-    
-    bool isSelectable = true;
-    bool isLight = false;
-    int index;
-};
-
-class Light: public SceneObject {
-public:
-//    Light(glm::vec3 p, float intensity, ofColor diffuse = ofColor::lightGray) { position = p; diffuseColor = diffuse; this->intensity = intensity; }
-
-    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
-        return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
-    }
-    void draw()
-    {
-        ofDrawSphere(position, radius);
-    }
-    
-    virtual bool isIlluminated(glm::vec3 lightDirection, int angle) = 0;
-    
-    float radius = 0.1;
-    float intensity = 1.0;
-};
-
-class PointLight: public Light {
-public:
-    PointLight(glm::vec3 p, float intensity, ofColor diffuse = ofColor::lightGray) { position = p; diffuseColor = diffuse; this->intensity = intensity; isLight = true; }
-    PointLight() { }
-    void draw()
-    {
-        ofDrawSphere(position, radius);
-    }
-    bool isIlluminated(glm::vec3 lightDirection, int angle) { return true; }
-};
-
-class SpotLight: public Light {
-public:
-    SpotLight(glm::vec3 p, float intensity, glm::vec3 spotDirection, float angle, ofColor diffuse = ofColor::lightGray) { position = p; diffuseColor = diffuse; direction = spotDirection; this->intensity = intensity; isLight = true; }
-    void draw()
-    {
-        ofSetColor(ofColor::coral);
-        ofDrawSphere(position, radius);
-    }
-    bool isIlluminated(glm::vec3 lightDirection, int angle);
-    
-    glm::vec3 direction;
-    // float exponent;
-    
-};
-
-//  General purpose sphere  (assume parametric)
-//
-class Sphere: public SceneObject {
-public:
-    Sphere(glm::vec3 p, float r, ofColor diffuse = ofColor::lightGray) { position = p; radius = r; diffuseColor = diffuse; }
-    Sphere() {}
-    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) {
-        return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
-    }
-    void draw()  {
-        ofDrawSphere(position, radius);
-    }
-    
-    float radius = 1.0;
-};
-
-//  Mesh class (will complete later- this will be a refinement of Mesh from Project 1)
-//
-class Mesh : public SceneObject {
-    bool intersect(const Ray &ray, glm::vec3 &point, glm::vec3 &normal) { return false;  }
-    void draw() { }
-};
-
-
-//  General purpose plane
-//
-class Plane: public SceneObject {
-public:
-    Plane(glm::vec3 p, glm::vec3 n, ofColor diffuse = ofColor::darkOliveGreen, float w = 20, float h = 20 ) {
-        position = p; normal = n;
-        width = w;
-        height = h;
-        diffuseColor = diffuse;
-        plane.rotateDeg(90, 1, 0, 0);
-        isSelectable = false;
-    }
-    Plane() { }
-    glm::vec3 normal = glm::vec3(0, 1, 0);
-    bool intersect(const Ray &ray, glm::vec3 & point, glm::vec3 & normal);
-    void draw() {
-        plane.setPosition(position);
-        plane.setWidth(width);
-        plane.setHeight(height);
-        plane.setResolution(4, 4);
-        plane.drawWireframe();
-    }
-    ofPlanePrimitive plane;
-    float width = 20;
-    float height = 20;
-    
-};
-
-// view plane for render camera
-//
-class  ViewPlane: public Plane {
-public:
-    ViewPlane(glm::vec2 p0, glm::vec2 p1) { min = p0; max = p1; }
-    
-    ViewPlane() {                         // create reasonable defaults (6x4 aspect)
-        min = glm::vec2(-3, -2);
-        max = glm::vec2(3, 2);
-        position = glm::vec3(0, 0, 5);
-        normal = glm::vec3(0, 0, 1);      // viewplane currently limited to Z axis orientation
-    }
-    
-    void setSize(glm::vec2 min, glm::vec2 max) { this->min = min; this->max = max; }
-    float getAspect() { return width() / height(); }
-    
-    glm::vec3 toWorld(float u, float v);   //   (u, v) --> (x, y, z) [ world space ]
-    
-    void draw() {
-        ofDrawRectangle(glm::vec3(min.x, min.y, position.z), width(), height());
-    }
-    
-    
-    float width() {
-        return (max.x - min.x);
-    }
-    float height() {
-        return (max.y - min.y);
-    }
-    
-    // some convenience methods for returning the corners
-    //
-    glm::vec2 topLeft() { return glm::vec2(min.x, max.y); }
-    glm::vec2 topRight() { return max; }
-    glm::vec2 bottomLeft() { return min;  }
-    glm::vec2 bottomRight() { return glm::vec2(max.x, min.y); }
-    
-    //  To define an infinite plane, we just need a point and normal.
-    //  The ViewPlane is a finite plane so we need to define the boundaries.
-    //  We will define this in terms of min, max  in 2D.
-    //  (in local 2D space of the plane)
-    //  ultimately, will want to locate the ViewPlane with RenderCam anywhere
-    //  in the scene, so it is easier to define the View rectangle in a local'
-    //  coordinate system.
-    //
-    glm::vec2 min, max;
-};
-
-
-//  render camera  - currently must be z axis aligned (we will improve this in project 4)
-//
-class RenderCam: public SceneObject {
-public:
-    RenderCam() {
-        position = glm::vec3(0, 0, 10);
-        aim = glm::vec3(0, 0, -1);
-    }
-    Ray getRay(float u, float v);
-    void draw() { ofDrawBox(position, 1.0); };
-    void drawFrustum();
-    
-    glm::vec3 aim;
-    ViewPlane view;          // The camera viewplane, this is the view that we will render
-};
-
-
+#include "Scene.h"
+#include "Renderer.h"
+#include "ProgressiveRenderer.h"
+#include "ImageWriter.h"
+#include "SequenceRenderer.h"
+#include "Profiler.h"
+#include "ViewportBatch.h"
 
 class ofApp : public ofBaseApp{
     
@@ -220,15 +29,13 @@ public:
     void dragEvent(ofDragInfo dragInfo);
     void gotMessage(ofMessage msg);
     void render();
-    ofColor rayTrace(const Ray &ray);
+    bool needsRender();
+    void markRendered();
+    void startPreview();
+    RenderSettings renderSettings();
     void drawGrid();
     void drawAxis(glm::vec3 position);
     
-//    ofColor lambert(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse);
-    bool inShadow(const Ray &ray);
-    ofColor phong(const glm::vec3 &p, const glm::vec3 &norm, const ofColor diffuse, const ofColor specular, float power);
-    ofColor ambient(const ofColor diffuse, float percentage);
-    
     
     bool bHide = true;
     bool bShowImage = false;
@@ -239,13 +46,38 @@ public:
     ofCamera previewCam;
     ofCamera  *theCam;    // set to current camera either mainCam or sideCam
     
-    // set up one render camera to render image throughn
+    // the scene (objects, lights and the render camera to render image through)
     //
-    RenderCam renderCam;
+    Scene scene;
+    Renderer renderer;
     ofImage image;
     
-    vector<SceneObject *> scene;
-    vector<Light *> lights;
+    // the scene and pixel grid as the viewport draws them, in a few
+    // batched buffers (see ViewportBatch.h)
+    ViewportBatch viewport;
+    
+    // saves rendered images in the background (output format toggles with 'o')
+    ImageWriter writer;
+    string outputExt = "jpg";
+    
+    // renders the whole animation to spotlight<frame> images in the
+    // background (start or cancel with 'v')
+    SequenceRenderer sequence;
+    bool bSequence = false;
+    
+    // background renderer for interactive edits (toggle with 'p')
+    ProgressiveRenderer preview;
+    ofPixels previewPixels;
+    bool bProgressive = true;
+    bool bAdaptive = true;          // adaptive anti-aliasing (toggle with 'a')
+    
+    // what image currently shows, see needsRender()
+    bool bRendered = false;
+    unsigned long renderedVersion = 0;
+    RenderSettings renderedSettings;
+    RenderCam renderedCam;
+    int renderedWidth = 0;
+    int renderedHeight = 0;
     
     int imageWidth = 1200;
     int imageHeight = 800;
@@ -255,7 +87,19 @@ public:
     ofxFloatSlider lightIntensity;
     ofxIntSlider phongExponent;
     ofxIntSlider spotlightAngle;
+    ofxIntSlider lightSamples;
+    ofxIntSlider maxDepth;
     ofxPanel gui;
+    float appliedLightIntensity = 0.8;     // last Light Intensity given to the scene's lights
+    
+    // where render time goes, refreshed every second in builds with
+    // RT_PROFILE (see Profiler.h); 't' saves it as a Chrome trace
+    //
+    void updateProfile();
+    ofxGuiGroup profileGroup;
+    ofxLabel profileLabels[STAGE_COUNT];
+    ProfileStats lastProfile;
+    uint64_t lastProfileTime = 0;
     
     // OBJECT CREATION, DELETION, AND TRANSLATION
     bool mouseToDragPlane(int x, int y, glm::vec3 &point);
@@ -264,6 +108,8 @@ public:
     void addSphere();
     void deleteSphere(SceneObject * obj);
     void addLight();
+    void addMesh(const string &path);
+    void scatterInstances(SceneObject * obj);
     vector<SceneObject *> selected;
     bool bDrag = false;
     bool bAltKeyDown = false;
@@ -272,18 +118,8 @@ public:
     bool rotateZ = false;
     glm::vec3 lastPoint;
     
-    // KEYFRAME ANIMATION
-    glm::vec3 linearAnimation(glm::vec3 key1, glm::vec3 key2);
-    glm::vec3 easeInOutAnimation(glm::vec3 key1, glm::vec3 key2);
+    // KEYFRAME ANIMATION (keys live in scene.tracks)
     bool bPlayback = false;
     int currentFrame = 1;
-    int frameMax = 200;
-    int frameMin = 1;
-    glm::vec3 key1;
-    glm::vec3 key2;
-    glm::vec3 key3;
-    glm::vec3 key4;
-    glm::vec3 key5;
-    glm::vec3 key6;
     
 };
@@ -0,0 +1,55 @@
+#include "tests.h"
+#include "Scene.h"
+#include "Renderer.h"
+
+// Average brightness (r + g + b, before clamping) over the image
+//
+static double brightness(const FrameBuffer &frame) {
+    double sum = 0;
+    for (int j = 0; j < frame.getHeight(); j++) {
+        for (int i = 0; i < frame.getWidth(); i++) {
+            glm::vec3 c = frame.getColor(i, j);
+            sum += c.x + c.y + c.z;
+        }
+    }
+    return sum / (frame.getWidth() * frame.getHeight());
+}
+
+// Sampled lights must average out to the image with every light: one point
+// light that reaches the spheres, and two spotlights next to each other
+// pointing away.  The tree often picks the spotlights' subtree and only
+// finds at their leaves that neither reaches the point - such a sample
+// must count as 0, not end the point's sampling.
+//
+bool testLightSampling() {
+    Scene scene;
+    scene.add<Sphere>(glm::vec3(-1, 0, 0), 2.0, ofColor::blue);
+    scene.add<Sphere>(glm::vec3(1, 0, -4), 2.0, ofColor::lightGreen);
+    scene.add<Sphere>(glm::vec3(0, 0, 2), 1.0, ofColor::red);
+    scene.add<Plane>(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray);
+    scene.add<PointLight>(glm::vec3(-4, 6, 4), 0.8, ofColor::white);
+    scene.add<SpotLight>(glm::vec3(4, 6, 4), 0.8, glm::vec3(0, 1, 0), 50, ofColor::white);
+    scene.add<SpotLight>(glm::vec3(5, 6, 4), 0.8, glm::vec3(0, 1, 0), 50, ofColor::white);
+    
+    RenderSettings settings;
+    settings.adaptive = false;
+    settings.nSquares = 1;
+    Renderer renderer;
+    FrameBuffer exhaustive;
+    exhaustive.allocate(120, 80);
+    renderer.accumulate(scene, settings, exhaustive);
+    
+    // every pass reseeds the samples, so the passes average out
+    //
+    settings.lightSamples = 2;
+    FrameBuffer sampled;
+    sampled.allocate(120, 80);
+    int passes = 64;
+    for (int i = 0; i < passes; i++) renderer.accumulate(scene, settings, sampled);
+    
+    double expected = brightness(exhaustive), actual = brightness(sampled);
+    double error = fabs(actual - expected) / expected;
+    cout << "  " << settings.lightSamples << " of " << scene.lights.size() << " lights over " << passes << " passes: brightness "
+         << actual << ", every light " << expected << " (" << error * 100 << "% off)" << endl;
+    return check(error < 0.01, "sampled lights don't average out to every light");
+}
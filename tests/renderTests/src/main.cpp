@@ -0,0 +1,49 @@
+#include "ofMain.h"
+#include "tests.h"
+
+//  Render tests
+//
+//  Checks of the guarantees the core documents but the app can't show: that
+//  the image doesn't depend on how the work was split, and that the fast
+//  paths agree with the simple ones.  Usage:
+//
+//    renderTests [name ...]
+//
+//  Runs every test, or only the named ones, and exits with 1 if any failed.
+//
+struct Test {
+    const char *name;
+    bool (*run)();
+};
+
+static const Test tests[] = {
+    { "threads", testThreadDeterminism },
+    { "packets", testPacketKernels },
+    { "lights", testLightSampling },
+    { "images", testImageWriter },
+};
+
+bool check(bool condition, const string &what) {
+    if (!condition) cout << "  FAILED: " << what << endl;
+    return condition;
+}
+
+//========================================================================
+int main(int argc, char *argv[]) {
+    ofSetDataPathRoot("./");
+    int run = 0, failed = 0;
+    for (const Test &test : tests) {
+        bool named = argc == 1;
+        for (int i = 1; i < argc; i++) named = named || test.name == string(argv[i]);
+        if (!named) continue;
+        cout << test.name << endl;
+        run++;
+        if (!test.run()) failed++;
+    }
+    if (run == 0) {
+        cout << "usage: renderTests [name ...]" << endl;
+        return 1;
+    }
+    cout << run - failed << " of " << run << " tests passed" << endl;
+    return failed > 0 ? 1 : 0;
+}
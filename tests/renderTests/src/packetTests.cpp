@@ -0,0 +1,77 @@
+#include "tests.h"
+#include "Scene.h"
+#include "RayPacket.h"
+
+// Two hits agree if they are the same primitive at the same distance, to
+// within packetTolerance - or, where two primitives are that close
+// together along the ray, either of them
+//
+static bool sameHit(float t, int id, float tScalar, int idScalar) {
+    if (idScalar < 0 || id < 0) return id == idScalar;
+    return fabsf(t - tScalar) <= packetTolerance * std::max(1.0f, fabsf(tScalar));
+}
+
+// Every SIMD kernel set this CPU supports against the scalar kernels, on
+// random packets of every size against random spheres and planes.  Slots
+// with a negative radius2 (not spheres) and sub-ranges are covered too.
+//
+bool testPacketKernels() {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(-10, 10), unit(-1, 1), size(0.1, 3);
+    auto randomVec = [&](std::uniform_real_distribution<float> &d) { return glm::vec3(d(rng), d(rng), d(rng)); };
+    
+    SphereArrays spheres;
+    spheres.resize(200);
+    for (int i = 0; i < 200; i++) {
+        if (i % 17 == 0) continue;      // left as a non-sphere slot
+        spheres.set(i, randomVec(coord), size(rng));
+    }
+    PlaneArrays planes;
+    for (int i = 0; i < 20; i++) planes.add(randomVec(coord), glm::normalize(randomVec(unit)));
+    
+    const PacketKernels &scalar = packetKernels(SIMD_SCALAR);
+    SimdLevel supported = detectSimdLevel();
+    bool ok = true;
+    for (int level = SIMD_SSE; level <= SIMD_AVX512; level++) {
+        if (level > supported) {
+            cout << "  simd level " << level << ": not supported by this CPU, skipped" << endl;
+            continue;
+        }
+        const PacketKernels &kernels = packetKernels((SimdLevel)level);
+        int compared = 0, hits = 0, mismatches = 0;
+        for (int round = 0; round < 2000; round++) {
+            RayPacket packet;
+            int n = 1 + round % maxPacketSize;
+            for (int i = 0; i < n; i++) packet.add(Ray(randomVec(coord), glm::normalize(randomVec(unit))));
+            int first = round % 3 == 0 ? round % 50 : 0;
+            int last = round % 3 == 0 ? 150 : spheres.x.size();
+            
+            // spheres alone, then planes on top of the same hits
+            //
+            PacketHits expected, actual;
+            expected.reset(n);
+            actual.reset(n);
+            for (int pass = 0; pass < 2; pass++) {
+                if (pass == 0) {
+                    scalar.spheres(packet, spheres, first, last, 0, expected);
+                    kernels.spheres(packet, spheres, first, last, 0, actual);
+                }
+                else {
+                    scalar.planes(packet, planes, 0, planes.size(), 1000, expected);
+                    kernels.planes(packet, planes, 0, planes.size(), 1000, actual);
+                }
+                for (int i = 0; i < n; i++, compared++) {
+                    if (expected.id[i] >= 0) hits++;
+                    if (sameHit(actual.t[i], actual.id[i], expected.t[i], expected.id[i])) continue;
+                    if (mismatches++ < 5) {
+                        cout << "  " << kernels.name << " ray " << i << " of round " << round << ": hit " << actual.id[i] << " at " << actual.t[i]
+                             << ", scalar " << expected.id[i] << " at " << expected.t[i] << endl;
+                    }
+                }
+            }
+        }
+        cout << "  " << kernels.name << ": " << compared - mismatches << " of " << compared << " ray tests (" << hits << " hits) match the scalar kernels" << endl;
+        ok = check(mismatches == 0, string(kernels.name) + " kernels disagree with the scalar ones") && ok;
+    }
+    return ok;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  The tests renderTests runs.  Each prints what it checked and returns
+//  false if anything failed.
+//
+bool testThreadDeterminism();
+bool testPacketKernels();
+bool testLightSampling();
+bool testImageWriter();
+
+//  Print a failure and return false unless condition holds
+//
+bool check(bool condition, const string &what);
@@ -0,0 +1,49 @@
+#include "tests.h"
+#include "Scene.h"
+#include "Renderer.h"
+
+static vector<unsigned char> render(Renderer &renderer, Scene &scene, const RenderSettings &settings) {
+    ofPixels pixels;
+    pixels.allocate(300, 200, OF_IMAGE_COLOR);
+    renderer.render(scene, settings, pixels);
+    return vector<unsigned char>(pixels.getData(), pixels.getData() + pixels.size());
+}
+
+// The default scene on one thread and on many must give the same bytes,
+// with every option that changes how pixels are sampled.  The many-thread
+// renderer is reused for every image, so they mustn't depend on what it
+// rendered before either.
+//
+bool testThreadDeterminism() {
+    RenderSettings base;
+    Scene scene;
+    scene.setupDefault(base.lightIntensity, base.spotlightAngle);
+    int threads = std::max(4, (int)std::thread::hardware_concurrency());
+    
+    struct Case {
+        const char *name;
+        RenderSettings settings;
+    };
+    vector<Case> cases(4, { "", base });
+    cases[0].name = "uniform anti-aliasing";
+    cases[0].settings.adaptive = false;
+    cases[1].name = "adaptive anti-aliasing";
+    cases[1].settings.adaptive = true;
+    cases[2].name = "light sampling";
+    cases[2].settings.lightSamples = 1;
+    cases[3].name = "light budget";
+    cases[3].settings.lightBudget = 200000;      // about 1 light per point, 2 (all) if misjudged
+    
+    Renderer many(threads);
+    bool ok = true;
+    for (int frame : { scene.frameMin, (scene.frameMin + scene.frameMax) / 2 }) {
+        scene.setFrame(frame);
+        for (const Case &c : cases) {
+            Renderer one(1);
+            bool same = render(one, scene, c.settings) == render(many, scene, c.settings);
+            cout << "  frame " << frame << ", " << c.name << ": 1 and " << threads << " threads " << (same ? "match" : "differ") << endl;
+            ok = check(same, c.name + string(" depends on the thread count or what was rendered before")) && ok;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,42 @@
+#include "tests.h"
+#include "ImageWriter.h"
+
+// Frames queued one after another for the same path, as the app queues
+// finalSpotlight: with several writer threads every write must succeed,
+// the file must end up holding the last frame, and no temporary files may
+// be left behind
+//
+bool testImageWriter() {
+    const string path = "writerTest.ppm";
+    const int rounds = 200, frames = 8, width = 64, height = 32;
+    int stale = 0;
+    ImageWriter writer;
+    for (int round = 0; round < rounds; round++) {
+        for (int frame = 0; frame < frames; frame++) {
+            ofPixels pixels = writer.recycle(width, height);
+            pixels.set(frame);
+            writer.write(std::move(pixels), path);
+        }
+        writer.flush();
+        
+        // the pixels are the last bytes of a raw PPM
+        //
+        ifstream in(ofToDataPath(path), ios::binary);
+        vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (bytes.size() < width * height * 3 || bytes.back() != frames - 1) stale++;
+    }
+    std::remove(ofToDataPath(path).c_str());
+    
+    int leftover = 0;
+    ofDirectory dir(ofToDataPath(""));
+    dir.allowExt("ppm");
+    dir.listDir();
+    for (int i = 0; i < dir.size(); i++) {
+        if (ofIsStringInString(dir.getName(i), "writerTest.partial")) leftover++;
+    }
+    cout << "  " << rounds << " rounds of " << frames << " frames to one path: " << writer.getErrors() << " failed, "
+         << stale << " left an older frame, " << leftover << " temporary files left" << endl;
+    bool ok = check(writer.getErrors() == 0, "writes to the same path failed");
+    ok = check(stale == 0, "an older frame was written last") && ok;
+    return check(leftover == 0, "temporary files were left behind") && ok;
+}
@@ -0,0 +1,192 @@
+#include "ofMain.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "SequenceRenderer.h"
+#include "DistributedRenderer.h"
+#include "Profiler.h"
+#include "TextureCache.h"
+
+//  Headless batch renderer
+//
+//  Renders frames of the scene's keyframe animation through the same core as
+//  the interactive app, without opening a window or creating a GL context,
+//  and writes them to disk.  Usage:
+//
+//    headlessRender [-scene file] [-frames N] [-start F] [-width W] [-height H]
+//                   [-threads T] [-framesInFlight N] [-memory MB] [-textureMemory MB] [-resume 0|1]
+//                   [-adaptive 0|1] [-lightSamples N] [-lightBudget N] [-maxDepth N]
+//                   [-out prefix] [-ext jpg|png|bmp|ppm]
+//                   [-mesh file.obj|file.ply ...] [-save file] [-trace file.json] [-listen address [-region N] [-timeout S]]
+//    headlessRender -worker address [-threads T] [-timeout S]
+//
+//  Frame F is written to <prefix><F zero padded to 4>.<ext>, encoded on
+//  background threads while other frames are traced (ppm is written raw).
+//  Frames are rendered several at once (see SequenceRenderer): by default as
+//  many as there are threads and frames, and as fit in -memory megabytes;
+//  -framesInFlight 1 renders one frame at a time on all threads.  With
+//  -resume 1, frames already on disk are skipped, so an interrupted
+//  sequence can be restarted with the same command.
+//  -maxDepth caps the reflection and refraction bounces of mirror and
+//  glass materials (0 shades them like any other).
+//  -textureMemory is the texture cache's budget (see TextureCache): image
+//  maps of any size render in it, read from disk a tile at a time.
+//  -scene renders a scene file (text or compiled) instead of the demo
+//  scene, and each -mesh is added to the scene at its own coordinates.
+//  -save writes the scene out before rendering - a .scene file as text,
+//  anything else compiled for fast loading.  With -frames 0 that is all it
+//  does:
+//
+//    headlessRender -scene city.scene -save city.scenebin -frames 0
+//
+//  -listen renders on worker processes instead (see DistributedRenderer),
+//  in regions N pixels square (0 = whole frames), and -worker runs one.
+//  Addresses are host:port or unix:path.  Workers that don't answer for
+//  -timeout seconds are dropped, and workers wait that long for the
+//  coordinator to start.
+//
+//  Built with RT_PROFILE (see Profiler.h), it prints how the render time
+//  splits between the stages, and -trace writes a Chrome trace of it.
+//
+static void usage() {
+    cout << "usage: headlessRender [-scene file] [-frames N] [-start F] [-width W] [-height H] [-threads T] [-framesInFlight N] [-memory MB] [-textureMemory MB] [-resume 0|1] [-adaptive 0|1] [-lightSamples N] [-lightBudget N] [-maxDepth N] [-out prefix] [-ext jpg|png|bmp|ppm] [-mesh file.obj|file.ply ...] [-save file] [-trace file.json] [-listen address [-region N] [-timeout S]]" << endl;
+    cout << "       headlessRender -worker address [-threads T] [-timeout S]" << endl;
+}
+
+// Stage times of everything rendered (in profiling builds), and the trace
+//
+static bool reportProfile(const string &tracePath) {
+    if (Profiler::isEnabled()) {
+        ProfileStats stats = Profiler::getStats();
+        double total = std::max(stats.totalMs(), 1e-6);
+        cout << "time by stage, summed over threads:" << endl;
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            cout << "  " << ProfileStats::stageName(s) << ": " << stats.ms[s] << " ms (" << (int)(100 * stats.ms[s] / total + 0.5) << "%), "
+                 << stats.calls[s] << " calls" << endl;
+        }
+    }
+    return tracePath.empty() || Profiler::writeChromeTrace(tracePath);
+}
+
+//========================================================================
+int main(int argc, char *argv[]) {
+    Scene scene;
+    RenderSettings settings;
+    int frames = 1;
+    int start = -1;
+    int width = 1200;
+    int height = 800;
+    int threads = 0;
+    string prefix = "frame";
+    string ext = "jpg";
+    vector<string> meshes;
+    string scenePath;
+    string savePath;
+    int framesInFlight = 0;
+    int memoryMB = 2048;
+    int textureMB = 0;
+    bool resume = false;
+    string listenAddress;
+    string workerAddress;
+    int regionSize = 256;
+    float timeout = 60;
+    string tracePath;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) { usage(); return 1; }
+        string value = argv[++i];
+        if (arg == "-scene") scenePath = value;
+        else if (arg == "-save") savePath = value;
+        else if (arg == "-frames") frames = ofToInt(value);
+        else if (arg == "-start") start = ofToInt(value);
+        else if (arg == "-width") width = ofToInt(value);
+        else if (arg == "-height") height = ofToInt(value);
+        else if (arg == "-threads") threads = ofToInt(value);
+        else if (arg == "-framesInFlight") framesInFlight = ofToInt(value);
+        else if (arg == "-memory") memoryMB = ofToInt(value);
+        else if (arg == "-textureMemory") textureMB = ofToInt(value);
+        else if (arg == "-resume") resume = ofToBool(value);
+        else if (arg == "-adaptive") settings.adaptive = ofToBool(value);
+        else if (arg == "-lightSamples") settings.lightSamples = ofToInt(value);
+        else if (arg == "-lightBudget") settings.lightBudget = ofToInt(value);
+        else if (arg == "-maxDepth") settings.maxDepth = ofToInt(value);
+        else if (arg == "-out") prefix = value;
+        else if (arg == "-ext") ext = value;
+        else if (arg == "-mesh") meshes.push_back(value);
+        else if (arg == "-listen") listenAddress = value;
+        else if (arg == "-worker") workerAddress = value;
+        else if (arg == "-region") regionSize = ofToInt(value);
+        else if (arg == "-timeout") timeout = ofToFloat(value);
+        else if (arg == "-trace") tracePath = value;
+        else { usage(); return 1; }
+    }
+    
+    // output paths are relative to where we were launched, not bin/data
+    //
+    ofSetDataPathRoot("./");
+    if (textureMB > 0) TextureCache::shared().setBudget((size_t)textureMB << 20);
+    
+    if (!workerAddress.empty()) {
+        RenderWorker worker(threads);
+        worker.timeout = timeout;
+        bool ok = worker.serve(workerAddress);
+        return reportProfile(tracePath) && ok ? 0 : 1;
+    }
+    
+    if (scenePath.empty()) scene.setupDefault(settings.lightIntensity, settings.spotlightAngle);
+    else if (!scene.load(scenePath)) return 1;
+    for (const string &path : meshes) {
+        shared_ptr<TriangleMesh> mesh = make_shared<TriangleMesh>();
+        if (!mesh->load(path)) return 1;
+        scene.add<Mesh>(mesh, glm::vec3(0, 0, 0));
+        scene.markChanged();
+    }
+    if (!savePath.empty() && !scene.save(savePath)) return 1;
+    if (frames <= 0) return 0;
+    if (start < 0) start = scene.frameMin;
+    
+    if (!listenAddress.empty()) {
+        RenderCoordinator coordinator;
+        coordinator.regionSize = regionSize;
+        coordinator.timeout = timeout;
+        coordinator.bResume = resume;
+        coordinator.onFrame = [](int frame) { cout << "frame " << frame << endl; };
+        bool ok = coordinator.render(scene, settings, width, height, start, start + frames - 1, prefix, ext, listenAddress);
+        
+        const DistributedStats &stats = coordinator.getStats();
+        if (stats.skipped > 0) cout << stats.skipped << " frames already written, skipped" << endl;
+        if (stats.frames > 0) {
+            cout << stats.frames << " frames at " << width << "x" << height << " on " << stats.workers << " workers: "
+                 << stats.wallMs / stats.frames << " ms/frame, " << (uint64_t)(stats.wallMs > 0 ? stats.rays / (stats.wallMs / 1000.0) : 0) << " rays/s, "
+                 << stats.bytesReceived / 1024 << " of " << stats.bytesRendered / 1024 << " KB sent, " << stats.reassigned << " jobs reassigned" << endl;
+        }
+        return reportProfile(tracePath) && ok ? 0 : 1;
+    }
+    
+    SequenceRenderer sequence(threads);
+    sequence.framesInFlight = framesInFlight;
+    sequence.memoryBudgetMB = memoryMB;
+    sequence.bResume = resume;
+    sequence.onFrame = [](int frame, const RenderStats &stats) {
+        cout << "frame " << frame << ": " << stats.renderMs << " ms, " << stats.primaryRays << " primary + "
+             << stats.shadowRays << " shadow rays (" << stats.samplesPerPixel << " samples/pixel), "
+             << (uint64_t)stats.raysPerSecond() << " rays/s" << endl;
+    };
+    bool ok = sequence.render(scene, settings, width, height, start, start + frames - 1, prefix, ext);
+    
+    const SequenceStats &stats = sequence.getStats();
+    if (stats.skipped > 0) cout << stats.skipped << " frames already written, skipped" << endl;
+    if (stats.frames > 0) {
+        cout << stats.frames << " frames at " << width << "x" << height << ", " << stats.framesInFlight << " at a time on "
+             << (threads > 0 ? threads : std::thread::hardware_concurrency()) << " threads: " << stats.wallMs / stats.frames << " ms/frame, "
+             << (uint64_t)(stats.wallMs > 0 ? stats.rays / (stats.wallMs / 1000.0) : 0) << " rays/s" << endl;
+    }
+    TextureCacheStats textures = TextureCache::shared().getStats();
+    if (textures.textures > 0) {
+        cout << textures.textures << " textures: " << textures.tileReads << " tiles read, " << textures.evictions << " evicted, "
+             << textures.residentBytes / (1 << 20) << " of " << textures.budgetBytes / (1 << 20) << " MB in memory";
+        if (textures.failedLoads > 0) cout << ", " << textures.failedLoads << " lookups found every tile in use";
+        cout << endl;
+    }
+    return reportProfile(tracePath) && ok ? 0 : 1;
+}
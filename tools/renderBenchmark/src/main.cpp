@@ -0,0 +1,436 @@
+#include "ofMain.h"
+#include "Scene.h"
+#include "Renderer.h"
+#include "Profiler.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+//  Render benchmark
+//
+//  Renders a fixed set of reproducible scenes through the same core as the
+//  app and writes the timings as JSON, so runs can be compared across
+//  changes and machines.  Usage:
+//
+//    renderBenchmark [-scene name|file ...] [-frames N] [-width W] [-height H]
+//                    [-threads T] [-adaptive 0|1] [-lightSamples N] [-lightBudget N] [-maxDepth N]
+//                    [-mesh file.obj|file.ply] [-out file.json]
+//
+//  Scenes are "default" (the app's 3 sphere scene), "spheres" (10k random
+//  spheres), "mesh" (a 1M triangle torus, or the -mesh file), "lights"
+//  (the default scene lit by 64 point lights), "mirrors" (the default
+//  scene with a mirror, a glass sphere and a reflective floor) and
+//  "instances" (a forest of 100k copies of a 2k triangle torus, or of the
+//  -mesh file).  All of them by default.
+//  Anything else is loaded as a scene file, and its setupMs includes the
+//  load - compare a .scene with its compiled form for the load time.
+//
+//  For each scene:
+//
+//    frameMs          full renders on all threads, best and mean of N
+//    raysPerSecond    primary + secondary + shadow rays of the best frame
+//    secondaryRays    reflected and refracted rays of the best frame
+//    samplesPerPixel  average primary rays per pixel (adaptive anti-aliasing)
+//    lightsPerPoint   lights sampled per shading point, 0 for all of them
+//    primaryNsPerRay  closest hit of one ray per pixel, on one thread, both
+//                     one ray at a time and in packets
+//    shadowNsPerRay   occlusion of the shadow rays from those hits to every
+//                     light, on one thread
+//    peakMemoryMB     peak resident size of the process so far - run one
+//                     scene per process for a per-scene figure
+//    stageMs          built with RT_PROFILE only: mean time per frame in
+//                     each stage of the renders (see Profiler.h), summed
+//                     over the threads
+//
+static void usage() {
+    cout << "usage: renderBenchmark [-scene default|spheres|mesh|lights|mirrors|instances|file ...] [-frames N] [-width W] [-height H] [-threads T] [-adaptive 0|1] [-lightSamples N] [-lightBudget N] [-maxDepth N] [-mesh file.obj|file.ply] [-out file.json]" << endl;
+}
+
+static const int maxShadowRays = 2000000;      // keeps the pre-generated rays to ~50MB
+
+struct BenchmarkResult {
+    string scene;
+    int objects = 0;
+    int lights = 0;
+    uint64_t triangles = 0;     // every copy of instanced meshes
+    float setupMs = 0;
+    float bestFrameMs = 0;
+    float meanFrameMs = 0;
+    uint64_t primaryRays = 0;
+    uint64_t secondaryRays = 0;
+    uint64_t shadowRays = 0;
+    uint64_t shadowCacheHits = 0;
+    float samplesPerPixel = 0;
+    int lightsPerPoint = 0;
+    double raysPerSecond = 0;
+    double primaryNsPerRay = 0;
+    double primaryPacketNsPerRay = 0;
+    double shadowNsPerRay = 0;
+    double peakMemoryMB = 0;
+    ProfileStats stages;
+};
+
+static double peakMemoryMB() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);        // bytes
+#else
+    return usage.ru_maxrss / 1024.0;                   // kilobytes
+#endif
+#endif
+}
+
+static const char * simdName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SSE: return "sse4.1";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+//  SCENES
+//  All random values come from a fixed seed, so every run traces the same
+//  scene.
+//
+
+static void addDefaultLights(Scene &scene, const RenderSettings &settings) {
+    scene.add<PointLight>(glm::vec3(4, 6, 4), settings.lightIntensity, ofColor::white);
+    scene.add<PointLight>(glm::vec3(-4, 6, 4), settings.lightIntensity, ofColor::white);
+}
+
+static void setupSpheres(Scene &scene, const RenderSettings &settings, int count) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> x(-15, 15), y(-1.5, 10), z(-40, 0), radius(0.1, 0.4);
+    std::uniform_int_distribution<int> channel(40, 255);
+    for (int i = 0; i < count; i++) {
+        ofColor color(channel(random), channel(random), channel(random));
+        scene.add<Sphere>(glm::vec3(x(random), y(random), z(random)), radius(random), color);
+    }
+    scene.add<Plane>(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray);
+    addDefaultLights(scene, settings);
+}
+
+//  Torus of rings x sides quads, tilted towards the camera
+//
+static shared_ptr<TriangleMesh> makeTorus(int rings, int sides, float major, float minor) {
+    shared_ptr<TriangleMesh> mesh = make_shared<TriangleMesh>();
+    float c = cos(glm::radians(60.0f)), s = sin(glm::radians(60.0f));
+    auto tilt = [c, s](glm::vec3 p) { return glm::vec3(p.x, c * p.y - s * p.z, s * p.y + c * p.z); };     // about x
+    for (int i = 0; i < rings; i++) {
+        float u = TWO_PI * i / rings;
+        glm::vec3 ring(cos(u), 0, sin(u));
+        for (int j = 0; j < sides; j++) {
+            float v = TWO_PI * j / sides;
+            glm::vec3 normal = ring * cos(v) + glm::vec3(0, sin(v), 0);
+            mesh->vertices.push_back(tilt(ring * major + normal * minor));
+            mesh->normals.push_back(tilt(normal));
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            uint32_t a = i * sides + j;
+            uint32_t b = ((i + 1) % rings) * sides + j;
+            uint32_t c = ((i + 1) % rings) * sides + (j + 1) % sides;
+            uint32_t d = i * sides + (j + 1) % sides;
+            mesh->indices.insert(mesh->indices.end(), { a, b, c, a, c, d });
+        }
+    }
+    mesh->build();
+    return mesh;
+}
+
+static bool setupMesh(Scene &scene, const RenderSettings &settings, const string &path) {
+    shared_ptr<TriangleMesh> mesh;
+    glm::vec3 position(0, 0, -2);
+    if (path.empty()) {
+        mesh = makeTorus(1024, 512, 3.0, 1.0);
+    }
+    else {
+        mesh = make_shared<TriangleMesh>();
+        if (!mesh->load(path)) return false;
+        position -= mesh->getBounds().center();
+    }
+    scene.add<Mesh>(mesh, position, ofColor::lightSkyBlue);
+    scene.add<Plane>(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray);
+    addDefaultLights(scene, settings);
+    return true;
+}
+
+static void setupLights(Scene &scene, const RenderSettings &settings, int count) {
+    scene.add<Sphere>(glm::vec3(-1, 0, 0), 2.0, ofColor::blue);
+    scene.add<Sphere>(glm::vec3(1, 0, -4), 2.0, ofColor::lightGreen);
+    scene.add<Sphere>(glm::vec3(0, 0, 2), 1.0, ofColor::red);
+    scene.add<Plane>(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray);
+    
+    // a ring of lights with the same total intensity as the default 2
+    //
+    for (int i = 0; i < count; i++) {
+        float angle = TWO_PI * i / count;
+        scene.add<PointLight>(glm::vec3(8 * cos(angle), 6, 8 * sin(angle)), settings.lightIntensity * 2 / count, ofColor::white);
+    }
+}
+
+static void setupMirrors(Scene &scene, const RenderSettings &settings) {
+    scene.setupDefault(settings.lightIntensity, settings.spotlightAngle);
+    scene.tracks.clear();
+    SceneObject *mirror = scene.objects[0];
+    mirror->reflectivity = 0.8;
+    SceneObject *glass = scene.objects[2];
+    glass->transparency = 0.9;
+    glass->refractiveIndex = 1.5;
+    SceneObject *floor = scene.objects[3];
+    floor->reflectivity = 0.3;
+}
+
+// count copies of a small torus, or of the -mesh file, scattered over a
+// 400 x 400 floor
+//
+static bool setupInstances(Scene &scene, const RenderSettings &settings, const string &path, int count) {
+    shared_ptr<TriangleMesh> mesh;
+    if (path.empty()) {
+        mesh = makeTorus(48, 24, 1.0, 0.35);
+    }
+    else {
+        mesh = make_shared<TriangleMesh>();
+        if (!mesh->load(path)) return false;
+    }
+    float size = glm::length(mesh->getBounds().max - mesh->getBounds().min);
+    glm::mat4 center = glm::translate(glm::mat4(1.0), -mesh->getBounds().center());
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> x(-200, 200), z(-400, 0), angle(0, 360), scale(0.5, 1.5);
+    Instances *forest = scene.add<Instances>(mesh, ofColor::forestGreen);
+    for (int i = 0; i < count; i++) {
+        float s = scale(random) * 2 / size;
+        forest->add(makeTransform(glm::vec3(x(random), -2 + s * size / 2, z(random)), glm::vec3(0, angle(random), 0), s) * center);
+    }
+    scene.add<Plane>(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0), ofColor::gray);
+    addDefaultLights(scene, settings);
+    return true;
+}
+
+//  MEASUREMENTS
+//
+
+// Closest hit of one ray through the center of every pixel, one at a time
+// and in packets, on this thread.  Returns the primary hits for the shadow
+// measurement.
+//
+static void timePrimaryRays(const Scene &scene, Renderer &renderer, int width, int height, BenchmarkResult &result, vector<glm::vec3> &hits) {
+    RenderCam cam = scene.renderCam;
+    vector<Ray> rays;
+    rays.reserve(width * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            rays.push_back(cam.getRay((i + 0.5f) / width, (height - (j + 0.5f)) / height));
+        }
+    }
+    
+    vector<int> prims(rays.size());
+    uint64_t start = ofGetElapsedTimeMicros();
+    for (int r = 0; r < rays.size(); r++) {
+        float t;
+        if (!renderer.bvh.intersect(rays[r], prims[r], t)) prims[r] = -1;
+    }
+    result.primaryNsPerRay = (ofGetElapsedTimeMicros() - start) * 1000.0 / rays.size();
+    
+    vector<RayPacket> packets((rays.size() + maxPacketSize - 1) / maxPacketSize);
+    for (int r = 0; r < rays.size(); r++) packets[r / maxPacketSize].add(rays[r]);
+    int packetPrims[maxPacketSize];
+    start = ofGetElapsedTimeMicros();
+    for (const RayPacket &packet : packets) renderer.bvh.intersect(packet, packetPrims);
+    result.primaryPacketNsPerRay = (ofGetElapsedTimeMicros() - start) * 1000.0 / rays.size();
+    
+    vector<Hit> resolved(rays.size());
+    renderer.intersect(rays.data(), rays.size(), resolved.data());
+    for (const Hit &hit : resolved) {
+        if (hit.isHit() && !renderer.store.isLight(hit.prim)) hits.push_back(hit.point);
+    }
+}
+
+// Shadow rays from the primary hits to every light, set up as
+// Renderer::phong() does and traced through Renderer::inShadow(), on this
+// thread
+//
+static void timeShadowRays(const Scene &scene, Renderer &renderer, const vector<glm::vec3> &hits, BenchmarkResult &result) {
+    if (hits.empty() || scene.lights.empty()) return;
+    int stride = std::max<size_t>(1, hits.size() * scene.lights.size() / maxShadowRays);
+    vector<Ray> rays;
+    vector<float> tMax;
+    for (int h = 0; h < hits.size(); h += stride) {
+        for (Light *light : scene.lights) {
+            glm::vec3 l = glm::normalize(light->position - hits[h]);
+            rays.push_back(Ray(hits[h] + 0.001f * l, l));
+            tMax.push_back(glm::length(light->position - rays.back().p));
+        }
+    }
+    
+    TraceContext ctx;
+    int lights = scene.lights.size();
+    int blocked = 0;
+    uint64_t start = ofGetElapsedTimeMicros();
+    for (int r = 0; r < rays.size(); r++) blocked += renderer.inShadow(rays[r], tMax[r], r % lights, ctx);
+    result.shadowNsPerRay = (ofGetElapsedTimeMicros() - start) * 1000.0 / rays.size();
+    if (blocked < 0) cerr << blocked;       // keep the loop from being optimized away
+}
+
+static BenchmarkResult runBenchmark(const string &name, Scene &scene, Renderer &renderer, const RenderSettings &settings, int width, int height, int frames, float setupMs) {
+    BenchmarkResult result;
+    result.scene = name;
+    result.objects = scene.objects.size();
+    result.lights = scene.lights.size();
+    for (SceneObject *obj : scene.objects) {
+        Mesh *mesh = dynamic_cast<Mesh *>(obj);
+        Instances *copies = dynamic_cast<Instances *>(obj);
+        if (mesh && mesh->mesh) result.triangles += mesh->mesh->triangleCount();
+        if (copies && copies->mesh) result.triangles += (uint64_t)copies->mesh->triangleCount() * copies->transforms.size();
+    }
+    
+    // the first render builds the store and the BVH - count that as setup
+    //
+    ofPixels pixels;
+    pixels.allocate(width, height, OF_IMAGE_COLOR);
+    renderer.render(scene, settings, pixels);
+    result.setupMs = setupMs + renderer.getStats().renderMs;
+    
+    double totalMs = 0;
+    Profiler::reset();
+    for (int frame = 0; frame < frames; frame++) {
+        renderer.render(scene, settings, pixels);
+        const RenderStats &stats = renderer.getStats();
+        totalMs += stats.renderMs;
+        if (frame == 0 || stats.renderMs < result.bestFrameMs) {
+            result.bestFrameMs = stats.renderMs;
+            result.primaryRays = stats.primaryRays;
+            result.secondaryRays = stats.secondaryRays;
+            result.shadowRays = stats.shadowRays;
+            result.shadowCacheHits = stats.shadowCacheHits;
+            result.samplesPerPixel = stats.samplesPerPixel;
+            result.lightsPerPoint = stats.lightsPerPoint;
+            result.raysPerSecond = stats.raysPerSecond();
+        }
+    }
+    result.meanFrameMs = totalMs / frames;
+    result.stages = Profiler::getStats();
+    
+    vector<glm::vec3> hits;
+    timePrimaryRays(scene, renderer, width, height, result, hits);
+    timeShadowRays(scene, renderer, hits, result);
+    
+    result.peakMemoryMB = peakMemoryMB();
+    return result;
+}
+
+static void writeJson(ostream &out, const vector<BenchmarkResult> &results, int width, int height, int frames, int threads, const RenderSettings &settings) {
+    out << "{" << endl;
+    out << "  \"width\": " << width << "," << endl;
+    out << "  \"height\": " << height << "," << endl;
+    out << "  \"antiAliasing\": \"" << (settings.adaptive ? "adaptive " : "") << settings.nSquares << "x" << settings.nSquares << "\"," << endl;
+    out << "  \"frames\": " << frames << "," << endl;
+    out << "  \"threads\": " << threads << "," << endl;
+    out << "  \"simd\": \"" << simdName(detectSimdLevel()) << "\"," << endl;
+    out << "  \"scenes\": [" << endl;
+    for (int i = 0; i < results.size(); i++) {
+        const BenchmarkResult &r = results[i];
+        out << "    {" << endl;
+        out << "      \"name\": \"" << r.scene << "\"," << endl;
+        out << "      \"objects\": " << r.objects << "," << endl;
+        out << "      \"lights\": " << r.lights << "," << endl;
+        out << "      \"triangles\": " << r.triangles << "," << endl;
+        out << "      \"setupMs\": " << r.setupMs << "," << endl;
+        out << "      \"frameMs\": { \"best\": " << r.bestFrameMs << ", \"mean\": " << r.meanFrameMs << " }," << endl;
+        out << "      \"primaryRays\": " << r.primaryRays << "," << endl;
+        out << "      \"secondaryRays\": " << r.secondaryRays << "," << endl;
+        out << "      \"shadowRays\": " << r.shadowRays << "," << endl;
+        out << "      \"shadowCacheHits\": " << r.shadowCacheHits << "," << endl;
+        out << "      \"samplesPerPixel\": " << r.samplesPerPixel << "," << endl;
+        out << "      \"lightsPerPoint\": " << r.lightsPerPoint << "," << endl;
+        out << "      \"raysPerSecond\": " << (uint64_t)r.raysPerSecond << "," << endl;
+        out << "      \"primaryNsPerRay\": { \"single\": " << r.primaryNsPerRay << ", \"packet\": " << r.primaryPacketNsPerRay << " }," << endl;
+        out << "      \"shadowNsPerRay\": " << r.shadowNsPerRay << "," << endl;
+        out << "      \"peakMemoryMB\": " << r.peakMemoryMB << (Profiler::isEnabled() ? "," : "") << endl;
+        if (Profiler::isEnabled()) {
+            out << "      \"stageMs\": {";
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                out << (s ? ", " : " ") << "\"" << ProfileStats::stageName(s) << "\": " << r.stages.ms[s] / frames;
+            }
+            out << " }" << endl;
+        }
+        out << "    }" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl;
+    out << "}" << endl;
+}
+
+//========================================================================
+int main(int argc, char *argv[]) {
+    RenderSettings settings;
+    vector<string> scenes;
+    int frames = 5;
+    int width = 600;
+    int height = 400;
+    int threads = 0;
+    string meshPath;
+    string outPath;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) { usage(); return 1; }
+        string value = argv[++i];
+        if (arg == "-scene") scenes.push_back(value);
+        else if (arg == "-frames") frames = std::max(1, ofToInt(value));
+        else if (arg == "-width") width = ofToInt(value);
+        else if (arg == "-height") height = ofToInt(value);
+        else if (arg == "-threads") threads = ofToInt(value);
+        else if (arg == "-adaptive") settings.adaptive = ofToBool(value);
+        else if (arg == "-lightSamples") settings.lightSamples = ofToInt(value);
+        else if (arg == "-lightBudget") settings.lightBudget = ofToInt(value);
+        else if (arg == "-maxDepth") settings.maxDepth = ofToInt(value);
+        else if (arg == "-mesh") meshPath = value;
+        else if (arg == "-out") outPath = value;
+        else { usage(); return 1; }
+    }
+    if (scenes.empty()) scenes = { "default", "spheres", "mesh", "lights", "mirrors", "instances" };
+    
+    // paths are relative to where we were launched, not bin/data
+    //
+    ofSetDataPathRoot("./");
+    
+    Renderer renderer(threads);
+    vector<BenchmarkResult> results;
+    for (const string &name : scenes) {
+        Scene scene;
+        uint64_t start = ofGetElapsedTimeMicros();
+        if (name == "default") scene.setupDefault(settings.lightIntensity, settings.spotlightAngle);
+        else if (name == "spheres") setupSpheres(scene, settings, 10000);
+        else if (name == "mesh") { if (!setupMesh(scene, settings, meshPath)) return 1; }
+        else if (name == "lights") setupLights(scene, settings, 64);
+        else if (name == "mirrors") setupMirrors(scene, settings);
+        else if (name == "instances") { if (!setupInstances(scene, settings, meshPath, 100000)) return 1; }
+        else if (!scene.load(name)) return 1;
+        float setupMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+        
+        results.push_back(runBenchmark(name, scene, renderer, settings, width, height, frames, setupMs));
+        const BenchmarkResult &r = results.back();
+        cerr << name << ": " << r.bestFrameMs << " ms/frame, " << r.samplesPerPixel << " samples/pixel, " << (uint64_t)r.raysPerSecond << " rays/s, "
+             << r.primaryNsPerRay << " ns/primary ray, " << r.shadowNsPerRay << " ns/shadow ray" << endl;
+    }
+    
+    if (outPath.empty()) {
+        writeJson(cout, results, width, height, frames, renderer.tileRenderer.getThreads(), settings);
+    }
+    else {
+        ofstream out(outPath);
+        if (!out) {
+            ofLogError("renderBenchmark") << "can't write " << outPath;
+            return 1;
+        }
+        writeJson(out, results, width, height, frames, renderer.tileRenderer.getThreads(), settings);
+    }
+    return 0;
+}